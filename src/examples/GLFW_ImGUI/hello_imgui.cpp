@@ -353,6 +353,10 @@ int main(int argc, char** argv)
 
         {
             uint32_t image_id = vkal_get_image();
+            if (image_id == VKAL_INVALID_IMAGE) {
+                ImGui::EndFrame();
+                continue; // The swapchain was recreated, try again next frame.
+            }
 
             vkal_begin_command_buffer(image_id);
             vkal_begin_render_pass(image_id, vkal_info->render_pass);
@@ -373,6 +377,8 @@ int main(int argc, char** argv)
             ImDrawData* draw_data = ImGui::GetDrawData();
             // Record dear imgui primitives into command buffer
             ImGui_ImplVulkan_RenderDrawData(draw_data, vkal_info->default_command_buffers[image_id]);
+            // ImGui binds its own pipeline and buffers behind VKAL's back.
+            vkal_invalidate_bind_state(vkal_info->default_command_buffers[image_id]);
 
             // End renderpass and submit the buffer to graphics-queue.
             vkal_end_renderpass(image_id);
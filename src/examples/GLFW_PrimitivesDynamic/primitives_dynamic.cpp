@@ -77,6 +77,8 @@ typedef struct Batch
     DeviceMemory vertex_memory;
     VkalBuffer       index_buffer;
     VkalBuffer       vertex_buffer;
+    uint64_t         index_buffer_offset;  /* where the batch starts within index_buffer */
+    uint64_t         vertex_buffer_offset; /* where the batch starts within vertex_buffer */
 } Batch;
 
 typedef enum RenderCmdType
@@ -231,12 +233,34 @@ void update_batch(Batch * batch)
     memcpy(batch->vertex_buffer.mapped, batch->vertices, PRIMITIVES_VERTEX_BUFFER_SIZE);      
 }
 
+/* Transient batches get rebuilt every frame. Their GPU copy lives in VKAL's per-frame transient
+   memory so frames still in flight keep reading their own data. */
+void create_transient_batch(Batch * batch)
+{
+    batch->indices = (uint16_t*)malloc(PRIMITIVES_INDEX_BUFFER_SIZE);
+    batch->vertices = (Vertex*)malloc(PRIMITIVES_VERTEX_BUFFER_SIZE);
+}
+
+/* Call after vkal_get_image. */
+void update_transient_batch(Batch * batch)
+{
+    VkalTransientAllocation indices = vkal_transient_alloc(batch->index_count*sizeof(uint16_t), sizeof(uint16_t));
+    memcpy(indices.data, batch->indices, batch->index_count*sizeof(uint16_t));
+    VkalTransientAllocation vertices = vkal_transient_alloc(batch->vertex_count*sizeof(Vertex), sizeof(float));
+    memcpy(vertices.data, batch->vertices, batch->vertex_count*sizeof(Vertex));
+
+    batch->index_buffer = indices.buffer;
+    batch->index_buffer_offset = indices.offset;
+    batch->vertex_buffer = vertices.buffer;
+    batch->vertex_buffer_offset = vertices.offset;
+}
+
 void destroy_batch(VkalInfo * vkal_info, Batch * batch)
 {
-    vkDestroyBuffer(vkal_info->device, batch->index_buffer.buffer, NULL);
-    vkDestroyBuffer(vkal_info->device, batch->vertex_buffer.buffer, NULL);
-    vkFreeMemory(vkal_info->device, batch->index_memory.vk_device_memory, NULL);
-    vkFreeMemory(vkal_info->device, batch->vertex_memory.vk_device_memory, NULL);
+    vkal_destroy_buffer(&batch->index_buffer);
+    vkal_destroy_buffer(&batch->vertex_buffer);
+    vkal_free_devicememory(&batch->index_memory);
+    vkal_free_devicememory(&batch->vertex_memory);
 }
 
 MyTexture create_texture(char const * file, uint32_t id)
@@ -798,7 +822,7 @@ int main(int argc, char ** argv)
 
     /* Create batches that hold Buffers for indices and vertices that can get updated every frame */
     /* Global Batch */
-    create_batch(vkal_info, &g_default_batch);
+    create_transient_batch(&g_default_batch);
     create_batch(vkal_info, &g_persistent_batch);
     
     /* Uniform Buffer for view projection matrices */
@@ -852,11 +876,13 @@ int main(int argc, char ** argv)
 	    circle(  500 + radius*cosf(i*theta), 500 + radius*sinf(i*theta), radius, 32, 1, {0, 0.5, 1.0});
 	}
     circle(500, 500, 200.0f, 64, 30, { 1.0, 0.5, 1.0 });
-
-	update_batch(&g_default_batch);
 	
 	{
 	    uint32_t image_id = vkal_get_image();
+	    if (image_id == VKAL_INVALID_IMAGE) {
+	        continue; // The swapchain was recreated, try again next frame.
+	    }
+	    update_transient_batch(&g_default_batch);
 
 	    vkal_begin_command_buffer(image_id);
 	    vkal_begin_render_pass(image_id, vkal_info->render_pass);
@@ -868,7 +894,8 @@ int main(int argc, char ** argv)
 			 width, height);	       
 	    for (uint32_t i = 0; i < render_cmd_count; ++i) {
 		RenderCmd render_cmd = render_commands[i];
-		uint32_t index_offset = render_cmd.index_buffer_offset;
+		uint64_t index_offset = render_cmd.batch->index_buffer_offset + render_cmd.index_buffer_offset;
+		uint64_t vertex_offset = render_cmd.batch->vertex_buffer_offset;
 		uint32_t index_count = render_cmd.index_count;
 		if (render_cmd.type == RENDER_CMD_TEXTURED_RECT) {
 		    uint32_t texture_id = render_cmd.texture_id;
@@ -876,13 +903,13 @@ int main(int argc, char ** argv)
 				       VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(uint32_t), (void*)&render_cmd.texture_id);
 		    vkal_bind_descriptor_set(image_id, &descriptor_sets[1], pipeline_layout_textured_rect);
 		    vkal_draw_indexed_from_buffers(render_cmd.batch->index_buffer, index_offset, index_count,					       
-						   render_cmd.batch->vertex_buffer, 0,
+						   render_cmd.batch->vertex_buffer, vertex_offset,
 						   image_id, graphics_pipeline_textured_rect);
 		}
 		else if (render_cmd.type == RENDER_CMD_STD) {
 		    vkal_bind_descriptor_set(image_id, &descriptor_sets[0], pipeline_layout);
 		    vkal_draw_indexed_from_buffers(render_cmd.batch->index_buffer, index_offset, index_count,					       
-						   render_cmd.batch->vertex_buffer, 0,
+						   render_cmd.batch->vertex_buffer, vertex_offset,
 						   image_id, graphics_pipeline);		
 		}
 	    }
@@ -899,7 +926,6 @@ int main(int argc, char ** argv)
     vkDeviceWaitIdle(vkal_info->device);
 
     destroy_batch(vkal_info, &g_persistent_batch);
-    destroy_batch(vkal_info, &g_default_batch);
     
     vkal_cleanup();
 
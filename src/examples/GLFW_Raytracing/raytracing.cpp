@@ -427,7 +427,7 @@ PipelineInfo create_ray_tracing_pipeline(VkalInfo * vkal_info, uint32_t model_co
     raytracing_pipeline_create_info.maxPipelineRayRecursionDepth = 1;
     raytracing_pipeline_create_info.layout = pipeline_layout;
     VkPipeline pipeline{};
-    vkCreateRayTracingPipelinesKHR(vkal_info->device, VK_NULL_HANDLE, VK_NULL_HANDLE, 1, &raytracing_pipeline_create_info, nullptr, &pipeline);
+    vkCreateRayTracingPipelinesKHR(vkal_info->device, VK_NULL_HANDLE, vkal_info->pipeline_cache, 1, &raytracing_pipeline_create_info, nullptr, &pipeline);
 
     return { pipeline, pipeline_layout, shader_groups, descriptor_set_layout } ;
 }
@@ -1269,6 +1269,9 @@ int main(int argc, char** argv)
 
         {
             uint32_t image_id = vkal_get_image();
+            if (image_id == VKAL_INVALID_IMAGE) {
+                continue; // The swapchain was recreated, try again next frame.
+            }
          
             VkCommandBuffer command_buffers1[] = { vkal_info->default_command_buffers[image_id] };
             vkal_queue_submit(command_buffers1, 1);
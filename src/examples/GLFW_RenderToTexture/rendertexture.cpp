@@ -272,15 +272,20 @@ int main(int argc, char ** argv)
 	
     
     // Main Loop
+    uint32_t frame_count = 0;
     while (!glfwWindowShouldClose(window))
     {
 	    glfwPollEvents();
 
 	    {
 	        uint32_t image_id = vkal_get_image();
+	        if (image_id == VKAL_INVALID_IMAGE) {
+	            continue; // The swapchain was recreated, try again next frame.
+	        }
 
 	        vkal_begin_command_buffer(image_id);
 
+	        vkal_gpu_scope_begin(vkal_info->default_command_buffers[image_id], "render to texture");
 	        vkal_begin_render_to_image_render_pass(image_id, vkal_info->default_command_buffers[image_id],
 						       vkal_info->render_to_image_render_pass, render_image);
 	        vkal_viewport(vkal_info->default_command_buffers[image_id], 0, 0, render_image.width, render_image.height);
@@ -300,7 +305,9 @@ int main(int argc, char ** argv)
 			          offset_indices, index_count,
 			          offset_vertices, 1);
 	        vkal_end_renderpass(image_id);
+	        vkal_gpu_scope_end(vkal_info->default_command_buffers[image_id], "render to texture");
 
+	        vkal_gpu_scope_begin(vkal_info->default_command_buffers[image_id], "composite");
 	        vkal_begin_render_pass(image_id, vkal_info->render_pass);
 	        vkal_viewport(vkal_info->default_command_buffers[image_id], 0, 0,
 			      2*image2.width, 2*image2.height);
@@ -311,12 +318,17 @@ int main(int argc, char ** argv)
 			          offset_indices, index_count,
 			          offset_vertices, 1);
 	        vkal_end_renderpass(image_id);
+	        vkal_gpu_scope_end(vkal_info->default_command_buffers[image_id], "composite");
 	    
 	        vkal_end_command_buffer(image_id);
 	        VkCommandBuffer command_buffers1[] = { vkal_info->default_command_buffers[image_id] };
 	        vkal_queue_submit(command_buffers1, 1);
 
 	        vkal_present(image_id);
+
+	        if (++frame_count % 1000 == 0) {
+	            vkal_print_gpu_profile();
+	        }
 	    }
     }
     
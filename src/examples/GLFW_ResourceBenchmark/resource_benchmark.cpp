@@ -0,0 +1,129 @@
+/* Resource creation throughput.
+
+   Creates and destroys a few thousand buffers and images and reports how long it took.
+   For comparison it also times the per-resource queries VKAL used to do on every creation
+   (find_queue_families and vkGetPhysicalDeviceMemoryProperties), which are now resolved
+   once at device creation.
+
+   Runs headless, so it works without a display.
+*/
+
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include <chrono>
+#include <vector>
+
+#include <vkal.h>
+
+#define BENCHMARK_BUFFER_COUNT  4096
+#define BENCHMARK_IMAGE_COUNT   2048
+#define BENCHMARK_BUFFER_SIZE   (4 * 1024)
+
+static double elapsed_ms(std::chrono::high_resolution_clock::time_point start)
+{
+    std::chrono::duration<double, std::milli> duration = std::chrono::high_resolution_clock::now() - start;
+    return duration.count();
+}
+
+static void report(char const * what, uint32_t count, double ms)
+{
+    printf("%-36s %6u in %9.3f ms  (%8.2f us each)\n", what, count, ms, 1000.0 * ms / count);
+}
+
+int main(int argc, char** argv)
+{
+    char* device_extensions[] = {
+        VK_KHR_MAINTENANCE3_EXTENSION_NAME
+    };
+    uint32_t device_extension_count = sizeof(device_extensions) / sizeof(*device_extensions);
+
+    char* instance_extensions[] = {
+        VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME
+        #ifdef __APPLE__
+            ,VK_KHR_PORTABILITY_ENUMERATION_EXTENSION_NAME
+        #endif
+    };
+    uint32_t instance_extension_count = sizeof(instance_extensions) / sizeof(*instance_extensions);
+
+    /* No validation layers: we want to measure VKAL and the driver, not the layers. */
+    vkal_create_instance_headless(64, 64, instance_extensions, instance_extension_count, NULL, 0);
+
+    VkalPhysicalDevice* devices = 0;
+    uint32_t device_count;
+    vkal_find_suitable_devices(device_extensions, device_extension_count, &devices, &device_count);
+    assert(device_count > 0);
+    vkal_select_physical_device(&devices[0]);
+    printf("Device: %s\n\n", devices[0].property.deviceName);
+
+    VkalWantedFeatures vulkan_features{};
+    VkalInfo* vkal_info = vkal_init(device_extensions, device_extension_count, vulkan_features, VK_INDEX_TYPE_UINT16);
+
+    /* What every create_buffer/create_image paid before the queries were cached. */
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        uint32_t sum = 0;
+        for (uint32_t i = 0; i < BENCHMARK_BUFFER_COUNT; ++i) {
+            QueueFamilyIndicies indicies = find_queue_families(vkal_info->physical_device, vkal_info->surface);
+            VkPhysicalDeviceMemoryProperties memory_properties;
+            vkGetPhysicalDeviceMemoryProperties(vkal_info->physical_device, &memory_properties);
+            sum += indicies.graphics_family + memory_properties.memoryTypeCount;
+        }
+        report("per-resource queries (old path)", BENCHMARK_BUFFER_COUNT, elapsed_ms(start));
+        (void)sum;
+    }
+
+    /* Buffers sub-allocated from one DeviceMemory. */
+    {
+        DeviceMemory memory = vkal_allocate_devicememory(BENCHMARK_BUFFER_COUNT * BENCHMARK_BUFFER_SIZE * 2,
+                                                         VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                                                         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0);
+        std::vector<VkalBuffer> buffers(BENCHMARK_BUFFER_COUNT);
+
+        auto start = std::chrono::high_resolution_clock::now();
+        for (uint32_t i = 0; i < BENCHMARK_BUFFER_COUNT; ++i) {
+            buffers[i] = vkal_create_buffer(BENCHMARK_BUFFER_SIZE, &memory, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+        }
+        report("vkal_create_buffer", BENCHMARK_BUFFER_COUNT, elapsed_ms(start));
+
+        start = std::chrono::high_resolution_clock::now();
+        for (uint32_t i = 0; i < BENCHMARK_BUFFER_COUNT; ++i) {
+            vkal_destroy_buffer(&buffers[i]);
+        }
+        report("vkal_destroy_buffer", BENCHMARK_BUFFER_COUNT, elapsed_ms(start));
+        vkal_free_devicememory(&memory);
+    }
+
+    /* Images with memory from the block allocator. */
+    {
+        std::vector<uint32_t> images(BENCHMARK_IMAGE_COUNT);
+        std::vector<uint32_t> memories(BENCHMARK_IMAGE_COUNT);
+
+        auto start = std::chrono::high_resolution_clock::now();
+        for (uint32_t i = 0; i < BENCHMARK_IMAGE_COUNT; ++i) {
+            create_image(64, 64, 1, 1, 0, VK_FORMAT_R8G8B8A8_UNORM,
+                         VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, &images[i]);
+            vkal_allocate_image_memory(images[i], VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &memories[i]);
+        }
+        report("create_image + memory", BENCHMARK_IMAGE_COUNT, elapsed_ms(start));
+
+        start = std::chrono::high_resolution_clock::now();
+        for (uint32_t i = 0; i < BENCHMARK_IMAGE_COUNT; ++i) {
+            vkal_destroy_image(images[i]);
+            vkal_destroy_device_memory(memories[i]);
+        }
+        report("vkal_destroy_image + memory", BENCHMARK_IMAGE_COUNT, elapsed_ms(start));
+    }
+
+    VkalAllocatorStats stats;
+    vkal_get_allocator_stats(&stats);
+    printf("\nAllocator: %u blocks, %u live allocations\n", stats.block_count, stats.allocation_count);
+
+    vkDeviceWaitIdle(vkal_info->device);
+    vkal_cleanup();
+
+    return 0;
+}
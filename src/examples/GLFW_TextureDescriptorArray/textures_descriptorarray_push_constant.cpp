@@ -267,6 +267,9 @@ int main(int argc, char ** argv)
 
 		{
 			uint32_t image_id = vkal_get_image();
+			if (image_id == VKAL_INVALID_IMAGE) {
+			    continue; // The swapchain was recreated, try again next frame.
+			}
 
 			vkal_begin_command_buffer(image_id);
 			vkal_begin_render_pass(image_id, vkal_info->render_pass);
@@ -509,6 +509,9 @@ int main(int argc, char ** argv)
 
 	{
 	    uint32_t image_id = vkal_get_image();
+	    if (image_id == VKAL_INVALID_IMAGE) {
+	        continue; // The swapchain was recreated, try again next frame.
+	    }
 
 	    vkal_begin_command_buffer(image_id);
 	    vkal_begin_render_pass(image_id, vkal_info->render_pass);
@@ -532,10 +535,10 @@ int main(int argc, char ** argv)
     }
 
     vkDeviceWaitIdle(vkal_info->device);
-    vkDestroyBuffer(vkal_info->device, index_buffer.buffer, NULL);
-    vkDestroyBuffer(vkal_info->device, vertex_buffer.buffer, NULL);
-    vkFreeMemory(vkal_info->device, index_memory.vk_device_memory, NULL);
-    vkFreeMemory(vkal_info->device, vertex_memory.vk_device_memory, NULL);
+    vkal_destroy_buffer(&index_buffer);
+    vkal_destroy_buffer(&vertex_buffer);
+    vkal_free_devicememory(&index_memory);
+    vkal_free_devicememory(&vertex_memory);
     
     vkal_cleanup();
 
@@ -227,6 +227,9 @@ int main(int argc, char** argv)
         {
             //vkDeviceWaitIdle(vkal_info->device);
             uint32_t image_id = vkal_get_image();
+            if (image_id == VKAL_INVALID_IMAGE) {
+                continue; // The swapchain was recreated, try again next frame.
+            }
                
             VkCommandBuffer currentCmdBuffer = vkal_info->default_command_buffers[image_id];
 
@@ -511,6 +511,9 @@ int main(int argc, char** argv)
 
         {      
             uint32_t image_id = vkal_get_image();
+            if (image_id == VKAL_INVALID_IMAGE) {
+                continue; // The swapchain was recreated, try again next frame.
+            }
                
             VkCommandBuffer currentCmdBuffer = vkal_info->default_command_buffers[image_id];
 
@@ -525,14 +528,16 @@ int main(int argc, char** argv)
                 0, 0,
                 (float)width, (float)height);
             vkal_bind_descriptor_set(image_id, &descriptor_sets[0], pipeline_layout);
-            //vkal_draw(image_id, graphics_pipeline, 0, )
-            //vkal_draw_indexed(image_id, graphics_pipeline,
-            //    offset_indices, 6,
-            //    offset_vertices, 2);
-            //vkCmdDrawIndexedIndirect(vkal_info.default_command_buffers[image_id], )
-            vkCmdBindPipeline(vkal_info->default_command_buffers[image_id], VK_PIPELINE_BIND_POINT_GRAPHICS, graphics_pipeline);
-            //vkCmdDraw(vkal_info->default_command_buffers[image_id], totalVertexCount, 1, 0, 0);
-            vkCmdDraw(vkal_info->default_command_buffers[image_id], 6, numSprites, 0, 0);
+            // One quad (6 vertices) per sprite instance. The command lives in this frame's transient memory.
+            VkalTransientAllocation draw_command = vkal_transient_alloc(sizeof(VkDrawIndirectCommand), 4);
+            VkDrawIndirectCommand * command = (VkDrawIndirectCommand*)draw_command.data;
+            command->vertexCount = 6;
+            command->instanceCount = numSprites;
+            command->firstVertex = 0;
+            command->firstInstance = 0;
+            vkal_statistics_scope_begin(currentCmdBuffer, "sprites");
+            vkal_draw_indirect(currentCmdBuffer, graphics_pipeline, draw_command.buffer.buffer, draw_command.offset, 1, 0);
+            vkal_statistics_scope_end(currentCmdBuffer, "sprites");
 
             vkal_end_renderpass(image_id);
             vkal_end_command_buffer(image_id);
@@ -550,6 +555,7 @@ int main(int argc, char** argv)
             sprintf(window_title, "frametime: %fms (%f FPS) || UpdateAsteroidTime (ms): %lli", dt, 1000.0 / (float)dt, timeUpdateFrame);
             SDL_SetWindowTitle(window, window_title);
             titleUpdateTimer = 0.0;
+            vkal_print_gpu_profile();
         }
     }
 
@@ -589,6 +589,9 @@ int main(int argc, char ** argv)
 	
 	{
 	    uint32_t image_id = vkal_get_image();
+	    if (image_id == VKAL_INVALID_IMAGE) {
+	        continue; // The swapchain was recreated, try again next frame.
+	    }
 
 	    vkal_begin_command_buffer(image_id);
 
@@ -631,11 +634,11 @@ int main(int argc, char ** argv)
     
 #if 1
     vkDestroyBuffer(vkal_info->device, storage_buffer_skeleton_matrices.buffer, NULL);
-    vkFreeMemory(vkal_info->device, skeleton_matrices_mem.vk_device_memory, NULL);
+    vkal_free_devicememory(&skeleton_matrices_mem);
 #endif
     
     vkDestroyBuffer(vkal_info->device, storage_buffer_bone_matrices.buffer, NULL);
-    vkFreeMemory(vkal_info->device, offset_matrices_mem.vk_device_memory, NULL);
+    vkal_free_devicememory(&offset_matrices_mem);
 
     vkal_cleanup();
 
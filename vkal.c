@@ -1,6 +1,7 @@
 #define _CRT_SECURE_NO_WARNINGS
 
 #include <stdlib.h>
+#include <stdarg.h>
 #include <assert.h>
 
 #if defined (VKAL_WIN32)
@@ -23,6 +24,120 @@
 
 #include "vkal.h"
 
+#if defined (_WIN32)
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #include <Windows.h>
+    #include <mmsystem.h> // timeBeginPeriod, link winmm.
+    #ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+        #define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+    #endif
+    typedef HANDLE              VkalThread;
+    typedef CRITICAL_SECTION    VkalMutex;
+    typedef CONDITION_VARIABLE  VkalCondition;
+#else
+    #include <pthread.h>
+    #include <unistd.h>
+    #include <time.h>
+    typedef pthread_t           VkalThread;
+    typedef pthread_mutex_t     VkalMutex;
+    typedef pthread_cond_t      VkalCondition;
+#endif
+
+typedef struct VkalJob
+{
+    VkalJobFunction function;
+    void            * data;
+    VkalJobGroup    * group;
+} VkalJob;
+
+typedef struct VkalJobPool
+{
+    VkalMutex       mutex;          /* Guards everything below and the 'pending' counters of the groups. */
+    VkalCondition   job_available;
+    VkalCondition   job_finished;
+    VkalThread      threads[VKAL_MAX_WORKER_THREADS];
+    uint32_t        thread_indices[VKAL_MAX_WORKER_THREADS];
+    uint32_t        thread_count;
+    VkalJob         * jobs;         /* Ring buffer. */
+    uint32_t        job_capacity;
+    uint32_t        job_head;
+    uint32_t        job_count;
+    uint32_t        shutdown;
+} VkalJobPool;
+
+typedef struct VkalRecordChunk
+{
+    VkRenderPass        render_pass;
+    uint32_t            subpass;
+    VkFramebuffer       framebuffer;
+    VkExtent2D          extent;
+    uint32_t            first;
+    uint32_t            count;
+    VkalRecordFunction  record;
+    void                * user_data;
+    VkCommandBuffer     command_buffer;
+} VkalRecordChunk;
+
+/* Queries of one frame in flight. Timestamp scope i writes queries 2i and 2i+1. The occlusion pool holds
+   the statistics scopes first and the vkal_occlusion_query ids after them. */
+typedef struct VkalGpuProfilerFrame
+{
+    VkQueryPool     pool;
+    VkQueryPool     statistics_pool;
+    VkQueryPool     occlusion_pool;
+    uint32_t        needs_reset; /* Only without hostQueryReset: reset by the next vkal_begin*. */
+    VkalGpuScope    scopes[VKAL_MAX_GPU_SCOPES];
+    uint32_t        ended[VKAL_MAX_GPU_SCOPES];
+    uint32_t        scope_count;
+    uint32_t        open[VKAL_MAX_GPU_SCOPES]; /* Stack of scopes waiting for vkal_gpu_scope_end. */
+    uint32_t        open_count;
+    VkalPipelineStatistics statistics[VKAL_MAX_STATISTICS_SCOPES];
+    uint32_t        statistics_ended[VKAL_MAX_STATISTICS_SCOPES];
+    uint32_t        statistics_count;
+    uint8_t         occlusion_written[VKAL_MAX_OCCLUSION_QUERIES]; /* 0: unused, 1: begun, 2: ended. */
+} VkalGpuProfilerFrame;
+
+typedef struct VkalGpuProfiler
+{
+    VkalMutex               mutex; /* Scopes may be recorded by worker threads. */
+    VkalGpuProfilerFrame    frames[VKAL_MAX_IMAGES_IN_FLIGHT];
+    uint64_t                occlusion_results[VKAL_MAX_OCCLUSION_QUERIES];
+    uint8_t                 occlusion_valid[VKAL_MAX_OCCLUSION_QUERIES];
+} VkalGpuProfiler;
+
+#if defined (_MSC_VER)
+    #define VKAL_THREAD_LOCAL __declspec(thread)
+#else
+    #define VKAL_THREAD_LOCAL _Thread_local
+#endif
+
+/* What the draw wrappers last bound on one command buffer. VK_NULL_HANDLE / 0 means unknown. */
+typedef struct VkalBindState
+{
+    VkCommandBuffer command_buffer;
+    VkPipeline      pipeline;
+    VkBuffer        vertex_buffer;
+    VkDeviceSize    vertex_buffer_offset;
+    VkBuffer        index_buffer;
+    VkDeviceSize    index_buffer_offset;
+    VkIndexType     index_type;
+    uint32_t        has_viewport;
+    VkViewport      viewport;
+    uint32_t        has_scissor;
+    VkRect2D        scissor;
+    uint64_t        last_use;
+} VkalBindState;
+
+/* One per thread so workers can record without locking. */
+typedef struct VkalBindTracker
+{
+    VkalBindState   states[VKAL_BIND_STATE_CACHE_SIZE];
+    uint64_t        use_counter;
+    VkalBindStats   stats; /* Not yet added to vkal_info.bind_stats. */
+} VkalBindTracker;
+
 #ifdef _DEBUG
     PFN_vkSetDebugUtilsObjectNameEXT                       vkSetDebugUtilsObjectName;
 #endif 
@@ -37,6 +152,9 @@ PFN_vkCmdTraceRaysKHR                                 vkCmdTraceRays;
 //PFN_vkGetBufferDeviceAddressKHR                       vkGetBufferDeviceAddress;
 
 static VkalInfo vkal_info;
+static VkalJobPool vkal_job_pool;
+static VkalGpuProfiler vkal_gpu_profiler;
+static VKAL_THREAD_LOCAL VkalBindTracker vkal_bind_tracker;
 
 static size_t vkal_index_size;
 static VkIndexType vkal_index_type;
@@ -66,6 +184,17 @@ VkalInfo * vkal_init(char ** extensions, uint32_t extension_count, VkalWantedFea
 
     vkal_index_size = sizeof(uint16_t);
     vkal_index_type = VK_INDEX_TYPE_UINT16;
+    if (!vkal_info.frames_in_flight) {
+        vkal_info.frames_in_flight = VKAL_FRAMES_IN_FLIGHT;
+    }
+    if (!vkal_info.present_modes_set) {
+#if VKAL_VSYNC_ON
+        VkPresentModeKHR present_modes[] = { VK_PRESENT_MODE_FIFO_KHR };
+#else
+        VkPresentModeKHR present_modes[] = { VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_FIFO_KHR };
+#endif
+        vkal_set_present_modes(present_modes, VKAL_ARRAY_LENGTH(present_modes));
+    }
 
     if (index_type == VK_INDEX_TYPE_UINT32) {
         vkal_index_size = sizeof(uint32_t);
@@ -73,8 +202,19 @@ VkalInfo * vkal_init(char ** extensions, uint32_t extension_count, VkalWantedFea
     }
 
 //    pick_physical_device(extensions, extension_count);
+    create_handle_pools();
     create_logical_device(extensions, extension_count, vulkan_features);
-    create_swapchain();
+    create_timeline_semaphore();
+    create_gpu_profiler();
+    create_pipeline_cache();
+    create_pipeline_registry();
+    create_job_pool(VKAL_WORKER_THREADS);
+    if (vkal_info.headless) {
+        create_headless_images();
+    }
+    else {
+        create_swapchain();
+    }
     create_image_views();
     create_default_render_pass();
     create_render_to_image_render_pass();
@@ -82,6 +222,7 @@ VkalInfo * vkal_init(char ** extensions, uint32_t extension_count, VkalWantedFea
     create_default_framebuffers();
     create_default_descriptor_pool();
     create_default_command_pool();
+    create_frame_command_pools();
     create_default_command_buffers();
     create_default_uniform_buffer(UNIFORM_BUFFER_SIZE);
     allocate_default_device_memory_uniform();
@@ -90,6 +231,9 @@ VkalInfo * vkal_init(char ** extensions, uint32_t extension_count, VkalWantedFea
     create_default_index_buffer(INDEX_BUFFER_SIZE);
     allocate_default_device_memory_index();
     create_staging_buffer(STAGING_BUFFER_SIZE);
+    create_transient_buffer(VKAL_TRANSIENT_BUFFER_SIZE);
+    create_upload_batches();
+    create_compute_resources();
     create_default_semaphores();
     vkal_info.frames_rendered = 0;
 
@@ -223,6 +367,7 @@ void vkal_create_instance_glfw(
 		create_info.enabledExtensionCount = total_instance_ext_count;
 		create_info.ppEnabledExtensionNames = (const char * const *)all_instance_extensions;
     
+        vkal_info.instance_api_version = app_info.apiVersion;
         VkResult result = vkCreateInstance(&create_info, 0, &vkal_info.instance);
 		VKAL_ASSERT(result && "failed to create VkInstance");
 
@@ -328,6 +473,7 @@ void vkal_create_instance_win32(
 		create_info.enabledExtensionCount = total_instance_ext_count;
 		create_info.ppEnabledExtensionNames = (const char * const *)all_instance_extensions;
 
+        vkal_info.instance_api_version = app_info.apiVersion;
         VkResult result = vkCreateInstance(&create_info, 0, &vkal_info.instance);
 		VKAL_ASSERT(result && "failed to create VkInstance");
 
@@ -434,6 +580,7 @@ void vkal_create_instance_sdl(
         create_info.enabledExtensionCount = total_instance_ext_count;
         create_info.ppEnabledExtensionNames = (const char* const*)all_instance_extensions;
 
+        vkal_info.instance_api_version = app_info.apiVersion;
         VkResult result = vkCreateInstance(&create_info, 0, &vkal_info.instance);
         VKAL_ASSERT(result && "failed to create VkInstance");
     }
@@ -442,6 +589,93 @@ void vkal_create_instance_sdl(
 }
 #endif
 
+void vkal_create_instance_headless(
+    uint32_t width, uint32_t height,
+    char** instance_extensions, uint32_t instance_extension_count,
+    char** instance_layers, uint32_t instance_layer_count)
+{
+    vkal_info.headless = 1;
+    vkal_info.swapchain_extent.width = width;
+    vkal_info.swapchain_extent.height = height;
+
+    VkApplicationInfo app_info = { 0 };
+    app_info.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+    app_info.pApplicationName = "VKAL Application";
+    app_info.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
+    app_info.pEngineName = "VKAL Engine";
+    app_info.engineVersion = VK_MAKE_VERSION(1, 0, 0);
+    #if defined (__APPLE__)
+        app_info.apiVersion = VK_API_VERSION_1_2; // MoltenVK only goes up to Vulkan version 1.2
+    #else
+        app_info.apiVersion = VK_API_VERSION_1_3;
+    #endif
+
+    VkInstanceCreateInfo create_info = { 0 };
+    create_info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+    #ifdef __APPLE__
+        create_info.flags |= VK_INSTANCE_CREATE_ENUMERATE_PORTABILITY_BIT_KHR;
+    #endif
+    create_info.pApplicationInfo = &app_info;
+
+    // Query available extensions.
+    {
+        vkEnumerateInstanceExtensionProperties(0, &vkal_info.available_instance_extension_count, 0);
+        VKAL_MALLOC(vkal_info.available_instance_extensions, vkal_info.available_instance_extension_count);
+        vkEnumerateInstanceExtensionProperties(0, &vkal_info.available_instance_extension_count,
+            vkal_info.available_instance_extensions);
+    }
+
+    // If debug build check if validation layers defined in struct are available and load them
+    {
+        vkEnumerateInstanceLayerProperties(&vkal_info.available_instance_layer_count, 0);
+        VKAL_MALLOC(vkal_info.available_instance_layers, vkal_info.available_instance_layer_count);
+        vkEnumerateInstanceLayerProperties(&vkal_info.available_instance_layer_count,
+            vkal_info.available_instance_layers);
+#ifdef _DEBUG
+        vkal_info.enable_instance_layers = 1;
+#else
+        vkal_info.enable_instance_layers = 0;
+#endif
+        int layer_ok = 0;
+        if (vkal_info.enable_instance_layers) {
+            for (uint32_t i = 0; i < instance_layer_count; ++i) {
+                layer_ok = check_instance_layer_support(instance_layers[i],
+                    vkal_info.available_instance_layers,
+                    vkal_info.available_instance_layer_count);
+                if (!layer_ok) {
+                    printf("[VKAL] validation layer not available: %s\n", instance_layers[i]);
+                    VKAL_ASSERT(VK_ERROR_LAYER_NOT_PRESENT && "requested isntance layer not present!");
+                }
+            }
+        }
+        if (layer_ok) {
+            create_info.enabledLayerCount = instance_layer_count;
+            create_info.ppEnabledLayerNames = (const char* const*)instance_layers;
+        }
+    }
+
+    // No surface extensions are required without a window. Only check what the user asked for.
+    {
+        for (uint32_t i = 0; i < instance_extension_count; ++i) {
+            int extension_ok = check_instance_extension_support(instance_extensions[i],
+                vkal_info.available_instance_extensions,
+                vkal_info.available_instance_extension_count);
+            if (!extension_ok) {
+                printf("[VKAL] instance extension not available: %s\n", instance_extensions[i]);
+                VKAL_ASSERT(VK_ERROR_EXTENSION_NOT_PRESENT && "requested instance extension not present!");
+            }
+        }
+        create_info.enabledExtensionCount = instance_extension_count;
+        create_info.ppEnabledExtensionNames = (const char* const*)instance_extensions;
+
+        vkal_info.instance_api_version = app_info.apiVersion;
+        VkResult result = vkCreateInstance(&create_info, 0, &vkal_info.instance);
+        VKAL_ASSERT(result && "failed to create VkInstance");
+    }
+
+    vkal_info.surface = VK_NULL_HANDLE;
+}
+
 
 
 	
@@ -575,6 +809,140 @@ void set_image_layout(
 	1, &barrier);
 }
 
+static void frame_command_pool_init(VkalFrameCommandPool * frame_pool, VkCommandBufferLevel level)
+{
+    memset(frame_pool, 0, sizeof(VkalFrameCommandPool));
+    frame_pool->level = level;
+    VkCommandPoolCreateInfo cmdpool_info = { 0 };
+    cmdpool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    cmdpool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    cmdpool_info.queueFamilyIndex = vkal_info.queue_families.graphics_family;
+    VkResult result = vkCreateCommandPool(vkal_info.device, &cmdpool_info, 0, &frame_pool->pool);
+    VKAL_ASSERT(result && "failed to create frame command pool!");
+}
+
+static void frame_command_pool_destroy(VkalFrameCommandPool * frame_pool)
+{
+    if (frame_pool->pool != VK_NULL_HANDLE) {
+        // Destroying the pool frees its command buffers.
+        vkDestroyCommandPool(vkal_info.device, frame_pool->pool, 0);
+    }
+    VKAL_FREE(frame_pool->buffers);
+    memset(frame_pool, 0, sizeof(VkalFrameCommandPool));
+}
+
+/* Only call once the GPU is done with the frame the pool belongs to. */
+static void frame_command_pool_reset(VkalFrameCommandPool * frame_pool)
+{
+    if (frame_pool->used) {
+        vkResetCommandPool(vkal_info.device, frame_pool->pool, 0);
+        frame_pool->used = 0;
+    }
+}
+
+/* Next recycled command buffer, allocating more if all of them are in use this frame. */
+static VkCommandBuffer frame_command_pool_acquire(VkalFrameCommandPool * frame_pool)
+{
+    if (frame_pool->used == frame_pool->buffer_count) {
+        uint32_t new_count = frame_pool->buffer_count ? 2 * frame_pool->buffer_count : 8;
+        VKAL_REALLOC(frame_pool->buffers, new_count);
+        assert(frame_pool->buffers && "frame_command_pool_acquire: out of memory!");
+        VkCommandBufferAllocateInfo allocate_info = { 0 };
+        allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocate_info.commandPool = frame_pool->pool;
+        allocate_info.level = frame_pool->level;
+        allocate_info.commandBufferCount = new_count - frame_pool->buffer_count;
+        VkResult result = vkAllocateCommandBuffers(vkal_info.device, &allocate_info, frame_pool->buffers + frame_pool->buffer_count);
+        VKAL_ASSERT(result && "failed to allocate frame command buffers!");
+        frame_pool->buffer_count = new_count;
+    }
+    return frame_pool->buffers[frame_pool->used++];
+}
+
+static int frame_command_pool_owns(VkalFrameCommandPool * frame_pool, VkCommandBuffer command_buffer)
+{
+    for (uint32_t i = 0; i < frame_pool->buffer_count; ++i) {
+        if (frame_pool->buffers[i] == command_buffer) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int is_oneshot_command_buffer(VkCommandBuffer command_buffer)
+{
+    for (uint32_t frame = 0; frame < VKAL_MAX_IMAGES_IN_FLIGHT; ++frame) {
+        if (frame_command_pool_owns(&vkal_info.oneshot_command_pools[frame][VK_COMMAND_BUFFER_LEVEL_PRIMARY], command_buffer) ||
+            frame_command_pool_owns(&vkal_info.oneshot_command_pools[frame][VK_COMMAND_BUFFER_LEVEL_SECONDARY], command_buffer)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* vkQueueSubmit that also signals the next timeline value if the timeline is enabled and 'queue' is the
+   graphics queue. Returns that value, 0 otherwise. Signals on one queue execute in submission order,
+   which keeps the values increasing. */
+static uint64_t submit_to_queue(VkQueue queue, VkSubmitInfo const * submit_info, VkFence fence)
+{
+    if (!vkal_info.timeline_enabled || queue != vkal_info.graphics_queue) {
+        VkResult result = vkQueueSubmit(queue, 1, submit_info, fence);
+        VKAL_ASSERT(result && "failed to submit to queue!");
+        return 0;
+    }
+    VkSemaphore signal_semaphores[4];
+    uint64_t signal_values[4] = { 0 }; // Ignored for binary semaphores.
+    assert(submit_info->signalSemaphoreCount < 4);
+    for (uint32_t i = 0; i < submit_info->signalSemaphoreCount; ++i) {
+        signal_semaphores[i] = submit_info->pSignalSemaphores[i];
+    }
+    uint32_t signal_count = submit_info->signalSemaphoreCount;
+    signal_semaphores[signal_count] = vkal_info.timeline_semaphore;
+    signal_values[signal_count++] = ++vkal_info.timeline_value;
+
+    VkTimelineSemaphoreSubmitInfo timeline_info = { 0 };
+    timeline_info.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timeline_info.signalSemaphoreValueCount = signal_count;
+    timeline_info.pSignalSemaphoreValues = signal_values;
+    VkSubmitInfo timeline_submit_info = *submit_info;
+    timeline_submit_info.pNext = &timeline_info;
+    timeline_submit_info.signalSemaphoreCount = signal_count;
+    timeline_submit_info.pSignalSemaphores = signal_semaphores;
+    VkResult result = vkQueueSubmit(queue, 1, &timeline_submit_info, fence);
+    VKAL_ASSERT(result && "failed to submit to queue!");
+    return vkal_info.timeline_value;
+}
+
+uint64_t vkal_submitted_value(void)
+{
+    return vkal_info.timeline_value;
+}
+
+uint64_t vkal_gpu_progress(void)
+{
+    if (!vkal_info.timeline_enabled) {
+        return 0;
+    }
+    uint64_t value = 0;
+    VkResult result = vkGetSemaphoreCounterValue(vkal_info.device, vkal_info.timeline_semaphore, &value);
+    VKAL_ASSERT(result && "failed to get timeline value!");
+    return value;
+}
+
+void vkal_wait_value(uint64_t value)
+{
+    if (!vkal_info.timeline_enabled || value == 0) {
+        return;
+    }
+    VkSemaphoreWaitInfo wait_info = { 0 };
+    wait_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+    wait_info.semaphoreCount = 1;
+    wait_info.pSemaphores = &vkal_info.timeline_semaphore;
+    wait_info.pValues = &value;
+    VkResult result = vkWaitSemaphores(vkal_info.device, &wait_info, UINT64_MAX);
+    VKAL_ASSERT(result && "failed to wait for timeline value!");
+}
+
 void vkal_flush_command_buffer(VkCommandBuffer command_buffer, VkQueue queue, int free)
 {
     if (command_buffer == VK_NULL_HANDLE)
@@ -585,29 +953,43 @@ void vkal_flush_command_buffer(VkCommandBuffer command_buffer, VkQueue queue, in
     VkResult result = vkEndCommandBuffer(command_buffer);
     VKAL_ASSERT(result && "failed to end command buffer");
 
+    // The command buffer may read data that is still sitting in the open upload batch.
+    vkal_flush_uniforms();
+    vkal_flush_transient();
+    uint64_t upload_ticket = vkal_flush_uploads();
+    if (queue != vkal_info.graphics_queue) {
+        vkal_wait_upload(upload_ticket);
+    }
+
     VkSubmitInfo submit_info = {0};
     submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
     submit_info.commandBufferCount = 1;
     submit_info.pCommandBuffers = &command_buffer;
 
-    // Create fence to ensure that the command buffer has finished executing
-    VkFenceCreateInfo fence_info = {0};
-    fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-    fence_info.flags = 0;
-
-    VkFence fence = VK_NULL_HANDLE;
-    result = vkCreateFence(vkal_info.device, &fence_info, NULL, &fence);
-    VKAL_ASSERT(result && "failed to create fence");
-
-    // Submit to the queue
-    result = vkQueueSubmit(queue, 1, &submit_info, fence);
-    // Wait for the fence to signal that command buffer has finished executing
-    result = vkWaitForFences(vkal_info.device, 1, &fence, VK_TRUE, UINT64_MAX);
-    VKAL_ASSERT(result && "failed waiting on fence");
-
-    vkDestroyFence(vkal_info.device, fence, NULL);
+    if (vkal_info.timeline_enabled && queue == vkal_info.graphics_queue) {
+        vkal_wait_value(submit_to_queue(queue, &submit_info, VK_NULL_HANDLE));
+    }
+    else {
+        // Create fence to ensure that the command buffer has finished executing
+        VkFenceCreateInfo fence_info = {0};
+        fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        fence_info.flags = 0;
+
+        VkFence fence = VK_NULL_HANDLE;
+        result = vkCreateFence(vkal_info.device, &fence_info, NULL, &fence);
+        VKAL_ASSERT(result && "failed to create fence");
+
+        // Submit to the queue
+        result = vkQueueSubmit(queue, 1, &submit_info, fence);
+        // Wait for the fence to signal that command buffer has finished executing
+        result = vkWaitForFences(vkal_info.device, 1, &fence, VK_TRUE, UINT64_MAX);
+        VKAL_ASSERT(result && "failed waiting on fence");
+
+        vkDestroyFence(vkal_info.device, fence, NULL);
+    }
 
-    if (vkal_info.default_command_pools[0] && free)
+    // Buffers from vkal_create_command_buffer go back to their frame's pool on their own.
+    if (vkal_info.default_command_pools[0] && free && !is_oneshot_command_buffer(command_buffer))
     {
 		vkFreeCommandBuffers(vkal_info.device, vkal_info.default_command_pools[0], 1, &command_buffer);
     }
@@ -633,19 +1015,7 @@ VkalImage create_vkal_image(
 			&vkal_image.image);			
 
 		// Back the image with actual memory:
-		VkMemoryRequirements image_memory_requirements = { 0 };
-		vkGetImageMemoryRequirements(
-			vkal_info.device,
-			get_image(vkal_image.image),
-			&image_memory_requirements);
-		uint32_t mem_type_bits = check_memory_type_index(
-			image_memory_requirements.memoryTypeBits,
-			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-		create_device_memory(image_memory_requirements.size, mem_type_bits, &vkal_image.device_memory);
-		VkResult result = vkBindImageMemory(
-			vkal_info.device, get_image(vkal_image.image),
-			get_device_memory(vkal_image.device_memory), 0);
-		VKAL_ASSERT(result && "failed to bind texture image memory!");
+		vkal_allocate_image_memory(vkal_image.image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &vkal_image.device_memory);
     }
 
     // Image View
@@ -818,58 +1188,74 @@ VkSurfaceFormatKHR choose_swapchain_surface_format(VkSurfaceFormatKHR * availabl
     return available_formats[0];
 }
 
-/* If the user wants sync to the vertical blank of the display then
-*  VK_PRESENT_MODE_FIFO_KHR is selected.This mode is guaranteed to 
+static char const * present_mode_name(VkPresentModeKHR present_mode)
+{
+    if (present_mode == VK_PRESENT_MODE_IMMEDIATE_KHR) {
+        return "PRESENT_MODE_IMMEDIATE";
+    }
+    else if (present_mode == VK_PRESENT_MODE_MAILBOX_KHR) {
+        return "PRESENT_MODE_MAILBOX";
+    }
+    else if (present_mode == VK_PRESENT_MODE_FIFO_KHR) {
+        return "PRESENT_MODE_FIFO";
+    }
+    else if (present_mode == VK_PRESENT_MODE_FIFO_RELAXED_KHR) {
+        return "PRESENT_MODE_FIFO_RELAXED";
+    }
+    else if (present_mode == VK_PRESENT_MODE_SHARED_DEMAND_REFRESH_KHR) {
+        return "PRESENT_MODE_SHARED_DEMAND_REFRESH";
+    }
+    else if (present_mode == VK_PRESENT_MODE_SHARED_CONTINUOUS_REFRESH_KHR) {
+        return "PRESENT_MODE_SHARED_CONTINUOUS_REFRESH";
+    }
+    return "PRESENT_MODE_UNKNOWN";
+}
+
+/* Picks the first mode of vkal_set_present_modes that the surface supports.
+*  VK_PRESENT_MODE_FIFO_KHR is the fallback, it is guaranteed to
 *  exist on any Vulkan implementation.
-*  Otherwise we try to use MAILBOX.
 */
-VkPresentModeKHR choose_swapchain_present_mode(VkPresentModeKHR* available_present_modes, uint32_t present_mode_count) // TODO: BUG IN UBUNTU: WON'T SELECT MAILBOX EVER EVEN IF AVAILABLE!
+VkPresentModeKHR choose_swapchain_present_mode(VkPresentModeKHR* available_present_modes, uint32_t present_mode_count)
 {
-    VkPresentModeKHR* available_present_mode = available_present_modes;
     printf("[VKAL] available swapchain present modes:\n");
     for (uint32_t i = 0; i < present_mode_count; ++i) {
-        if (*available_present_mode == VK_PRESENT_MODE_IMMEDIATE_KHR) {
-            printf("[VKAL]     PRESENT_MODE_IMMEDIATE\n");
-        }
-        else if (*available_present_mode == VK_PRESENT_MODE_MAILBOX_KHR) {
-            printf("[VKAL]     PRESENT_MODE_MAILBOX\n");
-        }
-        else if (*available_present_mode == VK_PRESENT_MODE_FIFO_KHR) {
-            printf("[VKAL]     PRESENT_MODE_FIFO\n");
-        }
-        else if (*available_present_mode == VK_PRESENT_MODE_FIFO_RELAXED_KHR) {
-            printf("[VKAL]     PRESENT_MODE_FIFO_RELAXED\n");
-        }
-        else if (*available_present_mode == VK_PRESENT_MODE_SHARED_DEMAND_REFRESH_KHR) {
-            printf("[VKAL]     PRESENT_MODE_SHARED_DEMAND_REFRESH\n");
-        }
-        else if (*available_present_mode == VK_PRESENT_MODE_SHARED_CONTINUOUS_REFRESH_KHR) {
-            printf("[VKAL]     PRESENT_MODE_SHARED_CONTINUOUS_REFRESH\n");
-        }
-        available_present_mode++;
+        printf("[VKAL]     %s\n", present_mode_name(available_present_modes[i]));
     }
 
-    printf("[VKAL] swapchain present mode selected: ");
-#if !VKAL_VSYNC_ON 
-    // Try to select Mailbox or Immediate
-    available_present_mode = available_present_modes;
-    for (uint32_t i = 0; i < present_mode_count; ++i) {
-        if (*available_present_mode == VK_PRESENT_MODE_MAILBOX_KHR) {
-            printf("PRESENT_MODE_MAILBOX\n");
-            return VK_PRESENT_MODE_MAILBOX_KHR;
-        }
-        else if (*available_present_mode == VK_PRESENT_MODE_IMMEDIATE_KHR) {
-            printf("PRESENT_MODE_IMMEDIATE\n");
-            return VK_PRESENT_MODE_IMMEDIATE_KHR;
+    VkPresentModeKHR selected = VK_PRESENT_MODE_FIFO_KHR;
+    int found = 0;
+    for (uint32_t i = 0; i < vkal_info.present_mode_preference_count && !found; ++i) {
+        for (uint32_t j = 0; j < present_mode_count; ++j) {
+            if (available_present_modes[j] == vkal_info.present_mode_preferences[i]) {
+                selected = available_present_modes[j];
+                found = 1;
+                break;
+            }
         }
-        available_present_mode++;
     }
-    printf("PRESENT_MODE_FIFO\n");
-    return VK_PRESENT_MODE_FIFO_KHR;
-#elif VKAL_VSYNC_ON
-    printf("PRESENT_MODE_FIFO\n");
-    return VK_PRESENT_MODE_FIFO_KHR; 
-#endif
+    printf("[VKAL] swapchain present mode selected: %s\n", present_mode_name(selected));
+    vkal_info.present_mode = selected;
+    return selected;
+}
+
+/* Used for the next swapchain. Once VKAL is initialized this recreates the swapchain at the next
+   vkal_present, which does not stall. */
+void vkal_set_present_modes(VkPresentModeKHR const * present_modes, uint32_t count)
+{
+    if (count > VKAL_MAX_PRESENT_MODES) {
+        count = VKAL_MAX_PRESENT_MODES;
+    }
+    memcpy(vkal_info.present_mode_preferences, present_modes, count * sizeof(VkPresentModeKHR));
+    vkal_info.present_mode_preference_count = count;
+    vkal_info.present_modes_set = 1;
+    if (vkal_info.swapchain != VK_NULL_HANDLE) {
+        vkal_info.should_recreate_swapchain = 1;
+    }
+}
+
+VkPresentModeKHR vkal_get_present_mode(void)
+{
+    return vkal_info.present_mode;
 }
 
 VkExtent2D choose_swap_extent(VkSurfaceCapabilitiesKHR * capabilities)
@@ -915,26 +1301,159 @@ void cleanup_swapchain(void)
         vkDestroyImageView(vkal_info.device, vkal_info.swapchain_image_views[i], 0);
     }
     
-    vkDestroySwapchainKHR(vkal_info.device, vkal_info.swapchain, 0);
+    if (vkal_info.swapchain != VK_NULL_HANDLE) {
+        vkDestroySwapchainKHR(vkal_info.device, vkal_info.swapchain, 0);
+    }
+}
+
+static void destroy_retired_swapchain(VkalRetiredSwapchain * retired)
+{
+    for (uint32_t i = 0; i < retired->framebuffer_count; ++i) {
+        vkDestroyFramebuffer(vkal_info.device, retired->framebuffers[i], 0);
+    }
+    VKAL_FREE(retired->framebuffers);
+    for (uint32_t i = 0; i < retired->image_view_count; ++i) {
+        vkDestroyImageView(vkal_info.device, retired->image_views[i], 0);
+    }
+    vkDestroySwapchainKHR(vkal_info.device, retired->swapchain, 0);
+    vkal_destroy_image_view(retired->depth_image_view);
+    vkal_destroy_image(retired->depth_image);
+    if (retired->depth_memory != VKAL_INVALID_HANDLE) {
+        vkal_destroy_device_memory(retired->depth_memory); // Only returns the range to its block.
+    }
+    if (retired->fence != VK_NULL_HANDLE) {
+        vkDestroyFence(vkal_info.device, retired->fence, 0);
+    }
+}
+
+/* Destroys retired swapchains in order as long as the GPU is done with them. With 'wait' set it
+   blocks until all of them can go. */
+void retire_swapchains(int wait)
+{
+    uint32_t done = 0;
+    for (; done < vkal_info.retired_swapchain_count; ++done) {
+        VkalRetiredSwapchain * retired = &vkal_info.retired_swapchains[done];
+        if (vkal_info.timeline_enabled) {
+            if (wait) {
+                vkal_wait_value(retired->timeline_value);
+            }
+            else if (vkal_gpu_progress() < retired->timeline_value) {
+                break;
+            }
+        }
+        else {
+            if (wait) {
+                vkWaitForFences(vkal_info.device, 1, &retired->fence, VK_TRUE, UINT64_MAX);
+            }
+            else if (vkGetFenceStatus(vkal_info.device, retired->fence) != VK_SUCCESS) {
+                break;
+            }
+        }
+        destroy_retired_swapchain(retired);
+    }
+    vkal_info.retired_swapchain_count -= done;
+    memmove(vkal_info.retired_swapchains, vkal_info.retired_swapchains + done,
+            vkal_info.retired_swapchain_count * sizeof(VkalRetiredSwapchain));
+}
+
+/* New depth image of the current extent. It is bound to the memory of the old one if that is big enough,
+   the render pass makes the old frames' depth writes finish before the new image gets cleared. */
+static void recreate_default_depth_buffer(VkalRetiredSwapchain * retired)
+{
+    retired->depth_image = vkal_info.depth_stencil_image;
+    retired->depth_image_view = vkal_info.depth_stencil_image_view;
+    retired->depth_memory = VKAL_INVALID_HANDLE;
+
+    create_image(
+        vkal_info.swapchain_extent.width, vkal_info.swapchain_extent.height,
+        1, 1, 0,
+        VK_FORMAT_D32_SFLOAT, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+        &vkal_info.depth_stencil_image);
+    VkMemoryRequirements requirements = { 0 };
+    vkGetImageMemoryRequirements(vkal_info.device, get_image(vkal_info.depth_stencil_image), &requirements);
+    VkalDeviceMemoryHandle * memory = (VkalDeviceMemoryHandle*)handle_pool_get(&vkal_info.user_device_memory, vkal_info.device_memory_depth_stencil);
+    uint32_t mem_type_index = vkal_info.memory_blocks[memory->block].mem_type_index;
+    if (requirements.size <= memory->size &&
+        (requirements.memoryTypeBits & (1u << mem_type_index)) &&
+        memory->offset % requirements.alignment == 0) {
+        VkResult result = vkBindImageMemory(vkal_info.device, get_image(vkal_info.depth_stencil_image), memory->device_memory, memory->offset);
+        VKAL_ASSERT(result && "failed to bind depth image memory!");
+    }
+    else {
+        retired->depth_memory = vkal_info.device_memory_depth_stencil;
+        vkal_allocate_image_memory(vkal_info.depth_stencil_image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &vkal_info.device_memory_depth_stencil);
+    }
+
+    vkal_create_image_view(
+        get_image(vkal_info.depth_stencil_image),
+        VK_IMAGE_VIEW_TYPE_2D, VK_FORMAT_D32_SFLOAT, VK_IMAGE_ASPECT_DEPTH_BIT,
+        0, 1,
+        0, 1,
+        &vkal_info.depth_stencil_image_view);
 }
 
+/* The swapchain came back with a different image count. Waits only for the frames that last used an image. */
+static void resize_default_command_buffers(void)
+{
+    for (uint32_t i = 0; i < vkal_info.default_command_buffer_count; ++i) {
+        if (vkal_info.timeline_enabled) {
+            vkal_wait_value(vkal_info.image_values[i]);
+        }
+        else if (vkal_info.images_in_flight[i] != VK_NULL_HANDLE) {
+            vkWaitForFences(vkal_info.device, 1, &vkal_info.images_in_flight[i], VK_TRUE, UINT64_MAX);
+        }
+    }
+    for (uint32_t i = 0; i < VKAL_MAX_SWAPCHAIN_IMAGES; ++i) {
+        vkal_info.images_in_flight[i] = VK_NULL_HANDLE;
+        vkal_info.image_values[i] = 0;
+    }
+    vkFreeCommandBuffers(vkal_info.device, vkal_info.default_command_pools[0],
+                         vkal_info.default_command_buffer_count, vkal_info.default_command_buffers);
+    VKAL_FREE(vkal_info.default_command_buffers);
+    create_default_command_buffers();
+}
+
+/* Does not wait for the device: The old swapchain is handed to the new one as oldSwapchain and everything
+   that belonged to it is retired until the frames that were already submitted have finished. The default
+   command buffers are per image: They stay while the image count is the same, images_in_flight keeps
+   protecting them, otherwise they are reallocated once the frames that recorded them have finished. */
 void recreate_swapchain(void)
 {
-    vkDeviceWaitIdle(vkal_info.device);
-    
-    cleanup_swapchain();
-    
-    create_swapchain();
+    retire_swapchains(0);
+    if (vkal_info.retired_swapchain_count == VKAL_MAX_RETIRED_SWAPCHAINS) {
+        retire_swapchains(1);
+    }
+    VkalRetiredSwapchain * retired = &vkal_info.retired_swapchains[vkal_info.retired_swapchain_count++];
+    memset(retired, 0, sizeof(VkalRetiredSwapchain));
+    retired->swapchain = vkal_info.swapchain;
+    retired->image_view_count = vkal_info.swapchain_image_count;
+    memcpy(retired->image_views, vkal_info.swapchain_image_views, vkal_info.swapchain_image_count * sizeof(VkImageView));
+    retired->framebuffers = vkal_info.framebuffers;
+    retired->framebuffer_count = vkal_info.framebuffer_count;
+    vkal_info.framebuffers = NULL;
+    vkal_info.framebuffer_count = 0;
+
+    create_swapchain(); // Passes the current swapchain as oldSwapchain.
     create_image_views();
-
-    vkal_destroy_image_view( vkal_info.depth_stencil_image_view );
-    vkal_destroy_image( vkal_info.depth_stencil_image );
-    vkal_destroy_device_memory( vkal_info.device_memory_depth_stencil ); // TODO: Is this smart to destroy the whole memory object?
-    create_default_depth_buffer();
+    recreate_default_depth_buffer(retired);
     create_default_framebuffers();
-    // TODO: Maybe we need to recreate the default command buffers (if client uses them)
-    // If so, check cleanup_spwapchain, that frees the default command buffers.
-    // create_default_command_buffers();
+    if (vkal_info.framebuffer_count != vkal_info.default_command_buffer_count) {
+        resize_default_command_buffers();
+    }
+
+    // Signals once everything submitted so far has finished, i.e. the last frames that used the old resources.
+    VkSubmitInfo submit_info = { 0 };
+    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    if (vkal_info.timeline_enabled) {
+        retired->timeline_value = submit_to_queue(vkal_info.graphics_queue, &submit_info, VK_NULL_HANDLE);
+    }
+    else {
+        VkFenceCreateInfo fence_info = { 0 };
+        fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        VkResult result = vkCreateFence(vkal_info.device, &fence_info, 0, &retired->fence);
+        VKAL_ASSERT(result && "failed to create swapchain retire fence!");
+        submit_to_queue(vkal_info.graphics_queue, &submit_info, retired->fence);
+    }
 }
 
 void create_swapchain(void)
@@ -960,7 +1479,7 @@ void create_swapchain(void)
     create_info.imageArrayLayers = 1;
     create_info.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
     
-    QueueFamilyIndicies indices = find_queue_families(vkal_info.physical_device, vkal_info.surface);
+    QueueFamilyIndicies indices = vkal_info.queue_families;
     uint32_t queue_family_indices[2];
     queue_family_indices[0] = indices.graphics_family;
     queue_family_indices[1] = indices.present_family;
@@ -979,7 +1498,7 @@ void create_swapchain(void)
 	create_info.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
     create_info.presentMode = present_mode;
     create_info.clipped = VK_TRUE;
-    create_info.oldSwapchain = VK_NULL_HANDLE;
+    create_info.oldSwapchain = vkal_info.swapchain; // VK_NULL_HANDLE unless we are recreating.
     
 	VkResult result = vkCreateSwapchainKHR(vkal_info.device, &create_info, 0, &vkal_info.swapchain);
     VKAL_ASSERT(result && "failed to create swapchain!");
@@ -992,6 +1511,26 @@ void create_swapchain(void)
     vkal_info.swapchain_extent = extent;
 }
 
+/* Stand-in for the swapchain when running headless. The images are regular VKAL images, so they
+   get cleaned up together with all the other user images. */
+void create_headless_images(void)
+{
+    vkal_info.swapchain_image_count = VKAL_MAX_SWAPCHAIN_IMAGES;
+    vkal_info.swapchain_image_format = VKAL_HEADLESS_FORMAT;
+    for (uint32_t i = 0; i < vkal_info.swapchain_image_count; ++i) {
+        create_image(
+            vkal_info.swapchain_extent.width, vkal_info.swapchain_extent.height,
+            1, 1, 0,
+            VKAL_HEADLESS_FORMAT,
+            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+            &vkal_info.headless_images[i]);
+
+        vkal_allocate_image_memory(vkal_info.headless_images[i], VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &vkal_info.headless_image_memory[i]);
+
+        vkal_info.swapchain_images[i] = get_image(vkal_info.headless_images[i]);
+    }
+}
+
 void create_image_views(void)
 {
     for (uint32_t i = 0; i < vkal_info.swapchain_image_count; ++i) {
@@ -1018,7 +1557,7 @@ void create_image_views(void)
 void create_image(uint32_t width, uint32_t height, uint32_t mip_levels, uint32_t array_layers, 
 		  VkImageCreateFlags flags, VkFormat format, VkImageUsageFlags usage_flags, uint32_t * out_image_id)
 {
-    QueueFamilyIndicies indicies = find_queue_families(vkal_info.physical_device, vkal_info.surface);
+    QueueFamilyIndicies indicies = vkal_info.queue_families;
     VkImageCreateInfo image_info = { 0 };
     image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
     image_info.extent.width  = width;
@@ -1036,31 +1575,24 @@ void create_image(uint32_t width, uint32_t height, uint32_t mip_levels, uint32_t
     image_info.arrayLayers = array_layers;
     image_info.flags = flags;
     image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-    uint32_t free_image_index;
-    for (free_image_index = 0; free_image_index < VKAL_MAX_VKIMAGE; ++free_image_index) {
-		if (vkal_info.user_images[free_image_index].used) { 
-			continue;
-		} 
-		break;
-    }
-    VkResult result = vkCreateImage(vkal_info.device, &image_info, 0, &vkal_info.user_images[ free_image_index ].image);
+    VkalImageHandle * image_handle;
+    uint32_t image_id = handle_pool_alloc(&vkal_info.user_images, (void**)&image_handle);
+    VkResult result = vkCreateImage(vkal_info.device, &image_info, 0, &image_handle->image);
     VKAL_ASSERT(result && "failed to create VkImage!");
-    vkal_info.user_images[free_image_index].used = 1;
-    *out_image_id = free_image_index;
+    *out_image_id = image_id;
 }
 
 void vkal_destroy_image(uint32_t id)
 {
-    if (vkal_info.user_images[id].used) {
+    if (handle_pool_valid(&vkal_info.user_images, id)) {
 		vkDestroyImage(vkal_info.device, get_image(id), 0);
-		vkal_info.user_images[id].used = 0;
+		handle_pool_free(&vkal_info.user_images, id);
     }
 }
 
 VkImage get_image(uint32_t id)
 {
-    assert(vkal_info.user_images[id].used > 0);
-    return vkal_info.user_images[id].image;
+    return ((VkalImageHandle*)handle_pool_get(&vkal_info.user_images, id))->image;
 }
 
 void vkal_create_image_view(VkImage image,
@@ -1085,35 +1617,27 @@ void vkal_create_image_view(VkImage image,
     view_info.subresourceRange.baseArrayLayer = base_array_layer;
     view_info.subresourceRange.layerCount = array_layer_count;
 
-    uint32_t free_index;
-    for (free_index = 0; free_index < VKAL_MAX_VKDEVICEMEMORY; ++free_index) {
-	    if (vkal_info.user_image_views[free_index].used) {
-	        continue;
-	    }
-	    break;
-    }
+    VkalImageViewHandle * image_view_handle;
+    uint32_t image_view_id = handle_pool_alloc(&vkal_info.user_image_views, (void**)&image_view_handle);
     VkResult result = vkCreateImageView(vkal_info.device, &view_info,
 					0,
-					&vkal_info.user_image_views[free_index].image_view);
+					&image_view_handle->image_view);
     VKAL_ASSERT(result && "failed to create VkImageView!");
 
-    *out_image_view = free_index;
-    vkal_info.user_image_views[free_index].used = 1;
+    *out_image_view = image_view_id;
 }
 
 void vkal_destroy_image_view(uint32_t id)
 {
-    if (vkal_info.user_image_views[id].used) {
-	    vkDestroyImageView(vkal_info.device, vkal_info.user_image_views[id].image_view, 0);
-	    vkal_info.user_image_views[id].used = 0;
+    if (handle_pool_valid(&vkal_info.user_image_views, id)) {
+	    vkDestroyImageView(vkal_info.device, get_image_view(id), 0);
+	    handle_pool_free(&vkal_info.user_image_views, id);
     }
 }
 
 VkImageView get_image_view(uint32_t id)
 {
-    assert(id < VKAL_MAX_VKIMAGEVIEW);
-    assert(vkal_info.user_image_views[id].used > 0);
-    return vkal_info.user_image_views[id].image_view;
+    return ((VkalImageViewHandle*)handle_pool_get(&vkal_info.user_image_views, id))->image_view;
 }
 
 // TODO: Too view options!
@@ -1146,31 +1670,23 @@ VkSampler create_sampler(VkFilter min_filter, VkFilter mag_filter, VkSamplerAddr
 
 static void internal_create_sampler(VkSamplerCreateInfo create_info, uint32_t * out_sampler)
 {
-    uint32_t free_index;
-    for (free_index = 0; free_index < VKAL_MAX_VKSAMPLER; ++free_index) {
-		if (vkal_info.user_samplers[free_index].used) {
-			continue;
-		}
-		break;
-    }
-    VkResult result = vkCreateSampler(vkal_info.device, &create_info, 0, &vkal_info.user_samplers[free_index].sampler);
+    VkalSamplerHandle * sampler_handle;
+    uint32_t sampler_id = handle_pool_alloc(&vkal_info.user_samplers, (void**)&sampler_handle);
+    VkResult result = vkCreateSampler(vkal_info.device, &create_info, 0, &sampler_handle->sampler);
     VKAL_ASSERT(result && "failed to create VkSampler!");
-    vkal_info.user_samplers[free_index].used = 1;
-    *out_sampler = free_index;
+    *out_sampler = sampler_id;
 }
 
 VkSampler get_sampler(uint32_t id)
 {
-    assert(id < VKAL_MAX_VKSAMPLER);
-    assert(vkal_info.user_samplers[id].used);
-    return vkal_info.user_samplers[id].sampler;
+    return ((VkalSamplerHandle*)handle_pool_get(&vkal_info.user_samplers, id))->sampler;
 }
 
 void destroy_sampler(uint32_t id)
 {
-    if (vkal_info.user_samplers[id].used) {
+    if (handle_pool_valid(&vkal_info.user_samplers, id)) {
 	    vkDestroySampler(vkal_info.device, get_sampler(id), 0);
-	    vkal_info.user_samplers[id].used = 0;
+	    handle_pool_free(&vkal_info.user_samplers, id);
     }
 }
 
@@ -1184,6 +1700,7 @@ void vkal_update_descriptor_set_render_image(VkDescriptorSet descriptor_set, uin
 
     VkWriteDescriptorSet write_set_image = create_write_descriptor_set_image(descriptor_set, binding, 1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, image_infos);
     vkUpdateDescriptorSets(vkal_info.device, 1, &write_set_image, 0, NULL);
+    vkal_info.frame_stats.descriptor_updates++;
 }
 
 void vkal_update_descriptor_set_texture(VkDescriptorSet descriptor_set, VkalTexture texture)
@@ -1199,6 +1716,7 @@ void vkal_update_descriptor_set_texture(VkDescriptorSet descriptor_set, VkalText
 		VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
 		image_infos);
     vkUpdateDescriptorSets(vkal_info.device, 1, &write_set_image, 0, NULL);
+    vkal_info.frame_stats.descriptor_updates++;
 }
 
 void vkal_update_descriptor_set_texturearray(
@@ -1218,6 +1736,7 @@ void vkal_update_descriptor_set_texturearray(
 	descriptor_type, image_infos);
 
     vkUpdateDescriptorSets(vkal_info.device, 1, &write_set_uniform, 0, NULL);
+    vkal_info.frame_stats.descriptor_updates++;
 }
 
 VkalTexture vkal_create_texture(
@@ -1248,14 +1767,7 @@ VkalTexture vkal_create_texture(
 		 &texture.image);
     
     // Back the image with actual memory:	
-    VkMemoryRequirements image_memory_requirements = { 0 };
-    vkGetImageMemoryRequirements(vkal_info.device, get_image(texture.image), &image_memory_requirements);
-    uint32_t mem_type_bits = check_memory_type_index(image_memory_requirements.memoryTypeBits,
-						     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-    create_device_memory(image_memory_requirements.size, mem_type_bits, &texture.device_memory_id);
-    VkResult result = vkBindImageMemory(vkal_info.device,
-					get_image(texture.image), get_device_memory(texture.device_memory_id), 0);
-    VKAL_ASSERT(result && "failed to bind texture image memory!");
+    vkal_allocate_image_memory(texture.image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &texture.device_memory_id);
     
     vkal_create_image_view(get_image(texture.image), view_type,
 		      format, VK_IMAGE_ASPECT_COLOR_BIT,
@@ -1282,94 +1794,738 @@ void create_staging_buffer(uint32_t size)
     VkMemoryRequirements buffer_memory_requirements = { 0 };
     vkGetBufferMemoryRequirements(vkal_info.device, vkal_info.staging_buffer.buffer, &buffer_memory_requirements);
     uint32_t mem_type_bits = check_memory_type_index(buffer_memory_requirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
-    vkal_info.device_memory_staging = allocate_memory(buffer_memory_requirements.size, mem_type_bits);
+    vkal_info.device_memory_staging = allocate_memory(buffer_memory_requirements.size, mem_type_bits, VKAL_MEMORY_CATEGORY_STAGING);
     VkResult result = vkBindBufferMemory(vkal_info.device, vkal_info.staging_buffer.buffer, vkal_info.device_memory_staging, 0);
     VKAL_ASSERT(result &&  "failed to bind memory");
+
+    // The staging memory stays mapped for the lifetime of VKAL.
+    vkal_info.staging_coherent = (vkal_info.memory_properties.memoryTypes[mem_type_bits].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+    result = vkMapMemory(vkal_info.device, vkal_info.device_memory_staging, 0, VK_WHOLE_SIZE, 0, &vkal_info.staging_mapped);
+    VKAL_ASSERT(result && "failed to map device staging memory!");
+    uint64_t atom = vkal_info.physical_device_properties.limits.nonCoherentAtomSize;
+    ring_init(&vkal_info.staging_ring, (size / atom) * atom);
 }
 
-DeviceMemory vkal_allocate_devicememory(uint32_t size,
-					VkBufferUsageFlags buffer_usage_flags,
-					VkMemoryPropertyFlags memory_property_flags,
-                    VkFlags mem_alloc_flags)
+void ring_init(VkalRing * ring, VkDeviceSize size)
 {
-    /* Create a dummy buffer so we can select the best possible memory for this type
-       of buffer via vkGetBufferMemoryRequirements 
-    */
-    uint64_t alignment = vkal_info.physical_device_properties.limits.nonCoherentAtomSize;
-    uint64_t aligned_size = (size + alignment - 1) & ~(alignment - 1);
+    ring->size = size;
+    ring->head = 0;
+    ring->tail = 0;
+    ring->used = 0;
+}
 
-    VkBuffer buffer = create_buffer(aligned_size, buffer_usage_flags).buffer;
-    VkMemoryRequirements buffer_memory_requirements = { 0 };
-    vkGetBufferMemoryRequirements(vkal_info.device, buffer, &buffer_memory_requirements);
-    uint32_t mem_type_bits = check_memory_type_index(buffer_memory_requirements.memoryTypeBits, memory_property_flags);
-    vkDestroyBuffer(vkal_info.device, buffer, NULL);
+/* Returns 0 if there is not enough space between head and tail right now. */
+int ring_alloc(VkalRing * ring, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize * out_offset)
+{
+    if (alignment == 0) alignment = 1;
+    if (ring->used == 0) {
+        ring->head = 0;
+        ring->tail = 0;
+    }
+    VkDeviceSize aligned_head = ((ring->head + alignment - 1) / alignment) * alignment;
+    VkDeviceSize offset;
+    if (ring->used == 0 || ring->head > ring->tail) {
+        if (aligned_head + size <= ring->size) {
+            offset = aligned_head;
+        }
+        else if (size <= ring->tail || (ring->used == 0 && size <= ring->size)) {
+            offset = 0; // wrap around, the rest at the end is skipped
+        }
+        else {
+            return 0;
+        }
+    }
+    else {
+        if (aligned_head + size <= ring->tail) {
+            offset = aligned_head;
+        }
+        else {
+            return 0;
+        }
+    }
 
-    VkMemoryAllocateFlagsInfo mem_alloc_flags_info = { 0 };
-    mem_alloc_flags_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO;
-    mem_alloc_flags_info.flags = mem_alloc_flags;    
+    VkDeviceSize new_head = offset + size;
+    if (offset >= ring->head) {
+        ring->used += new_head - ring->head;
+    }
+    else {
+        ring->used += (ring->size - ring->head) + new_head;
+    }
+    ring->head = new_head;
+    *out_offset = offset;
+    return 1;
+}
+
+/* Gives back everything up to 'end', which must be a head position returned earlier. */
+void ring_release(VkalRing * ring, VkDeviceSize end)
+{
+    ring->tail = end;
+    if (ring->tail == ring->head) {
+        ring->used = 0;
+    }
+    else if (ring->head > ring->tail) {
+        ring->used = ring->head - ring->tail;
+    }
+    else {
+        ring->used = (ring->size - ring->tail) + ring->head;
+    }
+}
+
+void create_upload_batches(void)
+{
+    VkCommandPool upload_pool = vkal_info.default_command_pools[0];
+    if (vkal_info.dedicated_transfer) {
+        VkCommandPoolCreateInfo cmdpool_info = { 0 };
+        cmdpool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        cmdpool_info.queueFamilyIndex = vkal_info.transfer_family;
+        cmdpool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+        VkResult result = vkCreateCommandPool(vkal_info.device, &cmdpool_info, 0, &vkal_info.transfer_command_pool);
+        VKAL_ASSERT(result && "failed to create transfer command pool!");
+        upload_pool = vkal_info.transfer_command_pool;
+    }
+
+    for (uint32_t i = 0; i < VKAL_MAX_UPLOAD_BATCHES; ++i) {
+        VkalUploadBatch * batch = &vkal_info.upload_batches[i];
+        VkCommandBufferAllocateInfo allocate_info = { 0 };
+        allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocate_info.commandBufferCount = 1;
+        allocate_info.commandPool = upload_pool;
+        allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        VkResult result = vkAllocateCommandBuffers(vkal_info.device, &allocate_info, &batch->command_buffer);
+        VKAL_ASSERT(result && "failed to allocate upload command buffer!");
+
+        VkFenceCreateInfo fence_info = { 0 };
+        fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        result = vkCreateFence(vkal_info.device, &fence_info, 0, &batch->fence);
+        VKAL_ASSERT(result && "failed to create upload fence!");
+        batch->state = VKAL_UPLOAD_BATCH_FREE;
+        batch->ticket = 0;
+
+        if (vkal_info.dedicated_transfer) {
+            allocate_info.commandPool = vkal_info.default_command_pools[0];
+            result = vkAllocateCommandBuffers(vkal_info.device, &allocate_info, &batch->acquire_command_buffer);
+            VKAL_ASSERT(result && "failed to allocate upload acquire command buffer!");
+            VkSemaphoreCreateInfo semaphore_info = { 0 };
+            semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+            result = vkCreateSemaphore(vkal_info.device, &semaphore_info, 0, &batch->transfer_done);
+            VKAL_ASSERT(result && "failed to create upload semaphore!");
+            result = vkCreateSemaphore(vkal_info.device, &semaphore_info, 0, &batch->graphics_done);
+            VKAL_ASSERT(result && "failed to create upload semaphore!");
+        }
+    }
+    vkal_info.upload_batch_recording = VKAL_MAX_UPLOAD_BATCHES;
+    vkal_info.upload_ticket_next = 1;
+    vkal_info.upload_ticket_completed = 0;
+}
+
+void destroy_upload_batches(void)
+{
+    for (uint32_t i = 0; i < VKAL_MAX_UPLOAD_BATCHES; ++i) {
+        VkalUploadBatch * batch = &vkal_info.upload_batches[i];
+        vkDestroyFence(vkal_info.device, batch->fence, 0);
+        if (vkal_info.dedicated_transfer) {
+            vkFreeCommandBuffers(vkal_info.device, vkal_info.default_command_pools[0], 1, &batch->acquire_command_buffer);
+            vkDestroySemaphore(vkal_info.device, batch->transfer_done, 0);
+            vkDestroySemaphore(vkal_info.device, batch->graphics_done, 0);
+        }
+        else {
+            vkFreeCommandBuffers(vkal_info.device, vkal_info.default_command_pools[0], 1, &batch->command_buffer);
+        }
+    }
+    if (vkal_info.dedicated_transfer) {
+        vkDestroyCommandPool(vkal_info.device, vkal_info.transfer_command_pool, 0);
+    }
+    if (vkal_info.staging_mapped) {
+        vkUnmapMemory(vkal_info.device, vkal_info.device_memory_staging);
+        vkal_info.staging_mapped = NULL;
+    }
+}
+
+/* Retires submitted batches in ticket order. Blocks for batches up to 'wait_ticket', returns as
+   soon as a later batch is still executing. Returns the number of retired batches. */
+static uint32_t retire_upload_batches(uint64_t wait_ticket)
+{
+    uint32_t retired = 0;
+    for (;;) {
+        VkalUploadBatch * oldest = NULL;
+        for (uint32_t i = 0; i < VKAL_MAX_UPLOAD_BATCHES; ++i) {
+            VkalUploadBatch * batch = &vkal_info.upload_batches[i];
+            if (batch->state == VKAL_UPLOAD_BATCH_SUBMITTED && (!oldest || batch->ticket < oldest->ticket)) {
+                oldest = batch;
+            }
+        }
+        if (!oldest) {
+            break;
+        }
+        if (vkal_info.timeline_enabled) {
+            if (oldest->ticket <= wait_ticket) {
+                vkal_wait_value(oldest->timeline_value);
+            }
+            else if (vkal_gpu_progress() < oldest->timeline_value) {
+                break;
+            }
+        }
+        else {
+            if (oldest->ticket <= wait_ticket) {
+                vkWaitForFences(vkal_info.device, 1, &oldest->fence, VK_TRUE, UINT64_MAX);
+            }
+            else if (vkGetFenceStatus(vkal_info.device, oldest->fence) != VK_SUCCESS) {
+                break;
+            }
+            vkResetFences(vkal_info.device, 1, &oldest->fence);
+        }
+        ring_release(&vkal_info.staging_ring, oldest->ring_end);
+        vkal_info.upload_ticket_completed = oldest->ticket;
+        oldest->state = VKAL_UPLOAD_BATCH_FREE;
+        retired++;
+    }
+    return retired;
+}
+
+static uint64_t oldest_submitted_upload_ticket(void)
+{
+    uint64_t oldest = 0;
+    for (uint32_t i = 0; i < VKAL_MAX_UPLOAD_BATCHES; ++i) {
+        VkalUploadBatch * batch = &vkal_info.upload_batches[i];
+        if (batch->state == VKAL_UPLOAD_BATCH_SUBMITTED && (!oldest || batch->ticket < oldest)) {
+            oldest = batch->ticket;
+        }
+    }
+    return oldest;
+}
+
+/* Reserves space in the staging ring and returns a pointer to it. If the ring is full the open
+   batch gets submitted and we wait for the oldest uploads to finish. */
+static void * staging_alloc(VkDeviceSize size, VkDeviceSize * out_offset)
+{
+    // bufferOffset of vkCmdCopyBufferToImage must be a multiple of 4 and of the texel size.
+    // Flushed ranges must start at a multiple of nonCoherentAtomSize.
+    uint64_t atom = vkal_info.physical_device_properties.limits.nonCoherentAtomSize;
+    VkDeviceSize alignment = VKAL_MAX(atom, 16);
+    VkDeviceSize aligned_size = ((size + atom - 1) / atom) * atom;
+    assert(aligned_size <= vkal_info.staging_ring.size && "staging_alloc: upload is bigger than the staging buffer!");
+    vkal_info.frame_stats.upload_bytes += size;
+    vkal_info.frame_stats.upload_count++;
+
+    retire_upload_batches(0);
+    while (!ring_alloc(&vkal_info.staging_ring, aligned_size, alignment, out_offset)) {
+        if (vkal_info.upload_batch_recording != VKAL_MAX_UPLOAD_BATCHES) {
+            vkal_flush_uploads();
+        }
+        uint64_t oldest = oldest_submitted_upload_ticket();
+        assert(oldest && "staging_alloc: staging ring is full but no upload is in flight!");
+        retire_upload_batches(oldest);
+    }
+    return (uint8_t*)vkal_info.staging_mapped + *out_offset;
+}
+
+void create_transient_buffer(uint32_t size)
+{
+    vkal_info.transient_buffer = create_buffer(size,
+        VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT |
+        VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+        VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+	VKAL_DBG_BUFFER_NAME(vkal_info.device, vkal_info.transient_buffer, "Transient Buffer");
+    VkMemoryRequirements buffer_memory_requirements = { 0 };
+    vkGetBufferMemoryRequirements(vkal_info.device, vkal_info.transient_buffer.buffer, &buffer_memory_requirements);
+    uint32_t mem_type_index = check_memory_type_index(buffer_memory_requirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+    vkal_info.device_memory_transient = allocate_memory(buffer_memory_requirements.size, mem_type_index, VKAL_MEMORY_CATEGORY_STAGING);
+    VkResult result = vkBindBufferMemory(vkal_info.device, vkal_info.transient_buffer.buffer, vkal_info.device_memory_transient, 0);
+    VKAL_ASSERT(result && "failed to bind transient buffer memory!");
+    vkal_info.transient_buffer.device_memory = vkal_info.device_memory_transient;
+
+    vkal_info.transient_coherent = (vkal_info.memory_properties.memoryTypes[mem_type_index].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+    result = vkMapMemory(vkal_info.device, vkal_info.device_memory_transient, 0, VK_WHOLE_SIZE, 0, &vkal_info.transient_buffer.mapped);
+    VKAL_ASSERT(result && "failed to map transient memory!");
+
+    // Regions start at a multiple of nonCoherentAtomSize so they can be flushed independently.
+    uint64_t atom = vkal_info.physical_device_properties.limits.nonCoherentAtomSize;
+    vkal_info.transient_region_size = ((size / vkal_info.frames_in_flight) / atom) * atom;
+    vkal_info.transient_head = 0;
+    vkal_info.transient_flushed = 0;
+}
+
+/* 'alignment' must be a power of two, e.g. the vertex/index size or minUniformBufferOffsetAlignment. */
+VkalTransientAllocation vkal_transient_alloc(VkDeviceSize size, VkDeviceSize alignment)
+{
+    if (alignment == 0) {
+        alignment = 1;
+    }
+    VkDeviceSize offset = (vkal_info.transient_head + alignment - 1) & ~(alignment - 1);
+    VkDeviceSize region_end = (vkal_info.frames_rendered + 1) * vkal_info.transient_region_size;
+    if (offset + size > region_end) {
+        printf("[VKAL] vkal_transient_alloc: transient region of %llu bytes is full!\n", (unsigned long long)vkal_info.transient_region_size);
+        VKAL_ASSERT(VK_ERROR_OUT_OF_DEVICE_MEMORY && "vkal_transient_alloc: out of transient memory!");
+    }
+    vkal_info.transient_head = offset + size;
+
+    VkalTransientAllocation allocation = { 0 };
+    allocation.buffer = vkal_info.transient_buffer;
+    allocation.offset = offset;
+    allocation.data = (uint8_t*)vkal_info.transient_buffer.mapped + offset;
+    return allocation;
+}
+
+/* Flushes what was allocated since the last flush. Called by the submit functions. */
+void vkal_flush_transient(void)
+{
+    if (vkal_info.transient_coherent || vkal_info.transient_head == vkal_info.transient_flushed) {
+        return;
+    }
+    uint64_t atom = vkal_info.physical_device_properties.limits.nonCoherentAtomSize;
+    VkDeviceSize begin = vkal_info.transient_flushed & ~(atom - 1);
+    VkDeviceSize end = (vkal_info.transient_head + atom - 1) & ~(atom - 1);
+    VkMappedMemoryRange flush_range = { 0 };
+    flush_range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+    flush_range.memory = vkal_info.device_memory_transient;
+    flush_range.offset = begin;
+    flush_range.size = end - begin;
+    VkResult result = vkFlushMappedMemoryRanges(vkal_info.device, 1, &flush_range);
+    VKAL_ASSERT(result && "failed to flush transient memory!");
+    vkal_info.transient_flushed = vkal_info.transient_head;
+}
+
+static void staging_flush(VkDeviceSize offset, VkDeviceSize size)
+{
+    if (vkal_info.staging_coherent) {
+        return;
+    }
+    uint64_t atom = vkal_info.physical_device_properties.limits.nonCoherentAtomSize;
+    VkMappedMemoryRange flush_range = { 0 };
+    flush_range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+    flush_range.memory = vkal_info.device_memory_staging;
+    flush_range.offset = offset;
+    flush_range.size = ((size + atom - 1) / atom) * atom;
+    VkResult result = vkFlushMappedMemoryRanges(vkal_info.device, 1, &flush_range);
+    VKAL_ASSERT(result && "failed to flush staging memory!");
+}
+
+/* Returns the command buffer of the open batch, opening a new one if needed. The staging range
+   allocated right before belongs to this batch. */
+static VkCommandBuffer upload_command_buffer(void)
+{
+    if (vkal_info.upload_batch_recording != VKAL_MAX_UPLOAD_BATCHES) {
+        VkalUploadBatch * batch = &vkal_info.upload_batches[vkal_info.upload_batch_recording];
+        if (batch->buffer_barrier_count == VKAL_MAX_UPLOAD_BARRIERS || batch->image_barrier_count == VKAL_MAX_UPLOAD_BARRIERS) {
+            vkal_flush_uploads();
+        }
+    }
+    if (vkal_info.upload_batch_recording == VKAL_MAX_UPLOAD_BATCHES) {
+        uint32_t free_index = VKAL_MAX_UPLOAD_BATCHES;
+        while (free_index == VKAL_MAX_UPLOAD_BATCHES) {
+            for (uint32_t i = 0; i < VKAL_MAX_UPLOAD_BATCHES; ++i) {
+                if (vkal_info.upload_batches[i].state == VKAL_UPLOAD_BATCH_FREE) {
+                    free_index = i;
+                    break;
+                }
+            }
+            if (free_index == VKAL_MAX_UPLOAD_BATCHES) {
+                retire_upload_batches(oldest_submitted_upload_ticket());
+            }
+        }
+
+        VkalUploadBatch * batch = &vkal_info.upload_batches[free_index];
+        batch->ticket = vkal_info.upload_ticket_next++;
+        batch->state = VKAL_UPLOAD_BATCH_RECORDING;
+        batch->wait_graphics = 0;
+        batch->buffer_barrier_count = 0;
+        batch->image_barrier_count = 0;
+        vkal_info.upload_batch_recording = free_index;
+
+        VkCommandBufferBeginInfo begin_info = { 0 };
+        begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        VkResult result = vkBeginCommandBuffer(batch->command_buffer, &begin_info);
+        VKAL_ASSERT(result && "failed to begin upload command buffer!");
+
+        // Write-after-read: Earlier frames may still read the ranges we are about to overwrite.
+        // On a dedicated transfer queue this is covered by waiting on the graphics queue instead (see wait_graphics).
+        vkCmdPipelineBarrier(batch->command_buffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             0, 0, NULL, 0, NULL, 0, NULL);
+    }
+    VkalUploadBatch * batch = &vkal_info.upload_batches[vkal_info.upload_batch_recording];
+    batch->ring_end = vkal_info.staging_ring.head;
+    return batch->command_buffer;
+}
+
+/* Queue family ownership of everything written by the batch goes from the transfer family to the
+   graphics family. The release half is recorded here, the acquire half is kept for the graphics queue. */
+static void upload_add_buffer_ownership(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size)
+{
+    VkalUploadBatch * batch = &vkal_info.upload_batches[vkal_info.upload_batch_recording];
+    VkBufferMemoryBarrier * barrier = &batch->buffer_barriers[batch->buffer_barrier_count++];
+    memset(barrier, 0, sizeof(VkBufferMemoryBarrier));
+    barrier->sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier->srcQueueFamilyIndex = vkal_info.transfer_family;
+    barrier->dstQueueFamilyIndex = vkal_info.graphics_family;
+    barrier->buffer = buffer;
+    barrier->offset = offset;
+    barrier->size = size;
+}
+
+static void upload_add_image_ownership(VkImage image, VkImageSubresourceRange range, VkImageLayout old_layout, VkImageLayout new_layout)
+{
+    VkalUploadBatch * batch = &vkal_info.upload_batches[vkal_info.upload_batch_recording];
+    VkImageMemoryBarrier * barrier = &batch->image_barriers[batch->image_barrier_count++];
+    memset(barrier, 0, sizeof(VkImageMemoryBarrier));
+    barrier->sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier->srcQueueFamilyIndex = vkal_info.transfer_family;
+    barrier->dstQueueFamilyIndex = vkal_info.graphics_family;
+    barrier->oldLayout = old_layout;
+    barrier->newLayout = new_layout;
+    barrier->image = image;
+    barrier->subresourceRange = range;
+}
+
+/* Transfer queue: copies + release. Graphics queue: acquire, waiting on the transfer. If the batch
+   overwrites memory that earlier frames may still read, the transfer first waits for the graphics queue. */
+static void submit_uploads_dedicated(VkalUploadBatch * batch)
+{
+    for (uint32_t i = 0; i < batch->buffer_barrier_count; ++i) {
+        batch->buffer_barriers[i].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        batch->buffer_barriers[i].dstAccessMask = 0;
+    }
+    for (uint32_t i = 0; i < batch->image_barrier_count; ++i) {
+        batch->image_barriers[i].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        batch->image_barriers[i].dstAccessMask = 0;
+    }
+    vkCmdPipelineBarrier(batch->command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+                         0, NULL,
+                         batch->buffer_barrier_count, batch->buffer_barriers,
+                         batch->image_barrier_count, batch->image_barriers);
+    VkResult result = vkEndCommandBuffer(batch->command_buffer);
+    VKAL_ASSERT(result && "failed to end upload command buffer!");
+
+    VkCommandBufferBeginInfo begin_info = { 0 };
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    result = vkBeginCommandBuffer(batch->acquire_command_buffer, &begin_info);
+    VKAL_ASSERT(result && "failed to begin upload acquire command buffer!");
+    for (uint32_t i = 0; i < batch->buffer_barrier_count; ++i) {
+        batch->buffer_barriers[i].srcAccessMask = 0;
+        batch->buffer_barriers[i].dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+    }
+    for (uint32_t i = 0; i < batch->image_barrier_count; ++i) {
+        batch->image_barriers[i].srcAccessMask = 0;
+        batch->image_barriers[i].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    }
+    vkCmdPipelineBarrier(batch->acquire_command_buffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0,
+                         0, NULL,
+                         batch->buffer_barrier_count, batch->buffer_barriers,
+                         batch->image_barrier_count, batch->image_barriers);
+    result = vkEndCommandBuffer(batch->acquire_command_buffer);
+    VKAL_ASSERT(result && "failed to end upload acquire command buffer!");
+
+    if (batch->wait_graphics) {
+        VkSubmitInfo signal_info = { 0 };
+        signal_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        signal_info.signalSemaphoreCount = 1;
+        signal_info.pSignalSemaphores = &batch->graphics_done;
+        result = vkQueueSubmit(vkal_info.graphics_queue, 1, &signal_info, VK_NULL_HANDLE);
+        VKAL_ASSERT(result && "failed to submit upload graphics signal!");
+    }
+
+    VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    VkSubmitInfo transfer_info = { 0 };
+    transfer_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    transfer_info.waitSemaphoreCount = batch->wait_graphics ? 1 : 0;
+    transfer_info.pWaitSemaphores = &batch->graphics_done;
+    transfer_info.pWaitDstStageMask = &wait_stage;
+    transfer_info.commandBufferCount = 1;
+    transfer_info.pCommandBuffers = &batch->command_buffer;
+    transfer_info.signalSemaphoreCount = 1;
+    transfer_info.pSignalSemaphores = &batch->transfer_done;
+    result = vkQueueSubmit(vkal_info.transfer_queue, 1, &transfer_info, VK_NULL_HANDLE);
+    VKAL_ASSERT(result && "failed to submit uploads to transfer queue!");
+
+    VkPipelineStageFlags acquire_stage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+    VkSubmitInfo acquire_info = { 0 };
+    acquire_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    acquire_info.waitSemaphoreCount = 1;
+    acquire_info.pWaitSemaphores = &batch->transfer_done;
+    acquire_info.pWaitDstStageMask = &acquire_stage;
+    acquire_info.commandBufferCount = 1;
+    acquire_info.pCommandBuffers = &batch->acquire_command_buffer;
+    VkFence fence = vkal_info.timeline_enabled ? VK_NULL_HANDLE : batch->fence;
+    batch->timeline_value = submit_to_queue(vkal_info.graphics_queue, &acquire_info, fence);
+}
+
+/* Ticket that covers every upload issued so far. */
+uint64_t vkal_upload_ticket(void)
+{
+    if (vkal_info.upload_batch_recording != VKAL_MAX_UPLOAD_BATCHES) {
+        return vkal_info.upload_batches[vkal_info.upload_batch_recording].ticket;
+    }
+    return vkal_info.upload_ticket_next - 1;
+}
+
+/* Submits the open batch (if any) to the graphics queue and returns its ticket. */
+uint64_t vkal_flush_uploads(void)
+{
+    if (vkal_info.upload_batch_recording == VKAL_MAX_UPLOAD_BATCHES) {
+        return vkal_info.upload_ticket_next - 1;
+    }
+    VkalUploadBatch * batch = &vkal_info.upload_batches[vkal_info.upload_batch_recording];
+
+    if (vkal_info.dedicated_transfer) {
+        submit_uploads_dedicated(batch);
+        if (batch->wait_graphics) {
+            vkal_info.upload_sync_graphics = 0;
+        }
+    }
+    else {
+        // Read-after-write: Make the copies visible to everything submitted after this batch.
+        VkMemoryBarrier memory_barrier = { 0 };
+        memory_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        memory_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        memory_barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+        vkCmdPipelineBarrier(batch->command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                             0, 1, &memory_barrier, 0, NULL, 0, NULL);
+        VkResult result = vkEndCommandBuffer(batch->command_buffer);
+        VKAL_ASSERT(result && "failed to end upload command buffer!");
+
+        VkSubmitInfo submit_info = { 0 };
+        submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submit_info.commandBufferCount = 1;
+        submit_info.pCommandBuffers = &batch->command_buffer;
+        VkFence fence = vkal_info.timeline_enabled ? VK_NULL_HANDLE : batch->fence;
+        batch->timeline_value = submit_to_queue(vkal_info.graphics_queue, &submit_info, fence);
+    }
+
+    batch->state = VKAL_UPLOAD_BATCH_SUBMITTED;
+    vkal_info.upload_batch_recording = VKAL_MAX_UPLOAD_BATCHES;
+    return batch->ticket;
+}
+
+/* Blocks until all uploads up to and including 'ticket' have finished on the GPU. */
+void vkal_wait_upload(uint64_t ticket)
+{
+    if (vkal_info.upload_batch_recording != VKAL_MAX_UPLOAD_BATCHES &&
+        ticket >= vkal_info.upload_batches[vkal_info.upload_batch_recording].ticket) {
+        vkal_flush_uploads();
+    }
+    retire_upload_batches(ticket);
+}
+
+int vkal_upload_finished(uint64_t ticket)
+{
+    retire_upload_batches(0);
+    return vkal_info.upload_ticket_completed >= ticket;
+}
+
+static VkalMemoryCategory memory_category_from_usage(VkBufferUsageFlags usage)
+{
+    if (usage & VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR) {
+        return VKAL_MEMORY_CATEGORY_ACCELERATION_STRUCTURE;
+    }
+    if (usage & (VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT)) {
+        return VKAL_MEMORY_CATEGORY_VERTEX;
+    }
+    if (usage & VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT) {
+        return VKAL_MEMORY_CATEGORY_UNIFORM;
+    }
+    if (usage == VK_BUFFER_USAGE_TRANSFER_SRC_BIT) {
+        return VKAL_MEMORY_CATEGORY_STAGING;
+    }
+    return VKAL_MEMORY_CATEGORY_OTHER;
+}
+
+/* Budget and usage of every heap. Without VK_EXT_memory_budget the budget is the heap size and the usage is
+   what VKAL allocated. */
+static void query_memory_budget(VkDeviceSize * out_budget, VkDeviceSize * out_usage)
+{
+    VkPhysicalDeviceMemoryProperties const * properties = &vkal_info.memory_properties;
+    if (vkal_info.memory_budget_enabled) {
+        VkPhysicalDeviceMemoryBudgetPropertiesEXT budget = { 0 };
+        budget.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+        VkPhysicalDeviceMemoryProperties2 properties2 = { 0 };
+        properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+        properties2.pNext = &budget;
+        vkGetPhysicalDeviceMemoryProperties2(vkal_info.physical_device, &properties2);
+        for (uint32_t i = 0; i < properties->memoryHeapCount; ++i) {
+            out_budget[i] = budget.heapBudget[i];
+            out_usage[i] = budget.heapUsage[i];
+        }
+        return;
+    }
+    for (uint32_t i = 0; i < properties->memoryHeapCount; ++i) {
+        out_budget[i] = properties->memoryHeaps[i].size;
+        out_usage[i] = 0;
+    }
+    for (uint32_t i = 0; i < vkal_info.memory_allocation_count; ++i) {
+        out_usage[vkal_info.memory_allocations[i].heap] += vkal_info.memory_allocations[i].size;
+    }
+}
+
+/* Every vkAllocateMemory goes through here so vkal_get_memory_stats sees it. */
+static VkDeviceMemory allocate_tracked_memory(VkMemoryAllocateInfo const * memory_info, VkalMemoryCategory category)
+{
+    uint32_t heap = vkal_info.memory_properties.memoryTypes[memory_info->memoryTypeIndex].heapIndex;
+    VkDeviceSize budget[VK_MAX_MEMORY_HEAPS];
+    VkDeviceSize usage[VK_MAX_MEMORY_HEAPS];
+    query_memory_budget(budget, usage);
+    if (usage[heap] + memory_info->allocationSize > budget[heap]) {
+        printf("[VKAL] allocating %llu bytes exceeds the budget of heap %u: %llu of %llu bytes used.\n",
+               (unsigned long long)memory_info->allocationSize, heap,
+               (unsigned long long)usage[heap], (unsigned long long)budget[heap]);
+    }
 
     VkDeviceMemory memory = VK_NULL_HANDLE;
-    VkMemoryAllocateInfo memory_info = { 0 };
-    memory_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    memory_info.allocationSize = buffer_memory_requirements.size;
-    memory_info.memoryTypeIndex = mem_type_bits;
-    memory_info.pNext = (mem_alloc_flags == 0 ? 0 : &mem_alloc_flags_info);
-    VkResult result = vkAllocateMemory(vkal_info.device, &memory_info, 0, &memory);
+    VkResult result = vkAllocateMemory(vkal_info.device, memory_info, 0, &memory);
     VKAL_ASSERT(result && "failed to allocate device memory.");
 
+    if (vkal_info.memory_allocation_count == vkal_info.memory_allocation_capacity) {
+        vkal_info.memory_allocation_capacity = vkal_info.memory_allocation_capacity ? 2 * vkal_info.memory_allocation_capacity : 64;
+        vkal_info.memory_allocations = (VkalMemoryAllocation*)realloc(vkal_info.memory_allocations,
+                                                                      vkal_info.memory_allocation_capacity * sizeof(VkalMemoryAllocation));
+        assert(vkal_info.memory_allocations && "allocate_tracked_memory: out of memory!");
+    }
+    VkalMemoryAllocation * allocation = &vkal_info.memory_allocations[vkal_info.memory_allocation_count++];
+    allocation->memory = memory;
+    allocation->size = memory_info->allocationSize;
+    allocation->heap = heap;
+    allocation->category = category;
+    allocation->block = 0;
+    return memory;
+}
+
+void free_memory(VkDeviceMemory memory)
+{
+    if (memory == VK_NULL_HANDLE) {
+        return;
+    }
+    for (uint32_t i = 0; i < vkal_info.memory_allocation_count; ++i) {
+        if (vkal_info.memory_allocations[i].memory == memory) {
+            vkal_info.memory_allocations[i] = vkal_info.memory_allocations[--vkal_info.memory_allocation_count];
+            break;
+        }
+    }
+    vkFreeMemory(vkal_info.device, memory, 0);
+}
+
+DeviceMemory vkal_allocate_devicememory(uint32_t size,
+					VkBufferUsageFlags buffer_usage_flags,
+					VkMemoryPropertyFlags memory_property_flags,
+                    VkFlags mem_alloc_flags)
+{
+    /* Create a dummy buffer so we can select the best possible memory for this type
+       of buffer via vkGetBufferMemoryRequirements 
+    */
+    uint64_t alignment = vkal_info.physical_device_properties.limits.nonCoherentAtomSize;
+    uint64_t aligned_size = (size + alignment - 1) & ~(alignment - 1);
+
+    VkBuffer buffer = create_buffer(aligned_size, buffer_usage_flags).buffer;
+    VkMemoryRequirements buffer_memory_requirements = { 0 };
+    vkGetBufferMemoryRequirements(vkal_info.device, buffer, &buffer_memory_requirements);
+    uint32_t mem_type_bits = check_memory_type_index(buffer_memory_requirements.memoryTypeBits, memory_property_flags);
+    vkDestroyBuffer(vkal_info.device, buffer, NULL);
+
     DeviceMemory device_memory = { 0 };
-    device_memory.vk_device_memory = memory;
+    device_memory.memory_id = VKAL_INVALID_HANDLE;
     device_memory.size = buffer_memory_requirements.size;
     device_memory.alignment = buffer_memory_requirements.alignment;
     device_memory.free = 0;
     device_memory.mem_type_index = mem_type_bits;
+    VKAL_MALLOC(device_memory.free_list, 1);
+    free_list_init(device_memory.free_list, device_memory.size);
+
+    /* Host visible memory keeps its own VkDeviceMemory, as every buffer maps it on its own and a block
+       can only be mapped once. The blocks are allocated without VkMemoryAllocateFlagsInfo. */
+    if (!(memory_property_flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) && mem_alloc_flags == 0) {
+        sub_allocate_memory(buffer_memory_requirements, mem_type_bits, 1, memory_category_from_usage(buffer_usage_flags),
+                            &device_memory.memory_id);
+        device_memory.vk_device_memory = get_device_memory(device_memory.memory_id);
+        device_memory.offset = get_device_memory_offset(device_memory.memory_id);
+        device_memory.free_list->ranges[0].offset = device_memory.offset;
+        return device_memory;
+    }
+
+    VkMemoryAllocateFlagsInfo mem_alloc_flags_info = { 0 };
+    mem_alloc_flags_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO;
+    mem_alloc_flags_info.flags = mem_alloc_flags;    
+
+    VkMemoryAllocateInfo memory_info = { 0 };
+    memory_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    memory_info.allocationSize = buffer_memory_requirements.size;
+    memory_info.memoryTypeIndex = mem_type_bits;
+    memory_info.pNext = (mem_alloc_flags == 0 ? 0 : &mem_alloc_flags_info);
+    device_memory.vk_device_memory = allocate_tracked_memory(&memory_info, memory_category_from_usage(buffer_usage_flags));
     return device_memory;
 }
 
+/* All buffers created from this memory must be destroyed (or at least not be used anymore). */
+void vkal_free_devicememory(DeviceMemory * device_memory)
+{
+    if (device_memory->memory_id != VKAL_INVALID_HANDLE) {
+        vkal_destroy_device_memory(device_memory->memory_id);
+        device_memory->memory_id = VKAL_INVALID_HANDLE;
+    }
+    else {
+        free_memory(device_memory->vk_device_memory);
+    }
+    if (device_memory->free_list) {
+        free_list_destroy(device_memory->free_list);
+        VKAL_FREE(device_memory->free_list);
+    }
+    device_memory->vk_device_memory = VK_NULL_HANDLE;
+    device_memory->free_list = NULL;
+}
+
 VkalBuffer vkal_create_buffer(VkDeviceSize size, DeviceMemory * device_memory, VkBufferUsageFlags buffer_usage_flags)
 {
-    VkalBuffer buffer0 = create_buffer(size, buffer_usage_flags);
+    VkalBuffer created = create_buffer(size, buffer_usage_flags);
+    VkBuffer vk_buffer = created.buffer;
     VkMemoryRequirements buffer_memory_requirements = { 0 };
-    vkGetBufferMemoryRequirements(vkal_info.device, buffer0.buffer, &buffer_memory_requirements);
-
-    uint64_t alignment = buffer_memory_requirements.alignment;
-    uint64_t aligned_size = (size + alignment - 1) & ~(alignment - 1);
+    vkGetBufferMemoryRequirements(vkal_info.device, vk_buffer, &buffer_memory_requirements);
 
-    assert(size <= device_memory->size && "vkal_create_buffer: Requested Buffer size exceeds Device Memory size!");
+    /* NOTE: the offset in vkBindBufferMemory must be a multiple of alignment returend by vkGetBufferMemoryRequirements and denotes the
+       offset into VkDeviceMemory. The alignment the DeviceMemory was created with is honored as well.
+    */
+    uint64_t alignment = VKAL_MAX(buffer_memory_requirements.alignment, device_memory->alignment);
+    uint64_t aligned_size = ((buffer_memory_requirements.size + alignment - 1) / alignment) * alignment;
+
+    VkDeviceSize offset = 0;
+    if (!free_list_alloc(device_memory->free_list, aligned_size, alignment, &offset)) {
+        printf("[VKAL] vkal_create_buffer: no free range of %llu bytes left in device memory of %llu bytes!\n",
+               (unsigned long long)aligned_size, (unsigned long long)device_memory->size);
+        assert(0 && "vkal_create_buffer: Requested Buffer size exceeds free Device Memory!");
+    }
 
-    VkBuffer vk_buffer = VK_NULL_HANDLE;
-    VkBufferCreateInfo buffer_info = { 0 };
-    buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    buffer_info.size = size;
-    QueueFamilyIndicies indicies = find_queue_families(vkal_info.physical_device, vkal_info.surface);
-    buffer_info.pQueueFamilyIndices = &indicies.graphics_family;
-    buffer_info.queueFamilyIndexCount = 1;
-    buffer_info.usage = buffer_usage_flags;
-    buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-    VkResult result = vkCreateBuffer(vkal_info.device, &buffer_info, 0, &vk_buffer);
-    VKAL_ASSERT( result && "Failed to create VkBuffer" );
-    result = vkBindBufferMemory(vkal_info.device, vk_buffer, device_memory->vk_device_memory, device_memory->free);
+    VkResult result = vkBindBufferMemory(vkal_info.device, vk_buffer, device_memory->vk_device_memory, offset);
     VKAL_ASSERT( result && "Failed to bind VkBuffer to VkDeviceMemory" );
-    /* NOTE: the offset in vkBindBufferMemory must be a multiple of alignment returend by vkGetBufferMemoryRequirements and denotes the
-       offset into VkDeviceMemory.
-    */	
+
     VkalBuffer buffer = { 0 };
     buffer.size = size;
-    buffer.offset = device_memory->free;
+    buffer.offset = offset;
     buffer.device_memory = device_memory->vk_device_memory;
     buffer.vkal_device_memory = device_memory;
+    buffer.free_list = device_memory->free_list;
+    buffer.allocated_size = aligned_size;
     buffer.usage = buffer_usage_flags;
+    buffer.concurrent = created.concurrent;
     buffer.buffer = vk_buffer;
     buffer.mapped = NULL;
 
-    VkDeviceSize device_memory_alignment = device_memory->alignment;
-    VkDeviceSize next_offset = device_memory->free + (aligned_size / device_memory_alignment) * device_memory_alignment;
-    next_offset += aligned_size % device_memory_alignment ? device_memory_alignment : 0;
-    device_memory->free = next_offset;
+    device_memory->free = VKAL_MAX(device_memory->free, offset + aligned_size - device_memory->offset);
 
     return buffer;
 }
 
+/* Destroys a buffer created with vkal_create_buffer and gives its range back to the DeviceMemory
+   so it can be reused by the next vkal_create_buffer. */
+void vkal_destroy_buffer(VkalBuffer * buffer)
+{
+    if (buffer->mapped) {
+        vkal_unmap_buffer(buffer);
+    }
+    vkDestroyBuffer(vkal_info.device, buffer->buffer, 0);
+    if (buffer->free_list) {
+        free_list_free(buffer->free_list, buffer->offset, buffer->allocated_size);
+    }
+    buffer->buffer = VK_NULL_HANDLE;
+    buffer->free_list = NULL;
+}
+
 void vkal_map_buffer(VkalBuffer* buffer) 
 {
     uint64_t alignment = vkal_info.physical_device_properties.limits.minMemoryMapAlignment;
@@ -1427,88 +2583,80 @@ void vkal_update_buffer(VkalBuffer* buffer, uint8_t* data, uint32_t byte_count)
     vkal_update_buffer_offset(buffer, data, byte_count, 0);
 }
 
-void upload_texture(VkImage const image,
+uint64_t upload_texture(VkImage const image,
 		    uint32_t w, uint32_t h, uint32_t n,
 		    uint32_t array_layer_count,
 		    unsigned char * texture_data)
 {
-    uint64_t alignment = vkal_info.physical_device_properties.limits.nonCoherentAtomSize;
     uint64_t size = array_layer_count * w * h * n;
-    uint64_t aligned_size = (size + alignment - 1) & ~(alignment - 1);
 
     // Copy image data to staging buffer
-    void * staging_buffer;
-    vkMapMemory(vkal_info.device, vkal_info.device_memory_staging, 0, aligned_size, 0, &staging_buffer);
-    memcpy(staging_buffer, texture_data, size);
-    VkMappedMemoryRange flush_range = { 0 };
-    flush_range.memory = vkal_info.device_memory_staging;
-    flush_range.offset = 0;
-    flush_range.size = aligned_size;
-    flush_range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
-    vkFlushMappedMemoryRanges(vkal_info.device, 1, &flush_range);
-    vkUnmapMemory(vkal_info.device, vkal_info.device_memory_staging);
+    VkDeviceSize staging_offset = 0;
+    void * staging_memory = staging_alloc(size, &staging_offset);
+    memcpy(staging_memory, texture_data, size);
+    staging_flush(staging_offset, size);
     
     //////////////////////////////////
     //////////////////////////////////
     
-    // Actual upload to GPU
-    VkCommandBufferBeginInfo begin_info = { 0 };
-    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    for (uint32_t i = 0; i < vkal_info.default_command_buffer_count; ++i) {
-	    vkBeginCommandBuffer(vkal_info.default_command_buffers[i], &begin_info);
-        
-	    VkImageSubresourceRange image_subresource_range = { 0 };
-	    image_subresource_range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	    image_subresource_range.layerCount = array_layer_count;
-	    image_subresource_range.baseArrayLayer = 0;
-	    image_subresource_range.levelCount = 1;
-	    image_subresource_range.baseMipLevel = 0;
+    // Actual upload to GPU. Recorded into the current upload batch.
+    VkCommandBuffer cmd_buffer = upload_command_buffer();
         
-	    VkImageMemoryBarrier image_memory_barrier_undef_to_transfer = { 0 };
-	    image_memory_barrier_undef_to_transfer.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-	    image_memory_barrier_undef_to_transfer.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-	    image_memory_barrier_undef_to_transfer.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	    image_memory_barrier_undef_to_transfer.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-	    image_memory_barrier_undef_to_transfer.image = image;
-	    image_memory_barrier_undef_to_transfer.subresourceRange = image_subresource_range;
-	    vkCmdPipelineBarrier(vkal_info.default_command_buffers[i], VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-                                 VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, 0, 0, 0, 1, &image_memory_barrier_undef_to_transfer);
+    VkImageSubresourceRange image_subresource_range = { 0 };
+    image_subresource_range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    image_subresource_range.layerCount = array_layer_count;
+    image_subresource_range.baseArrayLayer = 0;
+    image_subresource_range.levelCount = 1;
+    image_subresource_range.baseMipLevel = 0;
         
-	    VkBufferImageCopy copy_info = { 0 };
-	    copy_info.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	    copy_info.imageSubresource.baseArrayLayer = 0;
-	    copy_info.imageSubresource.layerCount = array_layer_count;
-	    copy_info.imageSubresource.mipLevel = 0;
-	    copy_info.bufferOffset = 0;
-	    copy_info.bufferImageHeight = 0;
-	    copy_info.bufferRowLength = 0;
-	    copy_info.imageOffset = (VkOffset3D){ 0, 0, 0 };
-	    copy_info.imageExtent.width  = w;
-	    copy_info.imageExtent.height = h;
-	    copy_info.imageExtent.depth  = 1;
-	    vkCmdCopyBufferToImage(vkal_info.default_command_buffers[i], vkal_info.staging_buffer.buffer, image,
-                                   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy_info);
+    VkImageMemoryBarrier image_memory_barrier_undef_to_transfer = { 0 };
+    image_memory_barrier_undef_to_transfer.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    image_memory_barrier_undef_to_transfer.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    image_memory_barrier_undef_to_transfer.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    image_memory_barrier_undef_to_transfer.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    image_memory_barrier_undef_to_transfer.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    image_memory_barrier_undef_to_transfer.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    image_memory_barrier_undef_to_transfer.image = image;
+    image_memory_barrier_undef_to_transfer.subresourceRange = image_subresource_range;
+    vkCmdPipelineBarrier(cmd_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, 0, 0, 0, 1, &image_memory_barrier_undef_to_transfer);
         
-	    VkImageMemoryBarrier image_memory_barrier_transfer_to_shader_read = { 0 };
-	    image_memory_barrier_transfer_to_shader_read.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-	    image_memory_barrier_transfer_to_shader_read.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-	    image_memory_barrier_transfer_to_shader_read.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-	    image_memory_barrier_transfer_to_shader_read.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-	    image_memory_barrier_transfer_to_shader_read.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-	    image_memory_barrier_transfer_to_shader_read.image = image;
-	    image_memory_barrier_transfer_to_shader_read.subresourceRange = image_subresource_range;
-	    vkCmdPipelineBarrier(vkal_info.default_command_buffers[i], VK_PIPELINE_STAGE_TRANSFER_BIT,
-                                 VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, 0, 0, 0, 1, &image_memory_barrier_transfer_to_shader_read);
-        
-	    vkEndCommandBuffer(vkal_info.default_command_buffers[i]);        
+    VkBufferImageCopy copy_info = { 0 };
+    copy_info.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    copy_info.imageSubresource.baseArrayLayer = 0;
+    copy_info.imageSubresource.layerCount = array_layer_count;
+    copy_info.imageSubresource.mipLevel = 0;
+    copy_info.bufferOffset = staging_offset;
+    copy_info.bufferImageHeight = 0;
+    copy_info.bufferRowLength = 0;
+    copy_info.imageOffset = (VkOffset3D){ 0, 0, 0 };
+    copy_info.imageExtent.width  = w;
+    copy_info.imageExtent.height = h;
+    copy_info.imageExtent.depth  = 1;
+    vkCmdCopyBufferToImage(cmd_buffer, vkal_info.staging_buffer.buffer, image,
+                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy_info);
+
+    if (vkal_info.dedicated_transfer) {
+        // The layout transition happens as part of the ownership transfer to the graphics queue.
+        upload_add_image_ownership(image, image_subresource_range,
+                                   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+        return vkal_upload_ticket();
     }
-
-    VkSubmitInfo submit_info = { 0 };
-    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submit_info.commandBufferCount = vkal_info.default_command_buffer_count;
-    submit_info.pCommandBuffers = vkal_info.default_command_buffers;
-    vkQueueSubmit(vkal_info.graphics_queue, 1, &submit_info, VK_NULL_HANDLE);
-    vkDeviceWaitIdle(vkal_info.device);	
+        
+    VkImageMemoryBarrier image_memory_barrier_transfer_to_shader_read = { 0 };
+    image_memory_barrier_transfer_to_shader_read.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    image_memory_barrier_transfer_to_shader_read.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    image_memory_barrier_transfer_to_shader_read.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    image_memory_barrier_transfer_to_shader_read.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    image_memory_barrier_transfer_to_shader_read.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    image_memory_barrier_transfer_to_shader_read.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    image_memory_barrier_transfer_to_shader_read.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    image_memory_barrier_transfer_to_shader_read.image = image;
+    image_memory_barrier_transfer_to_shader_read.subresourceRange = image_subresource_range;
+    vkCmdPipelineBarrier(cmd_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, 0, 0, 0, 1, &image_memory_barrier_transfer_to_shader_read);
+
+    return vkal_upload_ticket();
 }
 
 void create_default_depth_buffer(void)
@@ -1522,16 +2670,9 @@ void create_default_depth_buffer(void)
     }
     
     {
-		// Check how much size is required for this image. Calculating by hand _might_ work, but who knows what
-		// the GPU is doing behind the scenes with an OPTIMAL TILING set! Alignment stuff might blow up the whole thing when done manually!
-		VkMemoryRequirements image_memory_requirements;
-		vkGetImageMemoryRequirements(vkal_info.device, get_image(vkal_info.depth_stencil_image), &image_memory_requirements);
-        
-		// TODO: check if I am doing this property query correctly!!!!!!!
-		// Check what LunarG is doing in their samples!
-		uint32_t mem_type_index = check_memory_type_index(image_memory_requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-		create_device_memory(image_memory_requirements.size, mem_type_index, &vkal_info.device_memory_depth_stencil);
-		vkBindImageMemory(vkal_info.device, get_image(vkal_info.depth_stencil_image), get_device_memory(vkal_info.device_memory_depth_stencil), 0);
+		// The size and alignment come from vkGetImageMemoryRequirements. Calculating by hand _might_ work, but who knows what
+		// the GPU is doing behind the scenes with an OPTIMAL TILING set!
+		vkal_allocate_image_memory(vkal_info.depth_stencil_image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &vkal_info.device_memory_depth_stencil);
     }
     
     {
@@ -1547,15 +2688,14 @@ void create_default_depth_buffer(void)
 
 uint32_t check_memory_type_index(uint32_t const memory_requirement_bits, VkMemoryPropertyFlags const wanted_property)
 {
-    VkPhysicalDeviceMemoryProperties memory_properties;
-    vkGetPhysicalDeviceMemoryProperties(vkal_info.physical_device, &memory_properties);
+    VkPhysicalDeviceMemoryProperties * memory_properties = &vkal_info.memory_properties;
     uint32_t mem_type_index      = 0;
     uint32_t best_mem_type_index = 0;
     uint32_t found               = 0;
     uint32_t type_bits           = memory_requirement_bits;
-    for (; mem_type_index < memory_properties.memoryTypeCount; ++mem_type_index) {
+    for (; mem_type_index < memory_properties->memoryTypeCount; ++mem_type_index) {
 	    if (type_bits & 1) {
-	        if ((memory_properties.memoryTypes[mem_type_index].propertyFlags & wanted_property) == wanted_property) {
+	        if ((memory_properties->memoryTypes[mem_type_index].propertyFlags & wanted_property) == wanted_property) {
 		        found = 1;
 		        best_mem_type_index = mem_type_index;
 		        break;		
@@ -1633,11 +2773,12 @@ int is_device_suitable(VkPhysicalDevice device, char ** extensions, uint32_t ext
     vkGetPhysicalDeviceProperties(device, &device_properties);
     VkPhysicalDeviceFeatures device_features;
     vkGetPhysicalDeviceFeatures(device, &device_features);
-    SwapChainSupportDetails swapchain_support = query_swapchain_support(device);
     int swapchain_adequate = 1;
-	
-    if (!swapchain_support.formats || !swapchain_support.present_modes) {
-	    swapchain_adequate = 0;
+    if (!vkal_info.headless) {
+        SwapChainSupportDetails swapchain_support = query_swapchain_support(device);
+        if (!swapchain_support.formats || !swapchain_support.present_modes) {
+            swapchain_adequate = 0;
+        }
     }
     // NOTE: only test for swapchain support after the extension support has been checked!
     return check_device_extension_support(device, extensions, extension_count) && swapchain_adequate;
@@ -1654,6 +2795,8 @@ QueueFamilyIndicies find_queue_families(VkPhysicalDevice device, VkSurfaceKHR su
     VKAL_MALLOC(queue_families, queue_family_count);
     vkGetPhysicalDeviceQueueFamilyProperties(device, &queue_family_count, queue_families);
     indicies.has_graphics_family = 0;
+    indicies.has_present_family = 0;
+    indicies.has_transfer_family = 0;
     for (uint32_t i = 0; i < queue_family_count; ++i) {
 	    if (queue_families[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) {
 	        indicies.graphics_family = i;
@@ -1662,14 +2805,39 @@ QueueFamilyIndicies find_queue_families(VkPhysicalDevice device, VkSurfaceKHR su
 	    }
     }
     for (uint32_t i = 0; i < queue_family_count; ++i) {
-	    VkBool32 present_support = VK_FALSE;
-	    vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &present_support);
-	    if (present_support) {
-	        indicies.has_present_family = 1;
-	        indicies.present_family = i;
-	        break;
-	    }
+        VkQueueFlags flags = queue_families[i].queueFlags;
+        if ((flags & VK_QUEUE_TRANSFER_BIT) && !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))) {
+            indicies.transfer_family = i;
+            indicies.has_transfer_family = 1;
+            break;
+        }
+    }
+    indicies.has_compute_family = 0;
+    for (uint32_t i = 0; i < queue_family_count; ++i) {
+        VkQueueFlags flags = queue_families[i].queueFlags;
+        if ((flags & VK_QUEUE_COMPUTE_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT)) {
+            indicies.compute_family = i;
+            indicies.has_compute_family = 1;
+            break;
+        }
+    }
+    if (surface == VK_NULL_HANDLE) {
+        // Headless: nothing gets presented, so the graphics queue also acts as the 'present' queue.
+        indicies.has_present_family = indicies.has_graphics_family;
+        indicies.present_family = indicies.graphics_family;
+    }
+    else {
+        for (uint32_t i = 0; i < queue_family_count; ++i) {
+            VkBool32 present_support = VK_FALSE;
+            vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &present_support);
+            if (present_support) {
+                indicies.has_present_family = 1;
+                indicies.present_family = i;
+                break;
+            }
+        }
     }
+    VKAL_FREE(queue_families);
     return indicies;
 }
 
@@ -1721,18 +2889,25 @@ void vkal_select_physical_device(VkalPhysicalDevice * physical_device)
 
 void create_logical_device(char** extensions, uint32_t extension_count, VkalWantedFeatures vulkan_features)
 {
-    QueueFamilyIndicies indicies = find_queue_families(vkal_info.physical_device, vkal_info.surface);
-    uint32_t unique_queue_families[2];
-    unique_queue_families[0] = indicies.graphics_family;
-    unique_queue_families[1] = indicies.present_family;
-    VkDeviceQueueCreateInfo queue_create_infos[2] = { 0 };
+    // Neither the queue families nor the memory types change for the lifetime of the device.
+    vkal_info.queue_families = find_queue_families(vkal_info.physical_device, vkal_info.surface);
+    vkGetPhysicalDeviceMemoryProperties(vkal_info.physical_device, &vkal_info.memory_properties);
+    QueueFamilyIndicies indicies = vkal_info.queue_families;
+    vkal_info.dedicated_transfer = VKAL_USE_TRANSFER_QUEUE && indicies.has_transfer_family;
+    vkal_info.dedicated_compute = VKAL_USE_COMPUTE_QUEUE && indicies.has_compute_family;
+    uint32_t unique_queue_families[4];
     uint32_t info_count = 0;
+    unique_queue_families[info_count++] = indicies.graphics_family;
     if (indicies.graphics_family != indicies.present_family) {
-        info_count = 2;
+        unique_queue_families[info_count++] = indicies.present_family;
     }
-    else {
-        info_count = 1;
+    if (vkal_info.dedicated_transfer) {
+        unique_queue_families[info_count++] = indicies.transfer_family;
     }
+    if (vkal_info.dedicated_compute) {
+        unique_queue_families[info_count++] = indicies.compute_family;
+    }
+    VkDeviceQueueCreateInfo queue_create_infos[4] = { 0 };
     float queue_prio = 1.f;
     for (uint32_t i = 0; i < info_count; ++i) {
         queue_create_infos[i] = (VkDeviceQueueCreateInfo){ 0 };
@@ -1782,6 +2957,7 @@ void create_logical_device(char** extensions, uint32_t extension_count, VkalWant
 
     /* Check Features2 (which now contains VkalPhysicalDeviceFeatures). For now, just check, what we need */
     VKAL_CHECK_FEATURE(vulkan_features.features2.features.fillModeNonSolid, available_features2.features.fillModeNonSolid);
+    VKAL_CHECK_FEATURE(vulkan_features.features2.features.multiDrawIndirect, available_features2.features.multiDrawIndirect);
 
     /* Check Features 1_1 */
     VKAL_CHECK_FEATURE(vulkan_features.features11.multiview, device_features11.multiview);
@@ -1804,6 +2980,32 @@ void create_logical_device(char** extensions, uint32_t extension_count, VkalWant
     VKAL_CHECK_FEATURE(vulkan_features.features12.shaderStorageImageArrayNonUniformIndexing, device_features12.shaderStorageImageArrayNonUniformIndexing);
     VKAL_CHECK_FEATURE(vulkan_features.features12.shaderSampledImageArrayNonUniformIndexing, device_features12.shaderSampledImageArrayNonUniformIndexing);
     VKAL_CHECK_FEATURE(vulkan_features.features12.descriptorIndexing, device_features12.descriptorIndexing);
+    VKAL_CHECK_FEATURE(vulkan_features.features12.drawIndirectCount, device_features12.drawIndirectCount);
+    VKAL_CHECK_FEATURE(vulkan_features.features12.timelineSemaphore, device_features12.timelineSemaphore);
+    vkal_info.multi_draw_indirect = vulkan_features.features2.features.multiDrawIndirect;
+    vkal_info.draw_indirect_count = vulkan_features.features12.drawIndirectCount;
+    vkal_info.timeline_enabled = 0;
+#if VKAL_USE_TIMELINE_SEMAPHORE
+    if (device_features12.timelineSemaphore &&
+        vkal_info.instance_api_version >= VK_API_VERSION_1_2 &&
+        vkal_info.physical_device_properties.apiVersion >= VK_API_VERSION_1_2) {
+        vulkan_features.features12.timelineSemaphore = VK_TRUE;
+        vkal_info.timeline_enabled = 1;
+    }
+#endif
+    vkal_info.pipeline_statistics_supported = available_features2.features.pipelineStatisticsQuery;
+    vkal_info.occlusion_query_precise = available_features2.features.occlusionQueryPrecise;
+    vulkan_features.features2.features.pipelineStatisticsQuery |= available_features2.features.pipelineStatisticsQuery;
+    vulkan_features.features2.features.occlusionQueryPrecise |= available_features2.features.occlusionQueryPrecise;
+    vkal_info.inherited_queries = available_features2.features.inheritedQueries;
+    vulkan_features.features2.features.inheritedQueries |= available_features2.features.inheritedQueries;
+    vkal_info.host_query_reset = 0;
+    if (device_features12.hostQueryReset &&
+        vkal_info.instance_api_version >= VK_API_VERSION_1_2 &&
+        vkal_info.physical_device_properties.apiVersion >= VK_API_VERSION_1_2) {
+        vulkan_features.features12.hostQueryReset = VK_TRUE;
+        vkal_info.host_query_reset = 1;
+    }
 
     /* Check Raytracing features */
     VKAL_CHECK_FEATURE(vulkan_features.rayTracingPipelineFeatures.rayTracingPipeline, ray_tracing_features.rayTracingPipeline);
@@ -1831,10 +3033,62 @@ void create_logical_device(char** extensions, uint32_t extension_count, VkalWant
     create_info.enabledExtensionCount = extension_count;
     create_info.ppEnabledExtensionNames = (const char* const*)extensions;
 
+    // Memory accounting uses VK_EXT_memory_budget if it is there, whether or not it was requested.
+    char ** device_extensions = NULL;
+    vkal_info.memory_budget_enabled = 0;
+    if (vkal_info.instance_api_version >= VK_API_VERSION_1_1 &&
+        vkal_info.physical_device_properties.apiVersion >= VK_API_VERSION_1_1) {
+        uint32_t requested = 0;
+        for (uint32_t i = 0; i < extension_count; ++i) {
+            requested |= !strcmp(extensions[i], VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+        }
+        uint32_t available_count = 0;
+        vkEnumerateDeviceExtensionProperties(vkal_info.physical_device, 0, &available_count, 0);
+        VkExtensionProperties * available_extensions;
+        VKAL_MALLOC(available_extensions, available_count);
+        vkEnumerateDeviceExtensionProperties(vkal_info.physical_device, 0, &available_count, available_extensions);
+        for (uint32_t i = 0; i < available_count; ++i) {
+            if (!strcmp(available_extensions[i].extensionName, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME)) {
+                vkal_info.memory_budget_enabled = 1;
+                break;
+            }
+        }
+        VKAL_FREE(available_extensions);
+        if (vkal_info.memory_budget_enabled && !requested) {
+            VKAL_MALLOC(device_extensions, extension_count + 1);
+            memcpy(device_extensions, extensions, extension_count * sizeof(char*));
+            device_extensions[extension_count] = (char*)VK_EXT_MEMORY_BUDGET_EXTENSION_NAME;
+            create_info.enabledExtensionCount = extension_count + 1;
+            create_info.ppEnabledExtensionNames = (const char* const*)device_extensions;
+        }
+    }
+
     VKAL_ASSERT(vkCreateDevice(vkal_info.physical_device, &create_info, 0, &vkal_info.device));
+    if (device_extensions) {
+        VKAL_FREE(device_extensions);
+    }
 
     vkGetDeviceQueue(vkal_info.device, indicies.graphics_family, 0, &vkal_info.graphics_queue);
     vkGetDeviceQueue(vkal_info.device, indicies.present_family, 0, &vkal_info.present_queue);
+    vkal_info.graphics_family = indicies.graphics_family;
+    if (vkal_info.dedicated_transfer) {
+        vkal_info.transfer_family = indicies.transfer_family;
+        vkGetDeviceQueue(vkal_info.device, indicies.transfer_family, 0, &vkal_info.transfer_queue);
+        printf("[VKAL] using dedicated transfer queue family: %d\n", indicies.transfer_family);
+    }
+    else {
+        vkal_info.transfer_family = indicies.graphics_family;
+        vkal_info.transfer_queue = vkal_info.graphics_queue;
+    }
+    if (vkal_info.dedicated_compute) {
+        vkal_info.compute_family = indicies.compute_family;
+        vkGetDeviceQueue(vkal_info.device, indicies.compute_family, 0, &vkal_info.compute_queue);
+        printf("[VKAL] using dedicated compute queue family: %d\n", indicies.compute_family);
+    }
+    else {
+        vkal_info.compute_family = indicies.graphics_family;
+        vkal_info.compute_queue = vkal_info.graphics_queue;
+    }
 }
 
 void create_shader_module(uint8_t const * shader_byte_code, int size, uint32_t * out_shader_module)
@@ -1843,30 +3097,23 @@ void create_shader_module(uint8_t const * shader_byte_code, int size, uint32_t *
     create_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
     create_info.codeSize = size;
     create_info.pCode = (uint32_t*)shader_byte_code;
-    uint32_t free_index;
-    for (free_index = 0; free_index < VKAL_MAX_VKSHADERMODULE; ++free_index) {
-		if (vkal_info.user_shader_modules[free_index].used) {
-		} 
-		else break;
-	}
-    VkResult result = vkCreateShaderModule(vkal_info.device, &create_info, 0, &vkal_info.user_shader_modules[free_index].shader_module);
+    VkalShaderModuleHandle * shader_module_handle;
+    uint32_t shader_module_id = handle_pool_alloc(&vkal_info.user_shader_modules, (void**)&shader_module_handle);
+    VkResult result = vkCreateShaderModule(vkal_info.device, &create_info, 0, &shader_module_handle->shader_module);
     VKAL_ASSERT(result && "failed to create shader module!");
-    vkal_info.user_shader_modules[free_index].used = 1;
-    *out_shader_module = free_index;
+    *out_shader_module = shader_module_id;
 }
 
 VkShaderModule get_shader_module(uint32_t id)
 {
-    assert(id < VKAL_MAX_VKSHADERMODULE);
-    assert(vkal_info.user_shader_modules[id].used);
-    return vkal_info.user_shader_modules[id].shader_module;
+    return ((VkalShaderModuleHandle*)handle_pool_get(&vkal_info.user_shader_modules, id))->shader_module;
 }
 
 void destroy_shader_module(uint32_t id)
 {
-    if (vkal_info.user_shader_modules[id].used) {
+    if (handle_pool_valid(&vkal_info.user_shader_modules, id)) {
 	vkDestroyShaderModule(vkal_info.device, get_shader_module(id), 0);
-	vkal_info.user_shader_modules[id].used = 0;
+	handle_pool_free(&vkal_info.user_shader_modules, id);
     }
 }
 
@@ -1889,6 +3136,14 @@ void create_default_descriptor_pool(void)
 	    { // for sampling the shadow map
 		VK_DESCRIPTOR_TYPE_SAMPLER,
 		1024
+	    },
+	    {
+		VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+		1024
+	    },
+	    {
+		VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+		1024
 	    }
 	};
     
@@ -1987,7 +3242,7 @@ void create_default_render_pass(void)
     attachments[0].stencilLoadOp  = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     attachments[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
     attachments[0].initialLayout  = VK_IMAGE_LAYOUT_UNDEFINED;
-    attachments[0].finalLayout    = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    attachments[0].finalLayout    = vkal_info.headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
     // Depth Stencil Attachment
     attachments[1].flags          = 0;
     attachments[1].format         = VK_FORMAT_D32_SFLOAT;
@@ -2028,10 +3283,14 @@ void create_default_render_pass(void)
     VkSubpassDependency dependency = { 0 };
     dependency.srcSubpass = VK_SUBPASS_EXTERNAL; // refers to implicit subpass before/after renderpass
     dependency.dstSubpass = 0; // index into the (only) subpass created above
-    dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    dependency.srcAccessMask = 0;
-    dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    // The depth buffer is shared by all frames in flight, and after a resize its memory is aliased by the
+    // new depth image while older frames may still write through the old one. Their depth writes have to
+    // finish before this frame's depth tests and clear.
+    dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    dependency.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+                               VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
 	
     VkRenderPassCreateInfo render_pass_info = { 0 };
     render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
@@ -2094,37 +3353,35 @@ uint32_t create_render_image_framebuffer(RenderImage render_image, uint32_t widt
 
 void internal_create_framebuffer(VkFramebufferCreateInfo create_info, uint32_t * out_framebuffer)
 {
-    uint32_t free_index;
-    for (free_index = 0; free_index < VKAL_MAX_VKFRAMEBUFFER; ++free_index) {
-	if (vkal_info.user_framebuffers[free_index].used) {
-	    continue;
-	}
-	break;
-    }
-    VkResult result = vkCreateFramebuffer(vkal_info.device, &create_info, 0, &vkal_info.user_framebuffers[free_index].framebuffer);
+    VkalFramebufferHandle * framebuffer_handle;
+    uint32_t framebuffer_id = handle_pool_alloc(&vkal_info.user_framebuffers, (void**)&framebuffer_handle);
+    VkResult result = vkCreateFramebuffer(vkal_info.device, &create_info, 0, &framebuffer_handle->framebuffer);
     VKAL_ASSERT(result && "failed to create VkFramebuffer!");
-    vkal_info.user_framebuffers[free_index].used = 1;
-    *out_framebuffer = free_index;
+    *out_framebuffer = framebuffer_id;
 }
 
 VkFramebuffer get_framebuffer(uint32_t id)
 {
-    assert(id < VKAL_MAX_VKFRAMEBUFFER);
-    assert(vkal_info.user_framebuffers[id].used);
-    return vkal_info.user_framebuffers[id].framebuffer;
+    return ((VkalFramebufferHandle*)handle_pool_get(&vkal_info.user_framebuffers, id))->framebuffer;
 }
 
 void destroy_framebuffer(uint32_t id)
 {
-    if (vkal_info.user_framebuffers[id].used) {
+    if (handle_pool_valid(&vkal_info.user_framebuffers, id)) {
 	vkDestroyFramebuffer(vkal_info.device, get_framebuffer(id), 0);
-	vkal_info.user_framebuffers[id].used = 0;
+	handle_pool_free(&vkal_info.user_framebuffers, id);
     }
 }
 
 RenderImage recreate_render_image(RenderImage render_image, uint32_t width, uint32_t height)
 {
-    vkDeviceWaitIdle(vkal_info.device);
+    // Async compute does not signal the timeline, so it would not be covered.
+    if (vkal_info.timeline_enabled && !vkal_info.dedicated_compute) {
+        vkal_wait_value(vkal_info.timeline_value);
+    }
+    else {
+        vkDeviceWaitIdle(vkal_info.device);
+    }
 
     for (uint32_t i = 0; i < vkal_info.swapchain_image_count; ++i) {
 		destroy_framebuffer(render_image.framebuffers[i]);
@@ -2161,33 +3418,24 @@ void create_pipeline_layout(
     layout_info.setLayoutCount = descriptor_set_layout_count;
     layout_info.pushConstantRangeCount = push_constant_range_count;
     layout_info.pPushConstantRanges = push_constant_ranges;
-    uint32_t free_index = 0;
-    for (free_index = 0; free_index < VKAL_MAX_VKPIPELINELAYOUT; ++free_index) {
-		if (vkal_info.user_pipeline_layouts[free_index].used) {
-
-		}
-		else 
-			break;
-    }
-    VkResult result = vkCreatePipelineLayout(vkal_info.device, &layout_info, 0, &vkal_info.user_pipeline_layouts[free_index].pipeline_layout);
+    VkalPipelineLayoutHandle * pipeline_layout_handle;
+    uint32_t pipeline_layout_id = handle_pool_alloc(&vkal_info.user_pipeline_layouts, (void**)&pipeline_layout_handle);
+    VkResult result = vkCreatePipelineLayout(vkal_info.device, &layout_info, 0, &pipeline_layout_handle->pipeline_layout);
     VKAL_ASSERT(result && "failed to create pipeline layout!");
-    vkal_info.user_pipeline_layouts[free_index].used = 1;
-    *out_pipeline_layout = free_index;
+    *out_pipeline_layout = pipeline_layout_id;
 }
 
 void destroy_pipeline_layout(uint32_t id)
 {
-    if (vkal_info.user_pipeline_layouts[id].used) {
+    if (handle_pool_valid(&vkal_info.user_pipeline_layouts, id)) {
 		vkDestroyPipelineLayout(vkal_info.device, get_pipeline_layout(id), 0);
-		vkal_info.user_pipeline_layouts[id].used = 0;
+		handle_pool_free(&vkal_info.user_pipeline_layouts, id);
     }
 }
 
 VkPipelineLayout get_pipeline_layout(uint32_t id)
 {
-    assert(id < VKAL_MAX_VKPIPELINELAYOUT);
-    assert(vkal_info.user_pipeline_layouts[id].used);
-    return vkal_info.user_pipeline_layouts[id].pipeline_layout;
+    return ((VkalPipelineLayoutHandle*)handle_pool_get(&vkal_info.user_pipeline_layouts, id))->pipeline_layout;
 }
 
 void vkal_allocate_descriptor_sets(VkDescriptorPool pool,
@@ -2278,36 +3526,42 @@ void create_descriptor_set_layout(VkDescriptorSetLayoutBinding * layout, uint32_
     info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
     info.bindingCount = binding_count;
     info.pBindings = layout;
-    uint32_t free_index;
-    for (free_index = 0; free_index < VKAL_MAX_VKDESCRIPTORSETLAYOUT; ++free_index) {
-        if (vkal_info.user_descriptor_set_layouts[free_index].used) {
-
-        }
-        else break;
-    }
-    VkResult result = vkCreateDescriptorSetLayout(vkal_info.device, &info, 0, &vkal_info.user_descriptor_set_layouts[free_index].descriptor_set_layout);
+    VkalDescriptorSetLayoutHande * layout_handle;
+    uint32_t layout_id = handle_pool_alloc(&vkal_info.user_descriptor_set_layouts, (void**)&layout_handle);
+    VkResult result = vkCreateDescriptorSetLayout(vkal_info.device, &info, 0, &layout_handle->descriptor_set_layout);
     VKAL_ASSERT(result && "failed to create descriptor set layout(s)!");
-    vkal_info.user_descriptor_set_layouts[free_index].used = 1;
-    *out_descriptor_set_layout = free_index;
+    *out_descriptor_set_layout = layout_id;
 }
 
 VkDescriptorSetLayout get_descriptor_set_layout(uint32_t id)
 {
-    assert(id < VKAL_MAX_VKDESCRIPTORSETLAYOUT);
-    assert(vkal_info.user_descriptor_set_layouts[id].used);
-    return vkal_info.user_descriptor_set_layouts[id].descriptor_set_layout;
+    return ((VkalDescriptorSetLayoutHande*)handle_pool_get(&vkal_info.user_descriptor_set_layouts, id))->descriptor_set_layout;
 }
 
 void destroy_descriptor_set_layout(uint32_t id)
 {
-    if (vkal_info.user_descriptor_set_layouts[id].used) {
+    if (handle_pool_valid(&vkal_info.user_descriptor_set_layouts, id)) {
 	vkDestroyDescriptorSetLayout(vkal_info.device, get_descriptor_set_layout(id), 0);
-	vkal_info.user_descriptor_set_layouts[id].used = 0;
+	handle_pool_free(&vkal_info.user_descriptor_set_layouts, id);
     }
 }
 
+/* Releases one reference of a pipeline from vkal_create_pipeline/vkal_create_graphics_pipeline and
+   destroys it with the last one. Destroying pipelines is rare, so a scan over the pool is fine. */
 void vkal_destroy_graphics_pipeline(VkPipeline pipeline)
 {
+    for (uint32_t i = 0; i < vkal_info.user_pipelines.slot_count; ++i) {
+        uint32_t id = handle_pool_handle_at(&vkal_info.user_pipelines, i);
+        if (id == VKAL_INVALID_HANDLE) continue;
+        VkalPipelineHandle * pipeline_handle = (VkalPipelineHandle*)handle_pool_get(&vkal_info.user_pipelines, id);
+        if (pipeline_handle->pipeline != pipeline) continue;
+        if (pipeline_handle->key && --pipeline_handle->ref_count > 0) {
+            return;
+        }
+        destroy_graphics_pipeline(id);
+        return;
+    }
+    // Not created by VKAL.
     vkDestroyPipeline(vkal_info.device, pipeline, 0);
 }
 
@@ -2316,6 +3570,53 @@ void vkal_set_clear_color(VkClearColorValue value)
     vkal_info.clear_color_value = value;
 }
 
+VkalPipelineDesc vkal_pipeline_desc_default(void)
+{
+    VkalPipelineDesc desc;
+    memset(&desc, 0, sizeof(VkalPipelineDesc));
+    desc.patch_control_points = 3;
+    desc.primitive_topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+    desc.polygon_mode = VK_POLYGON_MODE_FILL;
+    desc.cull_mode = VK_CULL_MODE_BACK_BIT;
+    desc.front_face = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+    desc.line_width = 1.0f;
+
+    desc.depth_test_enable = VK_TRUE;
+    desc.depth_write_enable = VK_TRUE;
+    desc.depth_compare_op = VK_COMPARE_OP_LESS_OR_EQUAL;
+    desc.stencil_front.failOp = VK_STENCIL_OP_KEEP;
+    desc.stencil_front.passOp = VK_STENCIL_OP_KEEP;
+    desc.stencil_front.depthFailOp = VK_STENCIL_OP_KEEP;
+    desc.stencil_front.compareOp = VK_COMPARE_OP_ALWAYS;
+    desc.stencil_back = desc.stencil_front;
+
+    desc.samples = VK_SAMPLE_COUNT_1_BIT;
+    desc.min_sample_shading = 1.0f;
+
+    // Straight alpha blending into a single color attachment.
+    desc.color_attachment_count = 1;
+    for (uint32_t i = 0; i < VKAL_MAX_COLOR_ATTACHMENTS; ++i) {
+        VkPipelineColorBlendAttachmentState * blend = &desc.blend_attachments[i];
+        blend->colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+        blend->blendEnable = VK_TRUE;
+        blend->colorBlendOp = VK_BLEND_OP_ADD;
+        blend->srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+        blend->dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+        blend->alphaBlendOp = VK_BLEND_OP_ADD;
+        blend->srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+        blend->dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+    }
+
+    // dynamic state will force us to provide viewport dimensions at drawing-time
+    desc.dynamic_state_count = 2;
+    desc.dynamic_states[0] = VK_DYNAMIC_STATE_VIEWPORT;
+    desc.dynamic_states[1] = VK_DYNAMIC_STATE_SCISSOR;
+
+    desc.render_pass = vkal_info.render_pass;
+    desc.subpass = 0;
+    return desc;
+}
+
 VkPipeline vkal_create_graphics_pipeline(
 	VkVertexInputBindingDescription * vertex_input_bindings, 
 	uint32_t vertex_input_binding_count,
@@ -2332,41 +3633,64 @@ VkPipeline vkal_create_graphics_pipeline(
 	VkRenderPass render_pass,
 	VkPipelineLayout pipeline_layout)
 {        
+    VkalPipelineDesc desc = vkal_pipeline_desc_default();
+    desc.vertex_input_bindings = vertex_input_bindings;
+    desc.vertex_input_binding_count = vertex_input_binding_count;
+    desc.vertex_attributes = vertex_attributes;
+    desc.vertex_attribute_count = vertex_attribute_count;
+    desc.shader_setup = shader_setup;
+    desc.patch_control_points = patch_control_points;
+    desc.depth_test_enable = depth_test_enable;
+    desc.depth_compare_op = depth_compare_op;
+    desc.cull_mode = cull_mode;
+    desc.polygon_mode = polygon_mode;
+    desc.primitive_topology = primitive_topology;
+    desc.front_face = face_winding;
+    desc.render_pass = render_pass;
+    desc.pipeline_layout = pipeline_layout;
+    return vkal_create_pipeline(&desc);
+}
+
+/* Only reads VKAL state, so it may run on any thread. The pipeline is not registered yet. */
+static VkResult compile_graphics_pipeline(VkalPipelineDesc const * desc, VkPipelineCreationFeedback * out_feedback, VkPipeline * out_pipeline)
+{
+    ShaderStageSetup const * shader_setup = &desc->shader_setup;
     VkPipelineShaderStageCreateInfo shader_stages_infos[5] = { 0 };
-    shader_stages_infos[0] = shader_setup.vertex_shader_create_info;
-    shader_stages_infos[1] = shader_setup.fragment_shader_create_info;
+    shader_stages_infos[0] = shader_setup->vertex_shader_create_info;
+    shader_stages_infos[1] = shader_setup->fragment_shader_create_info;
     uint32_t num_shader_stages = 2;
     uint32_t tessellationShaderActive = 0;
-    if (shader_setup.tctrl_shader_create_info.stage == VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT) {
-        shader_stages_infos[num_shader_stages] = shader_setup.tctrl_shader_create_info;
+    if (shader_setup->tctrl_shader_create_info.stage == VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT) {
+        shader_stages_infos[num_shader_stages] = shader_setup->tctrl_shader_create_info;
         num_shader_stages += 1;
     }
-    if (shader_setup.teval_shader_create_info.stage == VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT) {
-        shader_stages_infos[num_shader_stages] = shader_setup.teval_shader_create_info;
+    if (shader_setup->teval_shader_create_info.stage == VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT) {
+        shader_stages_infos[num_shader_stages] = shader_setup->teval_shader_create_info;
         num_shader_stages += 1;
         tessellationShaderActive = 1;
     }
-    if (shader_setup.geometry_shader_create_info.stage == VK_SHADER_STAGE_GEOMETRY_BIT) {
-        shader_stages_infos[num_shader_stages] = shader_setup.geometry_shader_create_info;
+    if (shader_setup->geometry_shader_create_info.stage == VK_SHADER_STAGE_GEOMETRY_BIT) {
+        shader_stages_infos[num_shader_stages] = shader_setup->geometry_shader_create_info;
         num_shader_stages += 1;
     }
 
     VkPipelineVertexInputStateCreateInfo vertex_input_info = {0};
     vertex_input_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-    vertex_input_info.vertexBindingDescriptionCount = vertex_input_binding_count;
-    vertex_input_info.pVertexBindingDescriptions = vertex_input_bindings;
-    vertex_input_info.vertexAttributeDescriptionCount = vertex_attribute_count;
-    vertex_input_info.pVertexAttributeDescriptions = vertex_attributes;
+    vertex_input_info.vertexBindingDescriptionCount = desc->vertex_input_binding_count;
+    vertex_input_info.pVertexBindingDescriptions = desc->vertex_input_bindings;
+    vertex_input_info.vertexAttributeDescriptionCount = desc->vertex_attribute_count;
+    vertex_input_info.pVertexAttributeDescriptions = desc->vertex_attributes;
     //
     VkPipelineInputAssemblyStateCreateInfo input_assembly_info = {0};
     input_assembly_info.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-    input_assembly_info.topology = primitive_topology;
-    input_assembly_info.primitiveRestartEnable = VK_FALSE;
+    input_assembly_info.topology = desc->primitive_topology;
+    input_assembly_info.primitiveRestartEnable = desc->primitive_restart_enable;
     
     VkPipelineTessellationStateCreateInfo tessellation_state_info = { 0 };
     tessellation_state_info.sType = VK_STRUCTURE_TYPE_PIPELINE_TESSELLATION_STATE_CREATE_INFO;
-    tessellation_state_info.patchControlPoints = patch_control_points;
+    tessellation_state_info.patchControlPoints = desc->patch_control_points;
 
+    // Ignored for whatever is listed in desc->dynamic_states.
     VkViewport viewport = {0};
     viewport.x        = 0.f;
     viewport.y        = 0.f;
@@ -2386,66 +3710,46 @@ VkPipeline vkal_create_graphics_pipeline(
     
     VkPipelineRasterizationStateCreateInfo rasterizer_info = {0};
     rasterizer_info.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-    rasterizer_info.frontFace = face_winding;
-    rasterizer_info.cullMode = cull_mode;
-    rasterizer_info.polygonMode = polygon_mode;
+    rasterizer_info.frontFace = desc->front_face;
+    rasterizer_info.cullMode = desc->cull_mode;
+    rasterizer_info.polygonMode = desc->polygon_mode;
     rasterizer_info.rasterizerDiscardEnable = VK_FALSE;
-    rasterizer_info.depthClampEnable = VK_FALSE;
-    rasterizer_info.depthBiasEnable = VK_FALSE;
-    rasterizer_info.lineWidth = 1.0f;
-    
-    // COME BACK LATER: Set up depth/stencil testing (we need to create a buffer for that as it is
-    // not created with the Swapchain
-    
-    VkPipelineColorBlendAttachmentState color_blend_attachment = {0};
-    color_blend_attachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-    color_blend_attachment.blendEnable = VK_TRUE;
-    
-    color_blend_attachment.colorBlendOp = VK_BLEND_OP_ADD;
-    color_blend_attachment.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
-    color_blend_attachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+    rasterizer_info.depthClampEnable = desc->depth_clamp_enable;
+    rasterizer_info.depthBiasEnable = desc->depth_bias_enable;
+    rasterizer_info.depthBiasConstantFactor = desc->depth_bias_constant_factor;
+    rasterizer_info.depthBiasSlopeFactor = desc->depth_bias_slope_factor;
+    rasterizer_info.lineWidth = desc->line_width;
     
-    color_blend_attachment.alphaBlendOp = VK_BLEND_OP_ADD;
-    color_blend_attachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
-    color_blend_attachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
-
+    assert(desc->color_attachment_count <= VKAL_MAX_COLOR_ATTACHMENTS && "build_graphics_pipeline: too many color attachments!");
     VkPipelineColorBlendStateCreateInfo color_blending_info = { 0 };
     color_blending_info.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
     color_blending_info.logicOpEnable = VK_FALSE; // enabling this will set color_blend_attachment.blendEnable to VK_FALSE!    
-    color_blending_info.pAttachments = &color_blend_attachment;
-    color_blending_info.attachmentCount = 1; // must match the attachment count of render subpass!
-    // it affects ALL framebuffers
+    color_blending_info.pAttachments = desc->blend_attachments;
+    color_blending_info.attachmentCount = desc->color_attachment_count; // must match the attachment count of render subpass!
+    memcpy(color_blending_info.blendConstants, desc->blend_constants, sizeof(desc->blend_constants));
     
     VkPipelineDepthStencilStateCreateInfo depth_stencil_info = { 0 };
     depth_stencil_info.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
-    depth_stencil_info.depthTestEnable = depth_test_enable;
-    depth_stencil_info.depthCompareOp = depth_compare_op;
-    depth_stencil_info.depthWriteEnable = VK_TRUE;
+    depth_stencil_info.depthTestEnable = desc->depth_test_enable;
+    depth_stencil_info.depthCompareOp = desc->depth_compare_op;
+    depth_stencil_info.depthWriteEnable = desc->depth_write_enable;
     depth_stencil_info.depthBoundsTestEnable = VK_FALSE;
-    depth_stencil_info.stencilTestEnable = VK_FALSE;
-    depth_stencil_info.back.failOp = VK_STENCIL_OP_KEEP;
-    depth_stencil_info.back.passOp = VK_STENCIL_OP_KEEP;
-    depth_stencil_info.back.compareOp = depth_compare_op;
-    depth_stencil_info.back.compareMask = 0;
-    depth_stencil_info.back.reference = 0;
-    depth_stencil_info.back.depthFailOp = VK_STENCIL_OP_KEEP;
-    depth_stencil_info.back.writeMask = 0;
-    depth_stencil_info.front = depth_stencil_info.back;
+    depth_stencil_info.stencilTestEnable = desc->stencil_test_enable;
+    depth_stencil_info.front = desc->stencil_front;
+    depth_stencil_info.back = desc->stencil_back;
     
     VkPipelineMultisampleStateCreateInfo ms_info = { 0 };
     ms_info.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-    ms_info.sampleShadingEnable = VK_FALSE;
-    ms_info.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT; // must match renderpass's color attachment
+    ms_info.rasterizationSamples = desc->samples; // must match renderpass's color attachment
+    ms_info.sampleShadingEnable = desc->sample_shading_enable;
+    ms_info.minSampleShading = desc->min_sample_shading;
+    ms_info.alphaToCoverageEnable = desc->alpha_to_coverage_enable;
     
-    // dynamic state will force us to provide viewport dimensions and linewidth at drawing-time
-    VkDynamicState dynamic_states[] = {
-	VK_DYNAMIC_STATE_VIEWPORT,
-	VK_DYNAMIC_STATE_SCISSOR,
-    };
+    assert(desc->dynamic_state_count <= VKAL_MAX_DYNAMIC_STATES && "build_graphics_pipeline: too many dynamic states!");
     VkPipelineDynamicStateCreateInfo dynamic_state_info = { 0 };
     dynamic_state_info.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-    dynamic_state_info.pDynamicStates = dynamic_states;
-    dynamic_state_info.dynamicStateCount = sizeof(dynamic_states) / sizeof(*dynamic_states);
+    dynamic_state_info.pDynamicStates = desc->dynamic_states;
+    dynamic_state_info.dynamicStateCount = desc->dynamic_state_count;
     
     VkGraphicsPipelineCreateInfo pipeline_info = { 0 };
     pipeline_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
@@ -2461,44 +3765,540 @@ VkPipeline vkal_create_graphics_pipeline(
     pipeline_info.pMultisampleState = &ms_info;
     pipeline_info.pColorBlendState = &color_blending_info;
     pipeline_info.pDepthStencilState = &depth_stencil_info;
-    pipeline_info.pDynamicState = &dynamic_state_info;
-    pipeline_info.layout = pipeline_layout;
-    pipeline_info.renderPass = render_pass;
-    pipeline_info.subpass = 0;
-    
-    uint32_t id;
-    create_graphics_pipeline(pipeline_info, &id);
-    return get_graphics_pipeline(id);
+    pipeline_info.pDynamicState = dynamic_state_info.dynamicStateCount ? &dynamic_state_info : NULL;
+    pipeline_info.layout = desc->pipeline_layout;
+    pipeline_info.renderPass = desc->render_pass;
+    pipeline_info.subpass = desc->subpass;
+
+    VkPipelineCreationFeedbackCreateInfo feedback_info = { 0 };
+    memset(out_feedback, 0, sizeof(VkPipelineCreationFeedback));
+    if (vkal_info.pipeline_cache_stats.feedback_available) {
+        feedback_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO;
+        feedback_info.pPipelineCreationFeedback = out_feedback;
+        pipeline_info.pNext = &feedback_info;
+    }
+    return vkCreateGraphicsPipelines(vkal_info.device, vkal_info.pipeline_cache, 1, &pipeline_info, 0, out_pipeline);
 }
 
-void create_graphics_pipeline(VkGraphicsPipelineCreateInfo create_info, uint32_t * out_graphics_pipeline)
+static void pipeline_key_append(VkalPipelineKey * key, void const * data, size_t size)
 {
-    uint32_t free_index;
-    for (free_index = 0; free_index < VKAL_MAX_VKPIPELINE; ++free_index) {
-	if (vkal_info.user_pipelines[free_index].used) {
+    if (!size) {
+        return;
+    }
+    if (key->size + size > key->capacity) {
+        while (key->size + size > key->capacity) {
+            key->capacity = key->capacity ? 2 * key->capacity : 512;
+        }
+        VKAL_REALLOC(key->data, key->capacity);
+        assert(key->data && "pipeline_key_append: out of memory!");
+    }
+    memcpy(key->data + key->size, data, size);
+    key->size += (uint32_t)size;
+}
 
-	}
-	else break;
+static void pipeline_key_append_stage(VkalPipelineKey * key, VkPipelineShaderStageCreateInfo const * stage)
+{
+    pipeline_key_append(key, &stage->stage, sizeof(stage->stage));
+    if (!stage->stage) {
+        return;
+    }
+    pipeline_key_append(key, &stage->flags, sizeof(stage->flags));
+    pipeline_key_append(key, &stage->module, sizeof(stage->module));
+    if (stage->pName) {
+        pipeline_key_append(key, stage->pName, strlen(stage->pName) + 1);
+    }
+    VkSpecializationInfo const * specialization = stage->pSpecializationInfo;
+    uint32_t map_entry_count = specialization ? specialization->mapEntryCount : 0;
+    pipeline_key_append(key, &map_entry_count, sizeof(uint32_t));
+    if (specialization) {
+        pipeline_key_append(key, specialization->pMapEntries, map_entry_count * sizeof(VkSpecializationMapEntry));
+        pipeline_key_append(key, &specialization->dataSize, sizeof(specialization->dataSize));
+        pipeline_key_append(key, specialization->pData, specialization->dataSize);
+    }
+}
+
+/* Field by field, so padding and the caller's pointers never end up in the key. Render passes
+   are compared by handle, which is stricter than Vulkan's render pass compatibility. */
+static void serialize_pipeline_desc(VkalPipelineDesc const * desc, VkalPipelineKey * key)
+{
+    pipeline_key_append(key, &desc->vertex_input_binding_count, sizeof(uint32_t));
+    pipeline_key_append(key, desc->vertex_input_bindings, desc->vertex_input_binding_count * sizeof(VkVertexInputBindingDescription));
+    pipeline_key_append(key, &desc->vertex_attribute_count, sizeof(uint32_t));
+    pipeline_key_append(key, desc->vertex_attributes, desc->vertex_attribute_count * sizeof(VkVertexInputAttributeDescription));
+
+    pipeline_key_append_stage(key, &desc->shader_setup.vertex_shader_create_info);
+    pipeline_key_append_stage(key, &desc->shader_setup.fragment_shader_create_info);
+    pipeline_key_append_stage(key, &desc->shader_setup.tctrl_shader_create_info);
+    pipeline_key_append_stage(key, &desc->shader_setup.teval_shader_create_info);
+    pipeline_key_append_stage(key, &desc->shader_setup.geometry_shader_create_info);
+    pipeline_key_append(key, &desc->patch_control_points, sizeof(uint32_t));
+
+    pipeline_key_append(key, &desc->primitive_topology, sizeof(VkPrimitiveTopology));
+    pipeline_key_append(key, &desc->primitive_restart_enable, sizeof(VkBool32));
+    pipeline_key_append(key, &desc->polygon_mode, sizeof(VkPolygonMode));
+    pipeline_key_append(key, &desc->cull_mode, sizeof(VkCullModeFlags));
+    pipeline_key_append(key, &desc->front_face, sizeof(VkFrontFace));
+    pipeline_key_append(key, &desc->depth_clamp_enable, sizeof(VkBool32));
+    pipeline_key_append(key, &desc->depth_bias_enable, sizeof(VkBool32));
+    pipeline_key_append(key, &desc->depth_bias_constant_factor, sizeof(float));
+    pipeline_key_append(key, &desc->depth_bias_slope_factor, sizeof(float));
+    pipeline_key_append(key, &desc->line_width, sizeof(float));
+
+    pipeline_key_append(key, &desc->depth_test_enable, sizeof(VkBool32));
+    pipeline_key_append(key, &desc->depth_write_enable, sizeof(VkBool32));
+    pipeline_key_append(key, &desc->depth_compare_op, sizeof(VkCompareOp));
+    pipeline_key_append(key, &desc->stencil_test_enable, sizeof(VkBool32));
+    pipeline_key_append(key, &desc->stencil_front, sizeof(VkStencilOpState));
+    pipeline_key_append(key, &desc->stencil_back, sizeof(VkStencilOpState));
+
+    pipeline_key_append(key, &desc->samples, sizeof(VkSampleCountFlagBits));
+    pipeline_key_append(key, &desc->sample_shading_enable, sizeof(VkBool32));
+    pipeline_key_append(key, &desc->min_sample_shading, sizeof(float));
+    pipeline_key_append(key, &desc->alpha_to_coverage_enable, sizeof(VkBool32));
+
+    pipeline_key_append(key, &desc->color_attachment_count, sizeof(uint32_t));
+    pipeline_key_append(key, desc->blend_attachments, desc->color_attachment_count * sizeof(VkPipelineColorBlendAttachmentState));
+    pipeline_key_append(key, desc->blend_constants, sizeof(desc->blend_constants));
+
+    pipeline_key_append(key, &desc->dynamic_state_count, sizeof(uint32_t));
+    pipeline_key_append(key, desc->dynamic_states, desc->dynamic_state_count * sizeof(VkDynamicState));
+
+    pipeline_key_append(key, &desc->render_pass, sizeof(VkRenderPass));
+    pipeline_key_append(key, &desc->subpass, sizeof(uint32_t));
+    pipeline_key_append(key, &desc->pipeline_layout, sizeof(VkPipelineLayout));
+}
+
+/* FNV-1a, 64 bit. */
+static uint64_t hash_bytes(uint8_t const * data, uint32_t size)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (uint32_t i = 0; i < size; ++i) {
+        hash ^= data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+void create_pipeline_registry(void)
+{
+    VkalPipelineRegistry * registry = &vkal_info.pipeline_registry;
+    memset(registry, 0, sizeof(VkalPipelineRegistry));
+    registry->capacity = VKAL_PIPELINE_REGISTRY_SIZE;
+    VKAL_MALLOC(registry->slots, registry->capacity);
+    assert(registry->slots && "create_pipeline_registry: out of memory!");
+    memset(registry->slots, 0xFF, registry->capacity * sizeof(uint32_t)); // VKAL_INVALID_HANDLE
+}
+
+void destroy_pipeline_registry(void)
+{
+    VKAL_FREE(vkal_info.pipeline_registry.slots);
+    memset(&vkal_info.pipeline_registry, 0, sizeof(VkalPipelineRegistry));
+}
+
+static void pipeline_registry_place(VkalPipelineRegistry * registry, uint32_t id, uint64_t hash)
+{
+    uint32_t mask = registry->capacity - 1;
+    uint32_t slot = (uint32_t)hash & mask;
+    while (registry->slots[slot] != VKAL_INVALID_HANDLE && registry->slots[slot] != VKAL_PIPELINE_REGISTRY_TOMBSTONE) {
+        slot = (slot + 1) & mask;
+    }
+    if (registry->slots[slot] == VKAL_INVALID_HANDLE) {
+        registry->used++;
+    }
+    registry->slots[slot] = id;
+    registry->count++;
+}
+
+/* Keeps the load (tombstones included) below 3/4. Only grows if live entries make up half the table,
+   otherwise rehashing in place is enough to get rid of the tombstones. */
+static void pipeline_registry_insert(uint32_t id, uint64_t hash)
+{
+    VkalPipelineRegistry * registry = &vkal_info.pipeline_registry;
+    if (4 * (registry->used + 1) > 3 * registry->capacity) {
+        uint32_t * old_slots = registry->slots;
+        uint32_t old_capacity = registry->capacity;
+        if (2 * (registry->count + 1) > registry->capacity) {
+            registry->capacity *= 2;
+        }
+        VKAL_MALLOC(registry->slots, registry->capacity);
+        assert(registry->slots && "pipeline_registry_insert: out of memory!");
+        memset(registry->slots, 0xFF, registry->capacity * sizeof(uint32_t));
+        registry->count = 0;
+        registry->used = 0;
+        for (uint32_t i = 0; i < old_capacity; ++i) {
+            uint32_t old_id = old_slots[i];
+            if (old_id == VKAL_INVALID_HANDLE || old_id == VKAL_PIPELINE_REGISTRY_TOMBSTONE) continue;
+            VkalPipelineHandle * pipeline_handle = (VkalPipelineHandle*)handle_pool_get(&vkal_info.user_pipelines, old_id);
+            pipeline_registry_place(registry, old_id, pipeline_handle->hash);
+        }
+        VKAL_FREE(old_slots);
+    }
+    pipeline_registry_place(registry, id, hash);
+}
+
+/* Returns the slot of the registered pipeline matching 'hash' and 'key', VKAL_INVALID_HANDLE if there is none. */
+static uint32_t pipeline_registry_find(uint64_t hash, VkalPipelineKey const * key)
+{
+    VkalPipelineRegistry * registry = &vkal_info.pipeline_registry;
+    uint32_t mask = registry->capacity - 1;
+    uint32_t slot = (uint32_t)hash & mask;
+    while (registry->slots[slot] != VKAL_INVALID_HANDLE) {
+        uint32_t id = registry->slots[slot];
+        if (id != VKAL_PIPELINE_REGISTRY_TOMBSTONE) {
+            VkalPipelineHandle * pipeline_handle = (VkalPipelineHandle*)handle_pool_get(&vkal_info.user_pipelines, id);
+            if (pipeline_handle->hash == hash && pipeline_handle->key_size == key->size &&
+                !memcmp(pipeline_handle->key, key->data, key->size)) {
+                return slot;
+            }
+        }
+        slot = (slot + 1) & mask;
+    }
+    return VKAL_INVALID_HANDLE;
+}
+
+static void pipeline_registry_remove(uint32_t id, uint64_t hash)
+{
+    VkalPipelineRegistry * registry = &vkal_info.pipeline_registry;
+    uint32_t mask = registry->capacity - 1;
+    uint32_t slot = (uint32_t)hash & mask;
+    while (registry->slots[slot] != VKAL_INVALID_HANDLE) {
+        if (registry->slots[slot] == id) {
+            registry->slots[slot] = VKAL_PIPELINE_REGISTRY_TOMBSTONE;
+            registry->count--;
+            return;
+        }
+        slot = (slot + 1) & mask;
+    }
+    assert(0 && "pipeline_registry_remove: pipeline is not registered!");
+}
+
+static void record_pipeline_feedback(VkPipelineCreationFeedback * feedback);
+static void reset_gpu_profiler_pool(VkCommandBuffer command_buffer);
+static void resolve_gpu_profile(uint32_t frame);
+static void inherit_queries(VkCommandBufferInheritanceInfo * inheritance_info);
+
+/* Takes ownership of key->data. */
+static uint32_t register_graphics_pipeline(VkPipeline pipeline, VkPipelineCreationFeedback * feedback, VkalPipelineKey * key, uint64_t hash)
+{
+    VkalPipelineHandle * pipeline_handle;
+    uint32_t id = handle_pool_alloc(&vkal_info.user_pipelines, (void**)&pipeline_handle);
+    pipeline_handle->pipeline = pipeline;
+    pipeline_handle->hash = hash;
+    pipeline_handle->key = key->data;
+    pipeline_handle->key_size = key->size;
+    pipeline_handle->ref_count = 1;
+    key->data = NULL;
+    record_pipeline_feedback(feedback);
+    pipeline_registry_insert(id, hash);
+    return id;
+}
+
+VkPipeline vkal_create_pipeline(VkalPipelineDesc const * desc)
+{
+    VkalPipelineKey key = { 0 };
+    serialize_pipeline_desc(desc, &key);
+    uint64_t hash = hash_bytes(key.data, key.size);
+
+    uint32_t slot = pipeline_registry_find(hash, &key);
+    if (slot != VKAL_INVALID_HANDLE) {
+        VkalPipelineHandle * pipeline_handle = (VkalPipelineHandle*)handle_pool_get(&vkal_info.user_pipelines, vkal_info.pipeline_registry.slots[slot]);
+        pipeline_handle->ref_count++;
+        vkal_info.pipeline_cache_stats.registry_hits++;
+        VKAL_FREE(key.data);
+        return pipeline_handle->pipeline;
+    }
+
+    VkPipelineCreationFeedback feedback;
+    VkPipeline pipeline;
+    VkResult result = compile_graphics_pipeline(desc, &feedback, &pipeline);
+    VKAL_ASSERT(result && "failed to create graphics pipeline!");
+    register_graphics_pipeline(pipeline, &feedback, &key, hash);
+    return pipeline;
+}
+
+static void compile_pipeline_job(void * data, uint32_t worker_index)
+{
+    (void)worker_index;
+    VkalPipelineBatchJob * job = (VkalPipelineBatchJob*)data;
+    VkalPipelineBatch * batch = job->batch;
+    job->result = compile_graphics_pipeline(&batch->descs[job->index], &job->feedback, &batch->out_pipelines[job->index]);
+}
+
+void vkal_create_pipelines_begin(VkalPipelineBatch * batch, VkalPipelineDesc const * descs, uint32_t count, VkPipeline * out_pipelines)
+{
+    memset(batch, 0, sizeof(VkalPipelineBatch));
+    batch->descs = descs;
+    batch->count = count;
+    batch->out_pipelines = out_pipelines;
+    VKAL_MALLOC(batch->keys, count);
+    VKAL_MALLOC(batch->hashes, count);
+    VKAL_MALLOC(batch->sources, count);
+    VKAL_MALLOC(batch->jobs, count);
+    assert((!count || (batch->keys && batch->hashes && batch->sources && batch->jobs)) && "vkal_create_pipelines_begin: out of memory!");
+
+    // Registry lookups and deduplication happen here, so the workers only ever call into Vulkan.
+    for (uint32_t i = 0; i < count; ++i) {
+        VkalPipelineKey * key = &batch->keys[i];
+        memset(key, 0, sizeof(VkalPipelineKey));
+        serialize_pipeline_desc(&descs[i], key);
+        batch->hashes[i] = hash_bytes(key->data, key->size);
+        batch->sources[i] = i;
+
+        uint32_t slot = pipeline_registry_find(batch->hashes[i], key);
+        if (slot != VKAL_INVALID_HANDLE) {
+            VkalPipelineHandle * pipeline_handle = (VkalPipelineHandle*)handle_pool_get(&vkal_info.user_pipelines, vkal_info.pipeline_registry.slots[slot]);
+            pipeline_handle->ref_count++;
+            vkal_info.pipeline_cache_stats.registry_hits++;
+            out_pipelines[i] = pipeline_handle->pipeline;
+            batch->sources[i] = VKAL_INVALID_HANDLE;
+            continue;
+        }
+        for (uint32_t j = 0; j < i; ++j) {
+            if (batch->sources[j] == j && batch->hashes[j] == batch->hashes[i] && batch->keys[j].size == key->size &&
+                !memcmp(batch->keys[j].data, key->data, key->size)) {
+                batch->sources[i] = j;
+                break;
+            }
+        }
+        if (batch->sources[i] == i) {
+            batch->jobs[i].batch = batch;
+            batch->jobs[i].index = i;
+            vkal_submit_job(&batch->group, compile_pipeline_job, &batch->jobs[i]);
+        }
+    }
+}
+
+int vkal_pipeline_batch_done(VkalPipelineBatch * batch)
+{
+    return vkal_job_group_done(&batch->group);
+}
+
+void vkal_create_pipelines_end(VkalPipelineBatch * batch)
+{
+    vkal_wait_job_group(&batch->group);
+    for (uint32_t i = 0; i < batch->count; ++i) {
+        uint32_t source = batch->sources[i];
+        if (source == VKAL_INVALID_HANDLE) {
+            VKAL_FREE(batch->keys[i].data);
+        }
+        else if (source == i) {
+            VKAL_ASSERT(batch->jobs[i].result && "failed to create graphics pipeline!");
+            register_graphics_pipeline(batch->out_pipelines[i], &batch->jobs[i].feedback, &batch->keys[i], batch->hashes[i]);
+        }
+        else {
+            // Sources always come first, so this one is registered already.
+            batch->out_pipelines[i] = batch->out_pipelines[source];
+            vkal_create_pipeline(&batch->descs[i]);
+            VKAL_FREE(batch->keys[i].data);
+        }
+    }
+    VKAL_FREE(batch->keys);
+    VKAL_FREE(batch->hashes);
+    VKAL_FREE(batch->sources);
+    VKAL_FREE(batch->jobs);
+    memset(batch, 0, sizeof(VkalPipelineBatch));
+}
+
+void vkal_create_pipelines(VkalPipelineDesc const * descs, uint32_t count, VkPipeline * out_pipelines)
+{
+    VkalPipelineBatch batch;
+    vkal_create_pipelines_begin(&batch, descs, count, out_pipelines);
+    vkal_create_pipelines_end(&batch);
+}
+
+void vkal_set_pipeline_cache_path(char const * path)
+{
+    vkal_info.pipeline_cache_path_set = 1;
+    vkal_info.pipeline_cache_path[0] = '\0';
+    if (path) {
+        strncpy(vkal_info.pipeline_cache_path, path, VKAL_MAX_PATH - 1);
+        vkal_info.pipeline_cache_path[VKAL_MAX_PATH - 1] = '\0';
+    }
+}
+
+void vkal_set_frames_in_flight(uint32_t count)
+{
+    assert(!vkal_info.device && "vkal_set_frames_in_flight: call before vkal_init!");
+    if (count < 1) {
+        count = 1;
+    }
+    else if (count > VKAL_MAX_IMAGES_IN_FLIGHT) {
+        count = VKAL_MAX_IMAGES_IN_FLIGHT;
+    }
+    vkal_info.frames_in_flight = count;
+}
+
+void vkal_set_latency_mode(VkalLatencyMode mode)
+{
+    vkal_info.latency_mode = mode;
+}
+
+/* Only accept cache data written by this exact device and driver. Drivers are supposed to ignore
+   foreign data themselves, but not all of them do so gracefully. */
+static int pipeline_cache_header_valid(uint8_t * data, size_t size)
+{
+    if (size < sizeof(VkPipelineCacheHeaderVersionOne)) {
+        return 0;
+    }
+    VkPipelineCacheHeaderVersionOne header;
+    memcpy(&header, data, sizeof(VkPipelineCacheHeaderVersionOne));
+    return header.headerSize >= sizeof(VkPipelineCacheHeaderVersionOne) &&
+        header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+        header.vendorID == vkal_info.physical_device_properties.vendorID &&
+        header.deviceID == vkal_info.physical_device_properties.deviceID &&
+        memcmp(header.pipelineCacheUUID, vkal_info.physical_device_properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+void create_pipeline_cache(void)
+{
+    if (!vkal_info.pipeline_cache_path_set) {
+        vkal_set_pipeline_cache_path(VKAL_PIPELINE_CACHE_FILE);
+    }
+    memset(&vkal_info.pipeline_cache_stats, 0, sizeof(VkalPipelineCacheStats));
+    vkal_info.pipeline_cache_stats.feedback_available =
+        vkal_info.instance_api_version >= VK_API_VERSION_1_3 &&
+        vkal_info.physical_device_properties.apiVersion >= VK_API_VERSION_1_3;
+
+    uint8_t * data = NULL;
+    size_t size = 0;
+    FILE * file = vkal_info.pipeline_cache_path[0] ? fopen(vkal_info.pipeline_cache_path, "rb") : NULL;
+    if (file) {
+        fseek(file, 0, SEEK_END);
+        long file_size = ftell(file);
+        fseek(file, 0, SEEK_SET);
+        if (file_size > 0) {
+            data = (uint8_t*)malloc(file_size);
+            size = fread(data, 1, file_size, file);
+        }
+        fclose(file);
+        if (data && !pipeline_cache_header_valid(data, size)) {
+            printf("[VKAL] pipeline cache %s was written by a different device or driver, ignoring it.\n", vkal_info.pipeline_cache_path);
+            vkal_info.pipeline_cache_stats.file_rejected = 1;
+            size = 0;
+        }
+    }
+
+    VkPipelineCacheCreateInfo create_info = { 0 };
+    create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    create_info.initialDataSize = size;
+    create_info.pInitialData = size ? data : NULL;
+    VkResult result = vkCreatePipelineCache(vkal_info.device, &create_info, 0, &vkal_info.pipeline_cache);
+    VKAL_ASSERT(result && "failed to create pipeline cache!");
+    vkal_info.pipeline_cache_stats.loaded_size = size;
+    free(data);
+}
+
+void vkal_save_pipeline_cache(void)
+{
+    if (!vkal_info.pipeline_cache_path[0] || vkal_info.pipeline_cache == VK_NULL_HANDLE) {
+        return;
+    }
+    size_t size = 0;
+    VkResult result = vkGetPipelineCacheData(vkal_info.device, vkal_info.pipeline_cache, &size, NULL);
+    VKAL_ASSERT(result && "failed to get pipeline cache size!");
+    uint8_t * data = (uint8_t*)malloc(size);
+    result = vkGetPipelineCacheData(vkal_info.device, vkal_info.pipeline_cache, &size, data);
+    VKAL_ASSERT(result && "failed to get pipeline cache data!");
+
+    FILE * file = fopen(vkal_info.pipeline_cache_path, "wb");
+    if (file) {
+        fwrite(data, 1, size, file);
+        fclose(file);
+    }
+    else {
+        printf("[VKAL] could not write pipeline cache to %s\n", vkal_info.pipeline_cache_path);
+    }
+    free(data);
+}
+
+void vkal_get_pipeline_cache_stats(VkalPipelineCacheStats * out_stats)
+{
+    *out_stats = vkal_info.pipeline_cache_stats;
+}
+
+static void record_pipeline_feedback(VkPipelineCreationFeedback * feedback)
+{
+    vkal_info.pipeline_cache_stats.pipelines_created++;
+    vkal_info.frame_stats.pipeline_creations++;
+    if (!vkal_info.pipeline_cache_stats.feedback_available || !(feedback->flags & VK_PIPELINE_CREATION_FEEDBACK_VALID_BIT)) {
+        return;
+    }
+    if (feedback->flags & VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT) {
+        vkal_info.pipeline_cache_stats.cache_hits++;
+    }
+    else {
+        vkal_info.pipeline_cache_stats.cache_misses++;
     }
-    VkResult result = vkCreateGraphicsPipelines(vkal_info.device, VK_NULL_HANDLE, 1, &create_info, 0, &vkal_info.user_pipelines[free_index].pipeline);
+    vkal_info.pipeline_cache_stats.creation_time_ns += feedback->duration;
+}
+
+void create_graphics_pipeline(VkGraphicsPipelineCreateInfo create_info, uint32_t * out_graphics_pipeline)
+{
+    VkPipelineCreationFeedback feedback = { 0 };
+    VkPipelineCreationFeedbackCreateInfo feedback_info = { 0 };
+    if (vkal_info.pipeline_cache_stats.feedback_available) {
+        feedback_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO;
+        feedback_info.pNext = create_info.pNext;
+        feedback_info.pPipelineCreationFeedback = &feedback;
+        create_info.pNext = &feedback_info;
+    }
+
+    VkalPipelineHandle * pipeline_handle;
+    uint32_t pipeline_id = handle_pool_alloc(&vkal_info.user_pipelines, (void**)&pipeline_handle);
+    VkResult result = vkCreateGraphicsPipelines(vkal_info.device, vkal_info.pipeline_cache, 1, &create_info, 0, &pipeline_handle->pipeline);
     VKAL_ASSERT(result && "failed to create graphics pipeline!");
-    vkal_info.user_pipelines[free_index].used = 1;
-    *out_graphics_pipeline = free_index;
+    record_pipeline_feedback(&feedback);
+    *out_graphics_pipeline = pipeline_id;
 }
 
 VkPipeline get_graphics_pipeline(uint32_t id)
 {
-    assert(id < VKAL_MAX_VKPIPELINE);
-    assert(vkal_info.user_pipelines[id].used);
-    return vkal_info.user_pipelines[id].pipeline;
+    return ((VkalPipelineHandle*)handle_pool_get(&vkal_info.user_pipelines, id))->pipeline;
 }
 
 void destroy_graphics_pipeline(uint32_t id)
 {
-    if (vkal_info.user_pipelines[id].used) {
-		vkDestroyPipeline(vkal_info.device, get_graphics_pipeline(id), 0);
-		vkal_info.user_pipelines[id].used = 0;
+    if (handle_pool_valid(&vkal_info.user_pipelines, id)) {
+		VkalPipelineHandle * pipeline_handle = (VkalPipelineHandle*)handle_pool_get(&vkal_info.user_pipelines, id);
+		if (pipeline_handle->key) {
+			pipeline_registry_remove(id, pipeline_handle->hash);
+			VKAL_FREE(pipeline_handle->key);
+		}
+		vkDestroyPipeline(vkal_info.device, pipeline_handle->pipeline, 0);
+		handle_pool_free(&vkal_info.user_pipelines, id);
+    }
+}
+
+VkPipeline vkal_create_compute_pipeline(SingleShaderStageSetup shader_setup, VkPipelineLayout pipeline_layout)
+{
+    assert(shader_setup.create_info.stage == VK_SHADER_STAGE_COMPUTE_BIT);
+    VkComputePipelineCreateInfo pipeline_info = { 0 };
+    pipeline_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipeline_info.stage = shader_setup.create_info;
+    pipeline_info.layout = pipeline_layout;
+
+    uint32_t id;
+    create_compute_pipeline(pipeline_info, &id);
+    return get_graphics_pipeline(id);
+}
+
+void create_compute_pipeline(VkComputePipelineCreateInfo create_info, uint32_t * out_compute_pipeline)
+{
+    VkPipelineCreationFeedback feedback = { 0 };
+    VkPipelineCreationFeedbackCreateInfo feedback_info = { 0 };
+    if (vkal_info.pipeline_cache_stats.feedback_available) {
+        feedback_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO;
+        feedback_info.pNext = create_info.pNext;
+        feedback_info.pPipelineCreationFeedback = &feedback;
+        create_info.pNext = &feedback_info;
     }
+
+    VkalPipelineHandle * pipeline_handle;
+    uint32_t pipeline_id = handle_pool_alloc(&vkal_info.user_pipelines, (void**)&pipeline_handle);
+    VkResult result = vkCreateComputePipelines(vkal_info.device, vkal_info.pipeline_cache, 1, &create_info, 0, &pipeline_handle->pipeline);
+    VKAL_ASSERT(result && "failed to create compute pipeline!");
+    record_pipeline_feedback(&feedback);
+    *out_compute_pipeline = pipeline_id;
 }
 
 VkWriteDescriptorSet create_write_descriptor_set_image(VkDescriptorSet dst_descriptor_set, uint32_t dst_binding,
@@ -2568,7 +4368,7 @@ void create_default_command_pool(void)
     cmdpool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
     cmdpool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
     
-    QueueFamilyIndicies indicies = find_queue_families(vkal_info.physical_device, vkal_info.surface);
+    QueueFamilyIndicies indicies = vkal_info.queue_families;
     if (indicies.has_graphics_family && indicies.has_present_family) {
 		if (indicies.graphics_family != indicies.present_family) {
 			cmdpool_info.queueFamilyIndex = indicies.graphics_family;
@@ -2596,22 +4396,17 @@ void create_default_command_pool(void)
 
 VkCommandBuffer vkal_create_command_buffer(VkCommandBufferLevel cmd_buffer_level, uint32_t begin)
 {
-    VkCommandBufferAllocateInfo alloc_info = { 0 };
-    alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    alloc_info.commandPool = vkal_info.default_command_pools[0];
-    alloc_info.level = cmd_buffer_level;
-    alloc_info.commandBufferCount = 1;
-
-    VkCommandBuffer command_buffer = VK_NULL_HANDLE;
-    VkResult result = vkAllocateCommandBuffers(vkal_info.device, &alloc_info, &command_buffer);
-    VKAL_ASSERT(result && "Failed to allocate command buffer from pool");
+    assert(cmd_buffer_level <= VK_COMMAND_BUFFER_LEVEL_SECONDARY);
+    VkCommandBuffer command_buffer = frame_command_pool_acquire(&vkal_info.oneshot_command_pools[vkal_info.frames_rendered][cmd_buffer_level]);
 
     if (begin) {
 		VkCommandBufferBeginInfo begin_info = {0};
 		begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-        result = vkBeginCommandBuffer(command_buffer, &begin_info);
+		begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        VkResult result = vkBeginCommandBuffer(command_buffer, &begin_info);
 		VKAL_ASSERT(result && "Failed to begin command buffer recording");
     }
+    vkal_invalidate_bind_state(command_buffer);
 
     return command_buffer;
 }
@@ -2633,6 +4428,8 @@ void vkal_begin(uint32_t image_id, VkCommandBuffer command_buffer, VkRenderPass
     VkCommandBufferBeginInfo begin_info = { 0 };
     begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
     vkBeginCommandBuffer(command_buffer, &begin_info);
+    vkal_invalidate_bind_state(command_buffer);
+    reset_gpu_profiler_pool(command_buffer);
     
     VkRenderPassBeginInfo pass_begin_info = { 0 };
     pass_begin_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
@@ -2649,7 +4446,7 @@ void vkal_begin(uint32_t image_id, VkCommandBuffer command_buffer, VkRenderPass
     vkCmdBeginRenderPass(command_buffer, &pass_begin_info, VK_SUBPASS_CONTENTS_INLINE);
 }
 
-void vkal_begin_render_pass(uint32_t image_id, VkRenderPass render_pass)
+static void begin_default_render_pass(uint32_t image_id, VkRenderPass render_pass, VkSubpassContents contents)
 {
     VkRenderPassBeginInfo pass_begin_info = {0};
     pass_begin_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
@@ -2663,7 +4460,18 @@ void vkal_begin_render_pass(uint32_t image_id, VkRenderPass render_pass)
 
     pass_begin_info.clearValueCount = 2;
     pass_begin_info.pClearValues = clear_values;
-    vkCmdBeginRenderPass(vkal_info.default_command_buffers[image_id], &pass_begin_info, VK_SUBPASS_CONTENTS_INLINE);
+    vkCmdBeginRenderPass(vkal_info.default_command_buffers[image_id], &pass_begin_info, contents);
+    vkal_invalidate_bind_state(vkal_info.default_command_buffers[image_id]);
+}
+
+void vkal_begin_render_pass(uint32_t image_id, VkRenderPass render_pass)
+{
+    begin_default_render_pass(image_id, render_pass, VK_SUBPASS_CONTENTS_INLINE);
+}
+
+void vkal_begin_render_pass_secondary(uint32_t image_id, VkRenderPass render_pass)
+{
+    begin_default_render_pass(image_id, render_pass, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
 }
 
 void vkal_begin_command_buffer(uint32_t image_id)
@@ -2671,6 +4479,8 @@ void vkal_begin_command_buffer(uint32_t image_id)
     VkCommandBufferBeginInfo begin_info = {0};
     begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
     vkBeginCommandBuffer(vkal_info.default_command_buffers[image_id], &begin_info);
+    vkal_invalidate_bind_state(vkal_info.default_command_buffers[image_id]);
+    reset_gpu_profiler_pool(vkal_info.default_command_buffers[image_id]);
 }
 
 void vkal_begin_render_to_image_render_pass(
@@ -2697,6 +4507,7 @@ void vkal_begin_render_to_image_render_pass(
     pass_begin_info.clearValueCount = 2;
     pass_begin_info.pClearValues = clear_values;
     vkCmdBeginRenderPass(command_buffer, &pass_begin_info, VK_SUBPASS_CONTENTS_INLINE);
+    vkal_invalidate_bind_state(command_buffer);
 }
 
 void vkal_end_renderpass(uint32_t image_id)
@@ -2768,6 +4579,106 @@ void vkal_bind_descriptor_set2(
         pipeline_layout, first_set, descriptor_set_count, descriptor_sets, 0, 0);
 }
 
+static VkalBindState * get_bind_state(VkCommandBuffer command_buffer)
+{
+    VkalBindTracker * tracker = &vkal_bind_tracker;
+    VkalBindState * oldest = &tracker->states[0];
+    tracker->use_counter++;
+    for (uint32_t i = 0; i < VKAL_BIND_STATE_CACHE_SIZE; ++i) {
+        VkalBindState * state = &tracker->states[i];
+        if (state->command_buffer == command_buffer) {
+            state->last_use = tracker->use_counter;
+            return state;
+        }
+        if (state->last_use < oldest->last_use) {
+            oldest = state;
+        }
+    }
+    // Evicting only forgets what is bound, so the next binds on that command buffer are issued again.
+    memset(oldest, 0, sizeof(VkalBindState));
+    oldest->command_buffer = command_buffer;
+    oldest->last_use = tracker->use_counter;
+    return oldest;
+}
+
+void vkal_invalidate_bind_state(VkCommandBuffer command_buffer)
+{
+    VkalBindTracker * tracker = &vkal_bind_tracker;
+    for (uint32_t i = 0; i < VKAL_BIND_STATE_CACHE_SIZE; ++i) {
+        if (tracker->states[i].command_buffer == command_buffer) {
+            memset(&tracker->states[i], 0, sizeof(VkalBindState));
+        }
+    }
+}
+
+static void bind_pipeline(VkCommandBuffer command_buffer, VkPipeline pipeline)
+{
+    VkalBindState * state = get_bind_state(command_buffer);
+    vkal_bind_tracker.stats.pipelines++;
+    if (state->pipeline == pipeline) {
+        vkal_bind_tracker.stats.pipelines_skipped++;
+        return;
+    }
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+    state->pipeline = pipeline;
+    // Dynamic state set before may not survive a pipeline that does not declare it dynamic.
+    state->has_viewport = 0;
+    state->has_scissor = 0;
+}
+
+static void bind_vertex_buffer(VkCommandBuffer command_buffer, VkBuffer buffer, VkDeviceSize offset)
+{
+    VkalBindState * state = get_bind_state(command_buffer);
+    vkal_bind_tracker.stats.vertex_buffers++;
+    if (state->vertex_buffer == buffer && state->vertex_buffer_offset == offset) {
+        vkal_bind_tracker.stats.vertex_buffers_skipped++;
+        return;
+    }
+    vkCmdBindVertexBuffers(command_buffer, 0, 1, &buffer, &offset);
+    state->vertex_buffer = buffer;
+    state->vertex_buffer_offset = offset;
+}
+
+static void bind_index_buffer(VkCommandBuffer command_buffer, VkBuffer buffer, VkDeviceSize offset, VkIndexType index_type)
+{
+    VkalBindState * state = get_bind_state(command_buffer);
+    vkal_bind_tracker.stats.index_buffers++;
+    if (state->index_buffer == buffer && state->index_buffer_offset == offset && state->index_type == index_type) {
+        vkal_bind_tracker.stats.index_buffers_skipped++;
+        return;
+    }
+    vkCmdBindIndexBuffer(command_buffer, buffer, offset, index_type);
+    state->index_buffer = buffer;
+    state->index_buffer_offset = offset;
+    state->index_type = index_type;
+}
+
+static void set_viewport(VkCommandBuffer command_buffer, VkViewport viewport)
+{
+    VkalBindState * state = get_bind_state(command_buffer);
+    vkal_bind_tracker.stats.viewports++;
+    if (state->has_viewport && !memcmp(&state->viewport, &viewport, sizeof(VkViewport))) {
+        vkal_bind_tracker.stats.viewports_skipped++;
+        return;
+    }
+    vkCmdSetViewport(command_buffer, 0, 1, &viewport);
+    state->has_viewport = 1;
+    state->viewport = viewport;
+}
+
+static void set_scissor(VkCommandBuffer command_buffer, VkRect2D scissor)
+{
+    VkalBindState * state = get_bind_state(command_buffer);
+    vkal_bind_tracker.stats.scissors++;
+    if (state->has_scissor && !memcmp(&state->scissor, &scissor, sizeof(VkRect2D))) {
+        vkal_bind_tracker.stats.scissors_skipped++;
+        return;
+    }
+    vkCmdSetScissor(command_buffer, 0, 1, &scissor);
+    state->has_scissor = 1;
+    state->scissor = scissor;
+}
+
 void vkal_viewport(VkCommandBuffer command_buffer, float x, float y, float width, float height)
 {
     VkViewport viewport = { 0 };
@@ -2777,7 +4688,7 @@ void vkal_viewport(VkCommandBuffer command_buffer, float x, float y, float width
     viewport.height = height; // (float)vp_height;
     viewport.minDepth = 0.f;
     viewport.maxDepth = 1.f;
-    vkCmdSetViewport(command_buffer, 0, 1, &viewport);
+    set_viewport(command_buffer, viewport);
 }
 
 void vkal_scissor(VkCommandBuffer command_buffer, float offset_x, float offset_y, float extent_x, float extent_y)
@@ -2787,25 +4698,43 @@ void vkal_scissor(VkCommandBuffer command_buffer, float offset_x, float offset_y
     scissor.offset.y      = (int32_t)offset_y;
     scissor.extent.width  = (uint32_t)extent_x;
     scissor.extent.height = (uint32_t)extent_y;
-    vkCmdSetScissor(command_buffer, 0, 1, &scissor); 
+    set_scissor(command_buffer, scissor);
+}
+
+
+void vkal_bind_descriptor_sets_compute(
+	VkCommandBuffer command_buffer,
+	uint32_t first_set, VkDescriptorSet * descriptor_sets, uint32_t descriptor_set_count,
+	VkPipelineLayout pipeline_layout)
+{
+    vkCmdBindDescriptorSets(
+		command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+		pipeline_layout, first_set, descriptor_set_count, descriptor_sets, 0, 0);
+}
+
+void vkal_dispatch(VkCommandBuffer command_buffer, VkPipeline pipeline, uint32_t group_count_x, uint32_t group_count_y, uint32_t group_count_z)
+{
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+    vkCmdDispatch(command_buffer, group_count_x, group_count_y, group_count_z);
 }
 
+/* 'buffer' holds a VkDispatchIndirectCommand at 'offset' and needs VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT. */
+void vkal_dispatch_indirect(VkCommandBuffer command_buffer, VkPipeline pipeline, VkBuffer buffer, VkDeviceSize offset)
+{
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+    vkCmdDispatchIndirect(command_buffer, buffer, offset);
+}
 
 void vkal_draw_indexed(
     uint32_t image_id, VkPipeline pipeline,
     VkDeviceSize index_buffer_offset, uint32_t index_count,
     VkDeviceSize vertex_buffer_offset, uint32_t instance_count)
 {
-    vkCmdBindPipeline(vkal_info.default_command_buffers[image_id], VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
-    vkCmdBindIndexBuffer(
-		vkal_info.default_command_buffers[image_id],
-		vkal_info.default_index_buffer.buffer, index_buffer_offset, vkal_index_type);
-    uint64_t vertex_buffer_offsets[1];
-    vertex_buffer_offsets[0] = vertex_buffer_offset;
-    VkBuffer vertex_buffers[1];
-	vertex_buffers[0] = vkal_info.default_vertex_buffer.buffer;
-    vkCmdBindVertexBuffers(vkal_info.default_command_buffers[image_id], 0, 1, vertex_buffers, vertex_buffer_offsets);
-    vkCmdDrawIndexed(vkal_info.default_command_buffers[image_id], index_count, instance_count, 0, 0, 0);
+    VkCommandBuffer command_buffer = vkal_info.default_command_buffers[image_id];
+    bind_pipeline(command_buffer, pipeline);
+    bind_index_buffer(command_buffer, vkal_info.default_index_buffer.buffer, index_buffer_offset, vkal_index_type);
+    bind_vertex_buffer(command_buffer, vkal_info.default_vertex_buffer.buffer, vertex_buffer_offset);
+    vkCmdDrawIndexed(command_buffer, index_count, instance_count, 0, 0, 0);
 }
 
 void vkal_draw_indexed_from_buffers(
@@ -2815,15 +4744,11 @@ void vkal_draw_indexed_from_buffers(
     uint32_t image_id, 
 	VkPipeline pipeline)
 {
-    vkCmdBindPipeline(vkal_info.default_command_buffers[image_id], VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
-    vkCmdBindIndexBuffer(vkal_info.default_command_buffers[image_id],
-			 index_buffer.buffer, index_buffer_offset, vkal_index_type);
-    uint64_t vertex_buffer_offsets[1];
-    vertex_buffer_offsets[0] = vertex_buffer_offset;
-    VkBuffer vertex_buffers[1];
-    vertex_buffers[0] = vertex_buffer.buffer;
-    vkCmdBindVertexBuffers(vkal_info.default_command_buffers[image_id], 0, 1, vertex_buffers, vertex_buffer_offsets);
-    vkCmdDrawIndexed(vkal_info.default_command_buffers[image_id], index_count, 1, 0, 0, 0);
+    VkCommandBuffer command_buffer = vkal_info.default_command_buffers[image_id];
+    bind_pipeline(command_buffer, pipeline);
+    bind_index_buffer(command_buffer, index_buffer.buffer, index_buffer_offset, vkal_index_type);
+    bind_vertex_buffer(command_buffer, vertex_buffer.buffer, vertex_buffer_offset);
+    vkCmdDrawIndexed(command_buffer, index_count, 1, 0, 0, 0);
 }
 
 // TODO: Bind pipeline not here. Let it user do manually?
@@ -2831,13 +4756,10 @@ void vkal_draw(
     uint32_t image_id, VkPipeline pipeline,
     VkDeviceSize vertex_buffer_offset, uint32_t vertex_count)
 {
-    vkCmdBindPipeline(vkal_info.default_command_buffers[image_id], VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
-    uint64_t vertex_buffer_offsets[1];
-    vertex_buffer_offsets[0] = vertex_buffer_offset;
-    VkBuffer vertex_buffers[1];
-    vertex_buffers[0] = vkal_info.default_vertex_buffer.buffer;
-    vkCmdBindVertexBuffers(vkal_info.default_command_buffers[image_id], 0, 1, vertex_buffers, vertex_buffer_offsets);
-    vkCmdDraw(vkal_info.default_command_buffers[image_id], vertex_count, 1, 0, 0);
+    VkCommandBuffer command_buffer = vkal_info.default_command_buffers[image_id];
+    bind_pipeline(command_buffer, pipeline);
+    bind_vertex_buffer(command_buffer, vkal_info.default_vertex_buffer.buffer, vertex_buffer_offset);
+    vkCmdDraw(command_buffer, vertex_count, 1, 0, 0);
 }
 
 void vkal_draw_from_buffers(
@@ -2846,13 +4768,69 @@ void vkal_draw_from_buffers(
 	VkPipeline pipeline,
     VkDeviceSize vertex_buffer_offset, uint32_t vertex_count)
 {
-    vkCmdBindPipeline(vkal_info.default_command_buffers[image_id], VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
-    uint64_t vertex_buffer_offsets[1];
-    vertex_buffer_offsets[0] = vertex_buffer_offset;
-    VkBuffer vertex_buffers[1];
-    vertex_buffers[0] = vertex_buffer.buffer;
-    vkCmdBindVertexBuffers(vkal_info.default_command_buffers[image_id], 0, 1, vertex_buffers, vertex_buffer_offsets);
-    vkCmdDraw(vkal_info.default_command_buffers[image_id], vertex_count, 1, 0, 0);
+    VkCommandBuffer command_buffer = vkal_info.default_command_buffers[image_id];
+    bind_pipeline(command_buffer, pipeline);
+    bind_vertex_buffer(command_buffer, vertex_buffer.buffer, vertex_buffer_offset);
+    vkCmdDraw(command_buffer, vertex_count, 1, 0, 0);
+}
+
+static void bind_default_vertex_buffers(VkCommandBuffer command_buffer, VkPipeline pipeline, uint32_t indexed)
+{
+    bind_pipeline(command_buffer, pipeline);
+    bind_vertex_buffer(command_buffer, vkal_info.default_vertex_buffer.buffer, 0);
+    if (indexed) {
+        bind_index_buffer(command_buffer, vkal_info.default_index_buffer.buffer, 0, vkal_index_type);
+    }
+}
+
+void vkal_draw_indirect(VkCommandBuffer command_buffer, VkPipeline pipeline,
+    VkBuffer buffer, VkDeviceSize offset, uint32_t draw_count, uint32_t stride)
+{
+    stride = stride ? stride : sizeof(VkDrawIndirectCommand);
+    bind_default_vertex_buffers(command_buffer, pipeline, 0);
+    if (vkal_info.multi_draw_indirect) {
+        vkCmdDrawIndirect(command_buffer, buffer, offset, draw_count, stride);
+    }
+    else {
+        for (uint32_t i = 0; i < draw_count; ++i) {
+            vkCmdDrawIndirect(command_buffer, buffer, offset + (VkDeviceSize)i * stride, 1, stride);
+        }
+    }
+}
+
+void vkal_draw_indexed_indirect(VkCommandBuffer command_buffer, VkPipeline pipeline,
+    VkBuffer buffer, VkDeviceSize offset, uint32_t draw_count, uint32_t stride)
+{
+    stride = stride ? stride : sizeof(VkDrawIndexedIndirectCommand);
+    bind_default_vertex_buffers(command_buffer, pipeline, 1);
+    if (vkal_info.multi_draw_indirect) {
+        vkCmdDrawIndexedIndirect(command_buffer, buffer, offset, draw_count, stride);
+    }
+    else {
+        for (uint32_t i = 0; i < draw_count; ++i) {
+            vkCmdDrawIndexedIndirect(command_buffer, buffer, offset + (VkDeviceSize)i * stride, 1, stride);
+        }
+    }
+}
+
+void vkal_draw_indirect_count(VkCommandBuffer command_buffer, VkPipeline pipeline,
+    VkBuffer buffer, VkDeviceSize offset, VkBuffer count_buffer, VkDeviceSize count_offset,
+    uint32_t max_draw_count, uint32_t stride)
+{
+    assert(vkal_info.draw_indirect_count && "vkal_draw_indirect_count: features12.drawIndirectCount is not enabled!");
+    stride = stride ? stride : sizeof(VkDrawIndirectCommand);
+    bind_default_vertex_buffers(command_buffer, pipeline, 0);
+    vkCmdDrawIndirectCount(command_buffer, buffer, offset, count_buffer, count_offset, max_draw_count, stride);
+}
+
+void vkal_draw_indexed_indirect_count(VkCommandBuffer command_buffer, VkPipeline pipeline,
+    VkBuffer buffer, VkDeviceSize offset, VkBuffer count_buffer, VkDeviceSize count_offset,
+    uint32_t max_draw_count, uint32_t stride)
+{
+    assert(vkal_info.draw_indirect_count && "vkal_draw_indexed_indirect_count: features12.drawIndirectCount is not enabled!");
+    stride = stride ? stride : sizeof(VkDrawIndexedIndirectCommand);
+    bind_default_vertex_buffers(command_buffer, pipeline, 1);
+    vkCmdDrawIndexedIndirectCount(command_buffer, buffer, offset, count_buffer, count_offset, max_draw_count, stride);
 }
 
 void vkal_draw_indexed2(
@@ -2861,7 +4839,7 @@ void vkal_draw_indexed2(
     VkDeviceSize index_buffer_offset, uint32_t index_count,
     VkDeviceSize vertex_buffer_offset)
 {
-    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+    bind_pipeline(command_buffer, pipeline);
     
     VkViewport viewport = { 0 };
     viewport.x = 0.f;
@@ -2870,242 +4848,1918 @@ void vkal_draw_indexed2(
     viewport.height = (float)vkal_info.swapchain_extent.height; // (float)vp_height;
     viewport.minDepth = 0.f;
     viewport.maxDepth = 1.f;
-    vkCmdSetViewport(command_buffer, 0, 1, &viewport);
+    set_viewport(command_buffer, viewport);
     
     VkRect2D scissor = { 0 };
     scissor.offset = (VkOffset2D){ 0,0 };
     scissor.extent = vkal_info.swapchain_extent;
-    vkCmdSetScissor(command_buffer, 0, 1, &scissor);
+    set_scissor(command_buffer, scissor);
     
-    vkCmdBindIndexBuffer(command_buffer,
-			 vkal_info.default_index_buffer.buffer, index_buffer_offset, vkal_index_size);
-    uint64_t vertex_buffer_offsets[1];
-    vertex_buffer_offsets[0] = vertex_buffer_offset;
-    VkBuffer vertex_buffers[1];
-    vertex_buffers[0] = vkal_info.default_vertex_buffer.buffer;
-    vkCmdBindVertexBuffers(command_buffer, 0, 1, vertex_buffers, vertex_buffer_offsets);
+    bind_index_buffer(command_buffer, vkal_info.default_index_buffer.buffer, index_buffer_offset, vkal_index_type);
+    bind_vertex_buffer(command_buffer, vkal_info.default_vertex_buffer.buffer, vertex_buffer_offset);
     vkCmdDrawIndexed(command_buffer, index_count, 1, 0, 0, 0);
 }
 
-uint32_t vkal_get_image(void)
+static uint64_t time_now_ns(void)
 {
-    vkWaitForFences(vkal_info.device, 1, &vkal_info.in_flight_fences[vkal_info.frames_rendered], VK_TRUE, UINT64_MAX);
-    vkResetFences(vkal_info.device, 1, &vkal_info.in_flight_fences[vkal_info.frames_rendered]);
-    
-    uint32_t image_index;
-    // don't actually wait for the semaphore here. just associate it with this operation.
-    // check when needed during vkQueueSubmit
-    VkResult result = vkAcquireNextImageKHR(vkal_info.device,
-					    vkal_info.swapchain,
-					    UINT64_MAX, vkal_info.image_available_semaphores[vkal_info.frames_rendered],
-					    VK_NULL_HANDLE, &image_index);
-    
-    if (result == VK_ERROR_OUT_OF_DATE_KHR) {
-        vkal_info.should_recreate_swapchain = 0;
-        recreate_swapchain();
-        return 666; // TODO: return -1 here. This image is useless when too old. User has to check for this!
-    }
-    else {
-        // TODO
-    }
+#if defined (_WIN32)
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (uint64_t)((double)counter.QuadPart * 1e9 / (double)frequency.QuadPart);
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+#endif
+}
+
+static void sleep_ns(uint64_t duration)
+{
+#if defined (_WIN32)
+    /* Sleep alone overshoots by up to a scheduler tick (~15.6ms). A high resolution waitable timer
+       (Windows 10 1803+) wakes up within a fraction of a millisecond. Lives until the process exits. */
+    static HANDLE timer = NULL;
+    static int timer_created = 0;
+    if (!timer_created) {
+        timer = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+        timer_created = 1;
+    }
+    if (timer) {
+        LARGE_INTEGER due_time;
+        due_time.QuadPart = -(LONGLONG)(duration / 100); // Relative, in 100ns units.
+        if (SetWaitableTimer(timer, &due_time, 0, NULL, NULL, FALSE)) {
+            WaitForSingleObject(timer, INFINITE);
+            return;
+        }
+    }
+    // Older systems: Raise the timer resolution to 1ms while sleeping.
+    timeBeginPeriod(1);
+    Sleep((DWORD)(duration / 1000000));
+    timeEndPeriod(1);
+#else
+    struct timespec request;
+    request.tv_sec = (time_t)(duration / 1000000000ull);
+    request.tv_nsec = (long)(duration % 1000000000ull);
+    nanosleep(&request, NULL);
+#endif
+}
+
+static double elapsed_ms(uint64_t start_ns)
+{
+    return (double)(time_now_ns() - start_ns) / 1000000.0;
+}
+
+/* Moves the stats of the frame that was just presented into the history. */
+static void end_frame_stats(void)
+{
+    uint64_t now = time_now_ns();
+    VkalFrameStats * stats = &vkal_info.frame_stats;
+    stats->frame_ms = vkal_info.frame_stats_end_ns ? (double)(now - vkal_info.frame_stats_end_ns) / 1000000.0 : 0.0;
+    vkal_info.frame_stats_end_ns = now;
+
+    vkal_info.frame_stats_history[vkal_info.frame_stats_head] = *stats;
+    vkal_info.frame_stats_head = (vkal_info.frame_stats_head + 1) % VKAL_FRAME_STATS_HISTORY;
+    if (vkal_info.frame_stats_count < VKAL_FRAME_STATS_HISTORY) {
+        vkal_info.frame_stats_count++;
+    }
+    uint64_t frame = stats->frame;
+    memset(stats, 0, sizeof(VkalFrameStats));
+    stats->frame = frame + 1;
+}
+
+int vkal_get_frame_stats(VkalFrameStats * out_stats)
+{
+    if (!vkal_info.frame_stats_count) {
+        memset(out_stats, 0, sizeof(VkalFrameStats));
+        return 0;
+    }
+    uint32_t latest = (vkal_info.frame_stats_head + VKAL_FRAME_STATS_HISTORY - 1) % VKAL_FRAME_STATS_HISTORY;
+    *out_stats = vkal_info.frame_stats_history[latest];
+    return 1;
+}
+
+uint32_t vkal_get_frame_stats_history(VkalFrameStats * out_stats, uint32_t max_count)
+{
+    uint32_t count = max_count < vkal_info.frame_stats_count ? max_count : vkal_info.frame_stats_count;
+    uint32_t first = (vkal_info.frame_stats_head + VKAL_FRAME_STATS_HISTORY - count) % VKAL_FRAME_STATS_HISTORY;
+    for (uint32_t i = 0; i < count; ++i) {
+        out_stats[i] = vkal_info.frame_stats_history[(first + i) % VKAL_FRAME_STATS_HISTORY];
+    }
+    return count;
+}
+
+void vkal_set_frame_limit(double frames_per_second)
+{
+    vkal_info.frame_limit_period_ns = frames_per_second > 0.0 ? (uint64_t)(1e9 / frames_per_second) : 0;
+    vkal_info.frame_limit_next_ns = 0;
+}
+
+/* Sleeping alone overshoots by up to a scheduler tick, so the last VKAL_FRAME_LIMITER_SPIN_NS are spent spinning. */
+static void limit_frame_rate(void)
+{
+    if (!vkal_info.frame_limit_period_ns) {
+        return;
+    }
+
+    uint64_t now = time_now_ns();
+    uint64_t target = vkal_info.frame_limit_next_ns;
+    if (target > now) {
+        if (target - now > VKAL_FRAME_LIMITER_SPIN_NS) {
+            sleep_ns(target - now - VKAL_FRAME_LIMITER_SPIN_NS);
+        }
+        while ((now = time_now_ns()) < target) {
+        }
+    }
+    else {
+        // First frame, or we fell behind: pace from here rather than trying to catch up.
+        target = now;
+    }
+    vkal_info.frame_limit_next_ns = target + vkal_info.frame_limit_period_ns;
+}
+
+static void wait_frame(uint32_t frame)
+{
+    if (vkal_info.timeline_enabled) {
+        vkal_wait_value(vkal_info.frame_values[frame]);
+    }
+    else {
+        vkWaitForFences(vkal_info.device, 1, &vkal_info.in_flight_fences[frame], VK_TRUE, UINT64_MAX);
+    }
+}
+
+/* Also waits for the frame that last used the image, as the default command buffers and framebuffers are per image. */
+static void wait_image_in_flight(uint32_t image_index)
+{
+    vkal_info.acquired_image = image_index;
+    if (vkal_info.timeline_enabled) {
+        vkal_wait_value(vkal_info.image_values[image_index]); // Set by vkal_queue_submit.
+        return;
+    }
+    VkFence fence = vkal_info.images_in_flight[image_index];
+    if (fence != VK_NULL_HANDLE && fence != vkal_info.in_flight_fences[vkal_info.frames_rendered]) {
+        vkWaitForFences(vkal_info.device, 1, &fence, VK_TRUE, UINT64_MAX);
+    }
+    vkal_info.images_in_flight[image_index] = vkal_info.in_flight_fences[vkal_info.frames_rendered];
+}
+
+uint32_t vkal_get_image(void)
+{
+    // Pace before the frame starts, not before it is presented: The app samples input after this and the
+    // rendered frame does not sit on its swapchain image.
+    limit_frame_rate();
+
+    // The fence is reset right before the submit that signals it again. Resetting it here would leave it
+    // unsignaled forever if the frame never gets submitted, e.g. when the swapchain is out of date.
+    uint64_t wait_start = time_now_ns();
+    wait_frame(vkal_info.frames_rendered);
+    if (vkal_info.latency_mode == VKAL_LATENCY_MODE_LOW && vkal_info.frames_in_flight > 1) {
+        wait_frame((vkal_info.frames_rendered + vkal_info.frames_in_flight - 1) % vkal_info.frames_in_flight);
+    }
+    vkal_info.frame_stats.fence_wait_ms += elapsed_ms(wait_start);
+
+    resolve_gpu_profile(vkal_info.frames_rendered);
+
+    // The GPU is done with this frame's uniform slice and transient region.
+    vkal_info.uniform_ring_head = vkal_info.uniform_ring_base + vkal_info.frames_rendered * vkal_info.uniform_ring_slice;
+    vkal_info.transient_head = vkal_info.frames_rendered * vkal_info.transient_region_size;
+    vkal_info.transient_flushed = vkal_info.transient_head;
+    for (uint32_t i = 0; i < vkal_get_worker_count(); ++i) {
+        frame_command_pool_reset(&vkal_info.thread_command_pools[vkal_info.frames_rendered][i]);
+    }
+    frame_command_pool_reset(&vkal_info.oneshot_command_pools[vkal_info.frames_rendered][VK_COMMAND_BUFFER_LEVEL_PRIMARY]);
+    frame_command_pool_reset(&vkal_info.oneshot_command_pools[vkal_info.frames_rendered][VK_COMMAND_BUFFER_LEVEL_SECONDARY]);
+    retire_swapchains(0);
+
+    if (vkal_info.headless) {
+        // There is nothing to acquire. Just hand out the offscreen images round robin.
+        uint32_t image_index = vkal_info.frames_rendered % vkal_info.swapchain_image_count;
+        wait_start = time_now_ns();
+        wait_image_in_flight(image_index);
+        vkal_info.frame_stats.fence_wait_ms += elapsed_ms(wait_start);
+        return image_index;
+    }
+    
+    uint32_t image_index;
+    // don't actually wait for the semaphore here. just associate it with this operation.
+    // check when needed during vkQueueSubmit
+    uint64_t acquire_start = time_now_ns();
+    VkResult result = vkAcquireNextImageKHR(vkal_info.device,
+					    vkal_info.swapchain,
+					    UINT64_MAX, vkal_info.image_available_semaphores[vkal_info.frames_rendered],
+					    VK_NULL_HANDLE, &image_index);
+    vkal_info.frame_stats.acquire_ms += elapsed_ms(acquire_start);
+    
+    if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+        // Nothing was acquired, so the semaphore stays unsignaled and can be used again.
+        vkal_info.should_recreate_swapchain = 0;
+        recreate_swapchain();
+        return VKAL_INVALID_IMAGE;
+    }
+    else if (result == VK_SUBOPTIMAL_KHR) {
+        // The image can still be presented. Recreate afterwards.
+        vkal_info.should_recreate_swapchain = 1;
+    }
+    else if (result != VK_SUCCESS) {
+        printf("[VKAL] vkAcquireNextImageKHR failed: %d\n", result);
+        return VKAL_INVALID_IMAGE;
+    }
+    wait_start = time_now_ns();
+    wait_image_in_flight(image_index);
+    vkal_info.frame_stats.fence_wait_ms += elapsed_ms(wait_start);
     
     return image_index;
 }
 
-void vkal_queue_submit(VkCommandBuffer * command_buffers, uint32_t command_buffer_count)
+void vkal_queue_submit(VkCommandBuffer * command_buffers, uint32_t command_buffer_count)
+{
+    uint64_t submit_start = time_now_ns();
+    // Uploads and uniform writes issued while recording this frame must land before it executes.
+    vkal_flush_uniforms();
+    vkal_flush_transient();
+    vkal_flush_uploads();
+
+    VkSubmitInfo submit_info = { 0 };
+    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    VkSemaphore wait_semaphores[2];
+    VkPipelineStageFlags wait_stages[2];
+    uint32_t wait_count = 0;
+    if (!vkal_info.headless) {
+        wait_semaphores[wait_count] = vkal_info.image_available_semaphores[vkal_info.frames_rendered]; // wait until image is available from swapchain ringbuffer
+        wait_stages[wait_count++] = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    }
+    if (vkal_info.compute_pending[vkal_info.frames_rendered]) {
+        wait_semaphores[wait_count] = vkal_info.compute_finished_semaphores[vkal_info.frames_rendered];
+        wait_stages[wait_count++] = vkal_info.compute_wait_stages[vkal_info.frames_rendered];
+        vkal_info.compute_pending[vkal_info.frames_rendered] = 0;
+    }
+    submit_info.waitSemaphoreCount = wait_count;
+    submit_info.pWaitSemaphores = wait_semaphores;
+    submit_info.pWaitDstStageMask = wait_stages;
+    submit_info.commandBufferCount = command_buffer_count;
+    submit_info.pCommandBuffers = command_buffers;
+    VkSemaphore signal_semaphores[1];
+    signal_semaphores[0] = vkal_info.render_finished_semaphores[vkal_info.frames_rendered];
+    submit_info.signalSemaphoreCount = 1;
+    submit_info.pSignalSemaphores = signal_semaphores;
+    if (vkal_info.headless) {
+        // No present to signal.
+        submit_info.signalSemaphoreCount = 0;
+    }
+    if (vkal_info.timeline_enabled) {
+        uint64_t value = submit_to_queue(vkal_info.graphics_queue, &submit_info, VK_NULL_HANDLE);
+        vkal_info.frame_values[vkal_info.frames_rendered] = value;
+        vkal_info.image_values[vkal_info.acquired_image] = value;
+    }
+    else {
+        vkResetFences(vkal_info.device, 1, &vkal_info.in_flight_fences[vkal_info.frames_rendered]);
+        submit_to_queue(vkal_info.graphics_queue, &submit_info, vkal_info.in_flight_fences[vkal_info.frames_rendered]);
+    }
+    vkal_info.frame_stats.submit_ms += elapsed_ms(submit_start);
+}
+
+void vkal_present(uint32_t image_id)
+{
+    if (vkal_info.headless) {
+        end_frame_stats();
+        vkal_info.frames_rendered = (vkal_info.frames_rendered+1) % vkal_info.frames_in_flight;
+        return;
+    }
+
+    uint64_t present_start = time_now_ns();
+    VkPresentInfoKHR present_info = { 0 };
+    present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+    present_info.waitSemaphoreCount = 1;
+    VkSemaphore wait_semaphores[1];
+    wait_semaphores[0] = vkal_info.render_finished_semaphores[vkal_info.frames_rendered];
+    present_info.pWaitSemaphores = wait_semaphores;
+    VkSwapchainKHR swap_chains[1];
+    swap_chains[0] = vkal_info.swapchain;
+    present_info.swapchainCount = 1;
+    present_info.pSwapchains = swap_chains;
+    present_info.pImageIndices = &image_id;
+    VkResult result = vkQueuePresentKHR(vkal_info.present_queue, &present_info);
+    
+    // The frame was submitted either way, so move on to the next frame in flight instead of
+    // waiting for this one.
+    if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || vkal_info.should_recreate_swapchain) {
+		vkal_info.should_recreate_swapchain = 0;
+		recreate_swapchain();
+    }
+    vkal_info.frame_stats.present_ms += elapsed_ms(present_start);
+    end_frame_stats();
+    
+    vkal_info.frames_rendered = (vkal_info.frames_rendered+1) % vkal_info.frames_in_flight;
+}
+
+void create_compute_resources(void)
+{
+    VkCommandPoolCreateInfo cmdpool_info = { 0 };
+    cmdpool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    cmdpool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    cmdpool_info.queueFamilyIndex = vkal_info.compute_family;
+    VkResult result = vkCreateCommandPool(vkal_info.device, &cmdpool_info, 0, &vkal_info.compute_command_pool);
+    VKAL_ASSERT(result && "failed to create compute command pool!");
+
+    VkCommandBufferAllocateInfo allocate_info = { 0 };
+    allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocate_info.commandBufferCount = VKAL_MAX_IMAGES_IN_FLIGHT;
+    allocate_info.commandPool = vkal_info.compute_command_pool;
+    allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    result = vkAllocateCommandBuffers(vkal_info.device, &allocate_info, vkal_info.compute_command_buffers);
+    VKAL_ASSERT(result && "failed to allocate compute command buffers!");
+
+    VkSemaphoreCreateInfo semaphore_info = { 0 };
+    semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    for (uint32_t i = 0; i < VKAL_MAX_IMAGES_IN_FLIGHT; ++i) {
+        result = vkCreateSemaphore(vkal_info.device, &semaphore_info, 0, &vkal_info.compute_finished_semaphores[i]);
+        VKAL_ASSERT(result && "failed to create compute semaphore!");
+        result = vkCreateSemaphore(vkal_info.device, &semaphore_info, 0, &vkal_info.compute_graphics_semaphores[i]);
+        VKAL_ASSERT(result && "failed to create compute wait semaphore!");
+        vkal_info.compute_pending[i] = 0;
+    }
+}
+
+void destroy_compute_resources(void)
+{
+    for (uint32_t i = 0; i < VKAL_MAX_IMAGES_IN_FLIGHT; ++i) {
+        vkDestroySemaphore(vkal_info.device, vkal_info.compute_finished_semaphores[i], NULL);
+        vkDestroySemaphore(vkal_info.device, vkal_info.compute_graphics_semaphores[i], NULL);
+    }
+    vkDestroyCommandPool(vkal_info.device, vkal_info.compute_command_pool, 0);
+}
+
+void create_frame_command_pools(void)
+{
+    for (uint32_t frame = 0; frame < VKAL_MAX_IMAGES_IN_FLIGHT; ++frame) {
+        for (uint32_t i = 0; i < vkal_get_worker_count(); ++i) {
+            frame_command_pool_init(&vkal_info.thread_command_pools[frame][i], VK_COMMAND_BUFFER_LEVEL_SECONDARY);
+        }
+        frame_command_pool_init(&vkal_info.oneshot_command_pools[frame][VK_COMMAND_BUFFER_LEVEL_PRIMARY], VK_COMMAND_BUFFER_LEVEL_PRIMARY);
+        frame_command_pool_init(&vkal_info.oneshot_command_pools[frame][VK_COMMAND_BUFFER_LEVEL_SECONDARY], VK_COMMAND_BUFFER_LEVEL_SECONDARY);
+    }
+}
+
+void destroy_frame_command_pools(void)
+{
+    for (uint32_t frame = 0; frame < VKAL_MAX_IMAGES_IN_FLIGHT; ++frame) {
+        for (uint32_t i = 0; i < VKAL_MAX_WORKER_THREADS; ++i) {
+            frame_command_pool_destroy(&vkal_info.thread_command_pools[frame][i]);
+        }
+        frame_command_pool_destroy(&vkal_info.oneshot_command_pools[frame][VK_COMMAND_BUFFER_LEVEL_PRIMARY]);
+        frame_command_pool_destroy(&vkal_info.oneshot_command_pools[frame][VK_COMMAND_BUFFER_LEVEL_SECONDARY]);
+    }
+}
+
+VkCommandBuffer vkal_begin_secondary(uint32_t worker_index, VkRenderPass render_pass, uint32_t subpass, VkFramebuffer framebuffer)
+{
+    assert(worker_index < vkal_get_worker_count() && "vkal_begin_secondary: invalid worker index!");
+    VkCommandBuffer command_buffer = frame_command_pool_acquire(&vkal_info.thread_command_pools[vkal_info.frames_rendered][worker_index]);
+
+    VkCommandBufferInheritanceInfo inheritance_info = { 0 };
+    inheritance_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    inheritance_info.renderPass = render_pass;
+    inheritance_info.subpass = subpass;
+    inheritance_info.framebuffer = framebuffer;
+    inherit_queries(&inheritance_info);
+    VkCommandBufferBeginInfo begin_info = { 0 };
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+    begin_info.pInheritanceInfo = &inheritance_info;
+    VkResult result = vkBeginCommandBuffer(command_buffer, &begin_info);
+    VKAL_ASSERT(result && "failed to begin secondary command buffer!");
+    vkal_invalidate_bind_state(command_buffer);
+    return command_buffer;
+}
+
+static void record_chunk_job(void * data, uint32_t worker_index)
+{
+    VkalRecordChunk * chunk = (VkalRecordChunk*)data;
+    VkCommandBuffer command_buffer = vkal_begin_secondary(worker_index, chunk->render_pass, chunk->subpass, chunk->framebuffer);
+    // Dynamic state is not inherited from the primary command buffer.
+    vkal_viewport(command_buffer, 0, 0, (float)chunk->extent.width, (float)chunk->extent.height);
+    vkal_scissor(command_buffer, 0, 0, (float)chunk->extent.width, (float)chunk->extent.height);
+    chunk->record(command_buffer, chunk->first, chunk->count, chunk->user_data);
+    VkResult result = vkEndCommandBuffer(command_buffer);
+    VKAL_ASSERT(result && "failed to end secondary command buffer!");
+    chunk->command_buffer = command_buffer;
+}
+
+void vkal_record_parallel(uint32_t image_id, uint32_t item_count, VkalRecordFunction record, void * user_data)
+{
+    vkal_record_parallel2(vkal_info.default_command_buffers[image_id], vkal_info.render_pass, 0,
+                          vkal_info.framebuffers[image_id], vkal_info.swapchain_extent, item_count, record, user_data);
+}
+
+void vkal_record_parallel2(VkCommandBuffer command_buffer, VkRenderPass render_pass, uint32_t subpass, VkFramebuffer framebuffer,
+                           VkExtent2D extent, uint32_t item_count, VkalRecordFunction record, void * user_data)
+{
+    if (!item_count) {
+        return;
+    }
+    uint32_t chunk_count = vkal_get_worker_count();
+    if (chunk_count > item_count) {
+        chunk_count = item_count;
+    }
+    VkalRecordChunk chunks[VKAL_MAX_WORKER_THREADS];
+    VkalJobGroup group = { 0 };
+    uint32_t first = 0;
+    for (uint32_t i = 0; i < chunk_count; ++i) {
+        uint32_t count = item_count / chunk_count + (i < item_count % chunk_count ? 1 : 0);
+        chunks[i].render_pass = render_pass;
+        chunks[i].subpass = subpass;
+        chunks[i].framebuffer = framebuffer;
+        chunks[i].extent = extent;
+        chunks[i].first = first;
+        chunks[i].count = count;
+        chunks[i].record = record;
+        chunks[i].user_data = user_data;
+        chunks[i].command_buffer = VK_NULL_HANDLE;
+        vkal_submit_job(&group, record_chunk_job, &chunks[i]);
+        first += count;
+    }
+    vkal_wait_job_group(&group);
+
+    VkCommandBuffer command_buffers[VKAL_MAX_WORKER_THREADS];
+    for (uint32_t i = 0; i < chunk_count; ++i) {
+        command_buffers[i] = chunks[i].command_buffer;
+    }
+    vkCmdExecuteCommands(command_buffer, chunk_count, command_buffers);
+    // Executing secondaries leaves the state of the primary undefined.
+    vkal_invalidate_bind_state(command_buffer);
+}
+
+/* The compute command buffer of a frame is reused once vkal_get_image has waited for that frame. */
+VkCommandBuffer vkal_begin_compute(void)
+{
+    VkCommandBuffer command_buffer = vkal_info.compute_command_buffers[vkal_info.frames_rendered];
+    VkCommandBufferBeginInfo begin_info = { 0 };
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    VkResult result = vkBeginCommandBuffer(command_buffer, &begin_info);
+    VKAL_ASSERT(result && "failed to begin compute command buffer!");
+    return command_buffer;
+}
+
+void vkal_compute_submit(VkCommandBuffer command_buffer, VkPipelineStageFlags graphics_wait_stage)
+{
+    assert(!vkal_info.compute_pending[vkal_info.frames_rendered] && "vkal_compute_submit: only one compute submit per frame!");
+    VkResult result = vkEndCommandBuffer(command_buffer);
+    VKAL_ASSERT(result && "failed to end compute command buffer!");
+
+    // Compute may read what was uploaded for this frame.
+    vkal_flush_uniforms();
+    vkal_flush_transient();
+    vkal_flush_uploads();
+
+    VkSubmitInfo submit_info = { 0 };
+    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+
+    /* Waits on the GPU for everything submitted to the graphics queue so far: the uploads, which finish there,
+       and the previous frames, which may still read what this dispatch overwrites. */
+    VkPipelineStageFlags graphics_wait = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+    VkTimelineSemaphoreSubmitInfo timeline_info = { 0 };
+    uint64_t graphics_value = vkal_info.timeline_value;
+    if (vkal_info.timeline_enabled && vkal_info.compute_queue != vkal_info.graphics_queue) {
+        timeline_info.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+        timeline_info.waitSemaphoreValueCount = 1;
+        timeline_info.pWaitSemaphoreValues = &graphics_value;
+        submit_info.pNext = &timeline_info;
+        submit_info.pWaitSemaphores = &vkal_info.timeline_semaphore;
+    }
+    else {
+        // Signals after all earlier submissions to the graphics queue. Also needed if compute runs on it.
+        VkSubmitInfo signal_info = { 0 };
+        signal_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        signal_info.signalSemaphoreCount = 1;
+        signal_info.pSignalSemaphores = &vkal_info.compute_graphics_semaphores[vkal_info.frames_rendered];
+        submit_to_queue(vkal_info.graphics_queue, &signal_info, VK_NULL_HANDLE);
+        submit_info.pWaitSemaphores = &vkal_info.compute_graphics_semaphores[vkal_info.frames_rendered];
+    }
+    submit_info.waitSemaphoreCount = 1;
+    submit_info.pWaitDstStageMask = &graphics_wait;
+
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &command_buffer;
+    submit_info.signalSemaphoreCount = 1;
+    submit_info.pSignalSemaphores = &vkal_info.compute_finished_semaphores[vkal_info.frames_rendered];
+    submit_to_queue(vkal_info.compute_queue, &submit_info, VK_NULL_HANDLE);
+
+    vkal_info.compute_wait_stages[vkal_info.frames_rendered] = graphics_wait_stage;
+    vkal_info.compute_pending[vkal_info.frames_rendered] = 1;
+}
+
+/* Copies the contents of a headless image back to the host. out_pixels must be able to hold
+   width * height * 4 bytes (VKAL_HEADLESS_FORMAT). This waits until the copy has finished. */
+void vkal_read_image(uint32_t image_id, void * out_pixels)
+{
+    assert(vkal_info.headless && "vkal_read_image: only available in headless mode!");
+    assert(image_id < vkal_info.swapchain_image_count);
+
+    uint32_t width = vkal_info.swapchain_extent.width;
+    uint32_t height = vkal_info.swapchain_extent.height;
+    VkDeviceSize size = (VkDeviceSize)width * height * 4;
+
+    if (vkal_info.headless_readback_buffer.buffer == VK_NULL_HANDLE) {
+        vkal_info.headless_readback_buffer = create_buffer((uint32_t)size, VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+        VkMemoryRequirements buffer_memory_requirements = { 0 };
+        vkGetBufferMemoryRequirements(vkal_info.device, vkal_info.headless_readback_buffer.buffer, &buffer_memory_requirements);
+        uint32_t mem_type_index = check_memory_type_index(buffer_memory_requirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+        vkal_info.device_memory_headless_readback = allocate_memory(buffer_memory_requirements.size, mem_type_index, VKAL_MEMORY_CATEGORY_STAGING);
+        VkResult result = vkBindBufferMemory(vkal_info.device, vkal_info.headless_readback_buffer.buffer, vkal_info.device_memory_headless_readback, 0);
+        VKAL_ASSERT(result && "failed to bind readback buffer memory!");
+    }
+
+    VkCommandBuffer cmd_buffer = vkal_create_command_buffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1);
+
+    // The default render pass leaves the image in TRANSFER_SRC_OPTIMAL. Make sure rendering is done.
+    VkImageMemoryBarrier barrier = { 0 };
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = vkal_info.swapchain_images[image_id];
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.levelCount = 1;
+    barrier.subresourceRange.layerCount = 1;
+    vkCmdPipelineBarrier(cmd_buffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         0, 0, NULL, 0, NULL, 1, &barrier);
+
+    VkBufferImageCopy copy_info = { 0 };
+    copy_info.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    copy_info.imageSubresource.layerCount = 1;
+    copy_info.imageExtent.width  = width;
+    copy_info.imageExtent.height = height;
+    copy_info.imageExtent.depth  = 1;
+    vkCmdCopyImageToBuffer(cmd_buffer, vkal_info.swapchain_images[image_id], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                           vkal_info.headless_readback_buffer.buffer, 1, &copy_info);
+    vkal_flush_command_buffer(cmd_buffer, vkal_info.graphics_queue, 1);
+
+    void * mapped = NULL;
+    VkResult result = vkMapMemory(vkal_info.device, vkal_info.device_memory_headless_readback, 0, VK_WHOLE_SIZE, 0, &mapped);
+    VKAL_ASSERT(result && "failed to map readback memory!");
+    VkMappedMemoryRange invalidate_range = { 0 };
+    invalidate_range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+    invalidate_range.memory = vkal_info.device_memory_headless_readback;
+    invalidate_range.offset = 0;
+    invalidate_range.size = VK_WHOLE_SIZE;
+    vkInvalidateMappedMemoryRanges(vkal_info.device, 1, &invalidate_range);
+    memcpy(out_pixels, mapped, size);
+    vkUnmapMemory(vkal_info.device, vkal_info.device_memory_headless_readback);
+}
+
+void create_default_semaphores(void)
+{
+    for (int i = 0; i < VKAL_MAX_IMAGES_IN_FLIGHT; ++i) {
+		VkFenceCreateInfo fenceInfo = { 0 };
+		fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+		fenceInfo.pNext = NULL;
+		fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+		VkResult result = vkCreateFence(vkal_info.device, &fenceInfo, NULL, &vkal_info.in_flight_fences[i]);
+		VKAL_ASSERT(result && "failed to create draw-fence");
+
+		VkSemaphoreCreateInfo sem_info = (VkSemaphoreCreateInfo){ 0 };
+		sem_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+		vkCreateSemaphore(vkal_info.device, &sem_info, 0, &vkal_info.image_available_semaphores[i]);
+		vkCreateSemaphore(vkal_info.device, &sem_info, 0, &vkal_info.render_finished_semaphores[i]);
+
+    }
+    for (uint32_t i = 0; i < VKAL_MAX_SWAPCHAIN_IMAGES; ++i) {
+        vkal_info.images_in_flight[i] = VK_NULL_HANDLE;
+    }
+}
+
+/* Right after the device, as vkal_init already submits work to the graphics queue. */
+void create_timeline_semaphore(void)
+{
+    vkal_info.timeline_value = 0;
+    memset(vkal_info.frame_values, 0, sizeof(vkal_info.frame_values));
+    memset(vkal_info.image_values, 0, sizeof(vkal_info.image_values));
+    if (vkal_info.timeline_enabled) {
+        VkSemaphoreTypeCreateInfo type_info = { 0 };
+        type_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+        type_info.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+        type_info.initialValue = 0;
+        VkSemaphoreCreateInfo sem_info = { 0 };
+        sem_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+        sem_info.pNext = &type_info;
+        VkResult result = vkCreateSemaphore(vkal_info.device, &sem_info, 0, &vkal_info.timeline_semaphore);
+        VKAL_ASSERT(result && "failed to create timeline semaphore!");
+    }
+}
+
+void allocate_default_device_memory_uniform(void)
+{
+    VkMemoryRequirements buffer_memory_requirements;
+    vkGetBufferMemoryRequirements(vkal_info.device, vkal_info.default_uniform_buffer.buffer, &buffer_memory_requirements);
+    uint32_t mem_type_index = check_memory_type_index(
+		buffer_memory_requirements.memoryTypeBits, 
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+	vkal_info.default_device_memory_uniform = allocate_memory(buffer_memory_requirements.size, mem_type_index, VKAL_MEMORY_CATEGORY_UNIFORM);
+    
+    VkResult result = vkBindBufferMemory(
+		vkal_info.device, vkal_info.default_uniform_buffer.buffer,
+		vkal_info.default_device_memory_uniform, 0); // the last param is the memory offset!
+    VKAL_ASSERT(result && "failed to bind uniform buffer to device memory!");
+
+    vkal_info.uniform_coherent = (vkal_info.memory_properties.memoryTypes[mem_type_index].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+    vkal_info.uniform_memory_size = buffer_memory_requirements.size;
+    result = vkMapMemory(vkal_info.device, vkal_info.default_device_memory_uniform, 0, VK_WHOLE_SIZE, 0, &vkal_info.uniform_mapped);
+    VKAL_ASSERT(result && "failed to map uniform memory!");
+    vkal_info.uniform_dirty_count = 0;
+
+    vkal_info.uniform_ring_base = UNIFORM_BUFFER_SIZE - VKAL_UNIFORM_RING_SIZE;
+    vkal_info.uniform_ring_slice = VKAL_UNIFORM_RING_SIZE / vkal_info.frames_in_flight;
+    vkal_info.uniform_ring_head = vkal_info.uniform_ring_base;
+    vkal_info.uniform_ring_range = 0;
+}
+
+void allocate_default_device_memory_vertex(void)
+{
+    VkMemoryRequirements buffer_memory_requirements;
+    vkGetBufferMemoryRequirements(vkal_info.device, vkal_info.default_vertex_buffer.buffer, &buffer_memory_requirements);
+    uint32_t mem_type_index = check_memory_type_index(buffer_memory_requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    vkal_info.default_device_memory_vertex = allocate_memory(buffer_memory_requirements.size, mem_type_index, VKAL_MEMORY_CATEGORY_VERTEX);
+    
+    VkResult result = vkBindBufferMemory(vkal_info.device, vkal_info.default_vertex_buffer.buffer, vkal_info.default_device_memory_vertex, 0);
+    VKAL_ASSERT(result && "failed to bind vertex buffer memory!");
+}
+
+void allocate_default_device_memory_index(void)
+{
+    VkMemoryRequirements buffer_memory_requirements;
+    vkGetBufferMemoryRequirements(vkal_info.device, vkal_info.default_index_buffer.buffer, &buffer_memory_requirements);
+    uint32_t mem_type_index = check_memory_type_index(buffer_memory_requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    vkal_info.default_device_memory_index = allocate_memory(buffer_memory_requirements.size, mem_type_index, VKAL_MEMORY_CATEGORY_VERTEX);
+    
+    VkResult result = vkBindBufferMemory(vkal_info.device, vkal_info.default_index_buffer.buffer, vkal_info.default_device_memory_index, 0);
+    VKAL_ASSERT(result && "failed to bind vertex buffer memory!");
+}
+
+void create_default_uniform_buffer(uint32_t size)
+{
+    vkal_info.default_uniform_buffer = create_buffer(size, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
+	VKAL_DBG_BUFFER_NAME(vkal_info.device, vkal_info.default_uniform_buffer, "Default Uniform Buffer");
+}
+
+uint32_t vkal_aligned_size(uint32_t size, uint32_t alignment)
+{
+    return (size + alignment - 1) & ~(alignment - 1);
+}
+
+/* Remembers a written range of the uniform memory, widened to nonCoherentAtomSize, for vkal_flush_uniforms. */
+static void uniform_mark_dirty(VkDeviceSize offset, VkDeviceSize size)
+{
+    if (vkal_info.uniform_coherent) {
+        return;
+    }
+    uint64_t atom = vkal_info.physical_device_properties.limits.nonCoherentAtomSize;
+    VkDeviceSize begin = offset & ~(atom - 1);
+    VkDeviceSize end = (offset + size + atom - 1) & ~(atom - 1);
+    if (end > vkal_info.uniform_memory_size) {
+        end = vkal_info.uniform_memory_size;
+    }
+
+    // Consecutive writes (e.g. the uniform ring) usually touch or extend the last range.
+    if (vkal_info.uniform_dirty_count) {
+        VkalMemoryRange * last = &vkal_info.uniform_dirty[vkal_info.uniform_dirty_count - 1];
+        if (begin <= last->offset + last->size && end >= last->offset) {
+            VkDeviceSize last_end = last->offset + last->size;
+            last->offset = begin < last->offset ? begin : last->offset;
+            last->size = (end > last_end ? end : last_end) - last->offset;
+            return;
+        }
+    }
+    if (vkal_info.uniform_dirty_count == VKAL_MAX_UNIFORM_DIRTY_RANGES) {
+        // Out of ranges: collapse everything into one covering range.
+        VkDeviceSize min_offset = begin;
+        VkDeviceSize max_end = end;
+        for (uint32_t i = 0; i < vkal_info.uniform_dirty_count; ++i) {
+            VkalMemoryRange range = vkal_info.uniform_dirty[i];
+            if (range.offset < min_offset) min_offset = range.offset;
+            if (range.offset + range.size > max_end) max_end = range.offset + range.size;
+        }
+        vkal_info.uniform_dirty[0].offset = min_offset;
+        vkal_info.uniform_dirty[0].size = max_end - min_offset;
+        vkal_info.uniform_dirty_count = 1;
+        return;
+    }
+    vkal_info.uniform_dirty[vkal_info.uniform_dirty_count].offset = begin;
+    vkal_info.uniform_dirty[vkal_info.uniform_dirty_count].size = end - begin;
+    vkal_info.uniform_dirty_count++;
+}
+
+/* Makes host writes to uniform memory visible to the device. Called by the submit functions,
+   so you only need this if you submit command buffers yourself. No-op on HOST_COHERENT memory. */
+void vkal_flush_uniforms(void)
+{
+    if (!vkal_info.uniform_dirty_count) {
+        return;
+    }
+    VkMappedMemoryRange flush_ranges[VKAL_MAX_UNIFORM_DIRTY_RANGES];
+    for (uint32_t i = 0; i < vkal_info.uniform_dirty_count; ++i) {
+        flush_ranges[i].sType  = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+        flush_ranges[i].pNext  = 0;
+        flush_ranges[i].memory = vkal_info.default_device_memory_uniform;
+        flush_ranges[i].offset = vkal_info.uniform_dirty[i].offset;
+        flush_ranges[i].size   = vkal_info.uniform_dirty[i].size;
+    }
+    VkResult result = vkFlushMappedMemoryRanges(vkal_info.device, vkal_info.uniform_dirty_count, flush_ranges);
+    VKAL_ASSERT(result && "failed to flush mapped memory range(s)!");
+    vkal_info.uniform_dirty_count = 0;
+}
+
+/* NOTE: Writes straight into the persistently mapped uniform memory. The data is flushed with the next submit.
+         Uniform buffers created by vkal_create_uniform_buffer are not multi-buffered, so updating one that
+         a frame in flight still reads is a race. Use vkal_uniform_push for data that changes every frame. */
+void vkal_update_uniform(UniformBuffer * uniform_buffer, void * data) // TODO: Does uniform_buffer really have to be a pointer?
+{
+    memcpy((uint8_t*)vkal_info.uniform_mapped + uniform_buffer->offset, data, uniform_buffer->size);
+    uniform_mark_dirty(uniform_buffer->offset, uniform_buffer->size);
+}
+
+/* 'size' is the descriptor range. Every vkal_uniform_push bound through it must be at most that large. */
+UniformBuffer vkal_create_dynamic_uniform_buffer(uint32_t size, uint32_t binding)
+{
+    assert(size <= vkal_info.uniform_ring_slice && "vkal_create_dynamic_uniform_buffer: larger than a frame's uniform ring slice!");
+    UniformBuffer uniform_buffer = { 0 };
+    uniform_buffer.offset = vkal_info.uniform_ring_base;
+    uniform_buffer.size = size;
+    uniform_buffer.binding = binding;
+    uniform_buffer.alignment = size;
+    if (size > vkal_info.uniform_ring_range) {
+        vkal_info.uniform_ring_range = size;
+    }
+    return uniform_buffer;
+}
+
+/* Copies 'data' into the current frame's slice of the uniform ring and returns its dynamic offset.
+   Must be called after vkal_get_image. */
+uint32_t vkal_uniform_push(void * data, uint32_t size)
+{
+    uint64_t alignment = vkal_info.physical_device_properties.limits.minUniformBufferOffsetAlignment;
+    uint64_t atom = vkal_info.physical_device_properties.limits.nonCoherentAtomSize;
+    if (atom > alignment) {
+        alignment = atom;
+    }
+    VkDeviceSize offset = (vkal_info.uniform_ring_head + alignment - 1) & ~(alignment - 1);
+    // The whole descriptor range starting at the dynamic offset has to stay inside this frame's slice.
+    VkDeviceSize range = size > vkal_info.uniform_ring_range ? size : vkal_info.uniform_ring_range;
+    VkDeviceSize slice_end = vkal_info.uniform_ring_base + (vkal_info.frames_rendered + 1) * vkal_info.uniform_ring_slice;
+    if (offset + range > slice_end) {
+        printf("[VKAL] vkal_uniform_push: uniform ring slice of %llu bytes is full!\n", (unsigned long long)vkal_info.uniform_ring_slice);
+        VKAL_ASSERT(VK_ERROR_OUT_OF_DEVICE_MEMORY && "vkal_uniform_push: out of uniform ring memory!");
+    }
+
+    memcpy((uint8_t*)vkal_info.uniform_mapped + offset, data, size);
+    uniform_mark_dirty(offset, size);
+    vkal_info.uniform_ring_head = offset + size;
+    return (uint32_t)(offset - vkal_info.uniform_ring_base);
+}
+
+static void mutex_init(VkalMutex * mutex)
+{
+#if defined (_WIN32)
+    InitializeCriticalSection(mutex);
+#else
+    pthread_mutex_init(mutex, NULL);
+#endif
+}
+
+static void mutex_destroy(VkalMutex * mutex)
+{
+#if defined (_WIN32)
+    DeleteCriticalSection(mutex);
+#else
+    pthread_mutex_destroy(mutex);
+#endif
+}
+
+static void mutex_lock(VkalMutex * mutex)
+{
+#if defined (_WIN32)
+    EnterCriticalSection(mutex);
+#else
+    pthread_mutex_lock(mutex);
+#endif
+}
+
+static void mutex_unlock(VkalMutex * mutex)
+{
+#if defined (_WIN32)
+    LeaveCriticalSection(mutex);
+#else
+    pthread_mutex_unlock(mutex);
+#endif
+}
+
+static void condition_init(VkalCondition * condition)
+{
+#if defined (_WIN32)
+    InitializeConditionVariable(condition);
+#else
+    pthread_cond_init(condition, NULL);
+#endif
+}
+
+static void condition_destroy(VkalCondition * condition)
+{
+#if defined (_WIN32)
+    (void)condition; // Windows condition variables need no cleanup.
+#else
+    pthread_cond_destroy(condition);
+#endif
+}
+
+static void condition_wait(VkalCondition * condition, VkalMutex * mutex)
+{
+#if defined (_WIN32)
+    SleepConditionVariableCS(condition, mutex, INFINITE);
+#else
+    pthread_cond_wait(condition, mutex);
+#endif
+}
+
+static void condition_signal(VkalCondition * condition)
+{
+#if defined (_WIN32)
+    WakeConditionVariable(condition);
+#else
+    pthread_cond_signal(condition);
+#endif
+}
+
+static void condition_broadcast(VkalCondition * condition)
+{
+#if defined (_WIN32)
+    WakeAllConditionVariable(condition);
+#else
+    pthread_cond_broadcast(condition);
+#endif
+}
+
+static uint32_t cpu_core_count(void)
+{
+#if defined (_WIN32)
+    SYSTEM_INFO system_info;
+    GetSystemInfo(&system_info);
+    return (uint32_t)system_info.dwNumberOfProcessors;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (uint32_t)count : 1;
+#endif
+}
+
+static void add_bind_stats(VkalBindStats * dst, VkalBindStats * src)
+{
+    dst->pipelines              += src->pipelines;
+    dst->pipelines_skipped      += src->pipelines_skipped;
+    dst->vertex_buffers         += src->vertex_buffers;
+    dst->vertex_buffers_skipped += src->vertex_buffers_skipped;
+    dst->index_buffers          += src->index_buffers;
+    dst->index_buffers_skipped  += src->index_buffers_skipped;
+    dst->viewports              += src->viewports;
+    dst->viewports_skipped      += src->viewports_skipped;
+    dst->scissors               += src->scissors;
+    dst->scissors_skipped       += src->scissors_skipped;
+}
+
+static void job_worker(uint32_t worker_index)
+{
+    VkalJobPool * pool = &vkal_job_pool;
+    mutex_lock(&pool->mutex);
+    for (;;) {
+        while (!pool->job_count && !pool->shutdown) {
+            condition_wait(&pool->job_available, &pool->mutex);
+        }
+        if (!pool->job_count) {
+            break; // Shutting down and nothing left to do.
+        }
+        VkalJob job = pool->jobs[pool->job_head];
+        pool->job_head = (pool->job_head + 1) % pool->job_capacity;
+        pool->job_count--;
+        mutex_unlock(&pool->mutex);
+
+        job.function(job.data, worker_index);
+
+        mutex_lock(&pool->mutex);
+        add_bind_stats(&vkal_info.bind_stats, &vkal_bind_tracker.stats);
+        memset(&vkal_bind_tracker.stats, 0, sizeof(VkalBindStats));
+        if (--job.group->pending == 0) {
+            condition_broadcast(&pool->job_finished);
+        }
+    }
+    mutex_unlock(&pool->mutex);
+}
+
+#if defined (_WIN32)
+static DWORD WINAPI job_worker_entry(LPVOID data)
+{
+    job_worker(*(uint32_t*)data);
+    return 0;
+}
+#else
+static void * job_worker_entry(void * data)
+{
+    job_worker(*(uint32_t*)data);
+    return NULL;
+}
+#endif
+
+void create_job_pool(uint32_t thread_count)
+{
+    VkalJobPool * pool = &vkal_job_pool;
+    memset(pool, 0, sizeof(VkalJobPool));
+    if (!thread_count) {
+        uint32_t cores = cpu_core_count();
+        thread_count = cores > 1 ? cores - 1 : 1;
+    }
+    if (thread_count > VKAL_MAX_WORKER_THREADS) {
+        thread_count = VKAL_MAX_WORKER_THREADS;
+    }
+    mutex_init(&pool->mutex);
+    condition_init(&pool->job_available);
+    condition_init(&pool->job_finished);
+    pool->job_capacity = 64;
+    VKAL_MALLOC(pool->jobs, pool->job_capacity);
+    assert(pool->jobs && "create_job_pool: out of memory!");
+
+    for (uint32_t i = 0; i < thread_count; ++i) {
+        pool->thread_indices[i] = i;
+#if defined (_WIN32)
+        pool->threads[i] = CreateThread(NULL, 0, job_worker_entry, &pool->thread_indices[i], 0, NULL);
+        if (!pool->threads[i]) {
+#else
+        if (pthread_create(&pool->threads[i], NULL, job_worker_entry, &pool->thread_indices[i])) {
+#endif
+            printf("[VKAL] failed to start worker thread %u!\n", i);
+            break;
+        }
+        pool->thread_count++;
+    }
+    assert(pool->thread_count && "create_job_pool: no worker threads!");
+}
+
+/* Lets the workers finish what is queued, then joins them. */
+void destroy_job_pool(void)
+{
+    VkalJobPool * pool = &vkal_job_pool;
+    mutex_lock(&pool->mutex);
+    pool->shutdown = 1;
+    condition_broadcast(&pool->job_available);
+    mutex_unlock(&pool->mutex);
+    for (uint32_t i = 0; i < pool->thread_count; ++i) {
+#if defined (_WIN32)
+        WaitForSingleObject(pool->threads[i], INFINITE);
+        CloseHandle(pool->threads[i]);
+#else
+        pthread_join(pool->threads[i], NULL);
+#endif
+    }
+    condition_destroy(&pool->job_available);
+    condition_destroy(&pool->job_finished);
+    mutex_destroy(&pool->mutex);
+    VKAL_FREE(pool->jobs);
+    memset(pool, 0, sizeof(VkalJobPool));
+}
+
+uint32_t vkal_get_worker_count(void)
+{
+    return vkal_job_pool.thread_count;
+}
+
+void vkal_submit_job(VkalJobGroup * group, VkalJobFunction function, void * data)
+{
+    VkalJobPool * pool = &vkal_job_pool;
+    mutex_lock(&pool->mutex);
+    if (pool->job_count == pool->job_capacity) {
+        // Unroll the ring into the front of the bigger array.
+        VkalJob * jobs;
+        VKAL_MALLOC(jobs, 2 * pool->job_capacity);
+        assert(jobs && "vkal_submit_job: out of memory!");
+        for (uint32_t i = 0; i < pool->job_count; ++i) {
+            jobs[i] = pool->jobs[(pool->job_head + i) % pool->job_capacity];
+        }
+        VKAL_FREE(pool->jobs);
+        pool->jobs = jobs;
+        pool->job_capacity *= 2;
+        pool->job_head = 0;
+    }
+    VkalJob * job = &pool->jobs[(pool->job_head + pool->job_count) % pool->job_capacity];
+    job->function = function;
+    job->data = data;
+    job->group = group;
+    pool->job_count++;
+    group->pending++;
+    condition_signal(&pool->job_available);
+    mutex_unlock(&pool->mutex);
+}
+
+int vkal_job_group_done(VkalJobGroup * group)
+{
+    mutex_lock(&vkal_job_pool.mutex);
+    int done = group->pending == 0;
+    mutex_unlock(&vkal_job_pool.mutex);
+    return done;
+}
+
+void vkal_wait_job_group(VkalJobGroup * group)
+{
+    mutex_lock(&vkal_job_pool.mutex);
+    while (group->pending) {
+        condition_wait(&vkal_job_pool.job_finished, &vkal_job_pool.mutex);
+    }
+    mutex_unlock(&vkal_job_pool.mutex);
+}
+
+void vkal_get_bind_stats(VkalBindStats * out_stats)
+{
+    mutex_lock(&vkal_job_pool.mutex);
+    add_bind_stats(&vkal_info.bind_stats, &vkal_bind_tracker.stats);
+    *out_stats = vkal_info.bind_stats;
+    mutex_unlock(&vkal_job_pool.mutex);
+    memset(&vkal_bind_tracker.stats, 0, sizeof(VkalBindStats));
+}
+
+void vkal_reset_bind_stats(void)
+{
+    mutex_lock(&vkal_job_pool.mutex);
+    memset(&vkal_info.bind_stats, 0, sizeof(VkalBindStats));
+    mutex_unlock(&vkal_job_pool.mutex);
+    memset(&vkal_bind_tracker.stats, 0, sizeof(VkalBindStats));
+}
+
+#define VKAL_TIMESTAMP_QUERY_COUNT      (2 * VKAL_MAX_GPU_SCOPES)
+#define VKAL_OCCLUSION_QUERY_COUNT      (VKAL_MAX_STATISTICS_SCOPES + VKAL_MAX_OCCLUSION_QUERIES)
+
+/* Statistics in the order vkGetQueryPoolResults writes them. */
+#define VKAL_PIPELINE_STATISTICS_FLAGS  (VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT |          \
+                                         VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT |        \
+                                         VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |        \
+                                         VK_QUERY_PIPELINE_STATISTIC_CLIPPING_INVOCATIONS_BIT |             \
+                                         VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT |              \
+                                         VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT |      \
+                                         VK_QUERY_PIPELINE_STATISTIC_COMPUTE_SHADER_INVOCATIONS_BIT)
+#define VKAL_PIPELINE_STATISTICS_COUNT  7
+
+/* Lets secondaries run inside statistics scopes and occlusion queries of their primary. Needs inheritedQueries. */
+static void inherit_queries(VkCommandBufferInheritanceInfo * inheritance_info)
+{
+    if (!vkal_info.inherited_queries) {
+        return;
+    }
+    inheritance_info->occlusionQueryEnable = VK_TRUE;
+    inheritance_info->queryFlags = vkal_info.occlusion_query_precise ? VK_QUERY_CONTROL_PRECISE_BIT : 0;
+    inheritance_info->pipelineStatistics = vkal_info.pipeline_statistics_supported ? VKAL_PIPELINE_STATISTICS_FLAGS : 0;
+}
+
+static VkQueryPool create_query_pool(VkQueryType type, uint32_t count, VkQueryPipelineStatisticFlags statistics)
+{
+    VkQueryPoolCreateInfo pool_info = { 0 };
+    pool_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    pool_info.queryType = type;
+    pool_info.queryCount = count;
+    pool_info.pipelineStatistics = statistics;
+    VkQueryPool pool;
+    VkResult result = vkCreateQueryPool(vkal_info.device, &pool_info, 0, &pool);
+    VKAL_ASSERT(result && "failed to create query pool!");
+    if (vkal_info.host_query_reset) {
+        vkResetQueryPool(vkal_info.device, pool, 0, count);
+    }
+    return pool;
+}
+
+void create_gpu_profiler(void)
+{
+    mutex_init(&vkal_gpu_profiler.mutex);
+    memset(&vkal_info.gpu_profile, 0, sizeof(VkalGpuProfile));
+    memset(vkal_gpu_profiler.occlusion_valid, 0, sizeof(vkal_gpu_profiler.occlusion_valid));
+
+    uint32_t queue_family_count = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(vkal_info.physical_device, &queue_family_count, 0);
+    VkQueueFamilyProperties * queue_families;
+    VKAL_MALLOC(queue_families, queue_family_count);
+    vkGetPhysicalDeviceQueueFamilyProperties(vkal_info.physical_device, &queue_family_count, queue_families);
+    uint32_t valid_bits = queue_families[vkal_info.graphics_family].timestampValidBits;
+    VKAL_FREE(queue_families);
+
+    vkal_info.timestamps_supported = valid_bits > 0 && vkal_info.physical_device_properties.limits.timestampPeriod > 0.0f;
+    vkal_info.timestamp_mask = valid_bits >= 64 ? UINT64_MAX : ((uint64_t)1 << valid_bits) - 1;
+    if (!vkal_info.timestamps_supported) {
+        printf("[VKAL] graphics queue does not support timestamps. GPU scopes are disabled.\n");
+    }
+    if (!vkal_info.pipeline_statistics_supported) {
+        printf("[VKAL] pipelineStatisticsQuery not supported. Statistics scopes only count samples.\n");
+    }
+
+    for (uint32_t i = 0; i < vkal_info.frames_in_flight; ++i) {
+        VkalGpuProfilerFrame * frame = &vkal_gpu_profiler.frames[i];
+        if (vkal_info.timestamps_supported) {
+            frame->pool = create_query_pool(VK_QUERY_TYPE_TIMESTAMP, VKAL_TIMESTAMP_QUERY_COUNT, 0);
+        }
+        if (vkal_info.pipeline_statistics_supported) {
+            frame->statistics_pool = create_query_pool(VK_QUERY_TYPE_PIPELINE_STATISTICS, VKAL_MAX_STATISTICS_SCOPES, VKAL_PIPELINE_STATISTICS_FLAGS);
+        }
+        frame->occlusion_pool = create_query_pool(VK_QUERY_TYPE_OCCLUSION, VKAL_OCCLUSION_QUERY_COUNT, 0);
+        frame->needs_reset = !vkal_info.host_query_reset;
+        frame->scope_count = 0;
+        frame->open_count = 0;
+        frame->statistics_count = 0;
+        memset(frame->occlusion_written, 0, sizeof(frame->occlusion_written));
+    }
+}
+
+void destroy_gpu_profiler(void)
+{
+    for (uint32_t i = 0; i < VKAL_MAX_IMAGES_IN_FLIGHT; ++i) {
+        VkalGpuProfilerFrame * frame = &vkal_gpu_profiler.frames[i];
+        if (frame->pool != VK_NULL_HANDLE) {
+            vkDestroyQueryPool(vkal_info.device, frame->pool, 0);
+            frame->pool = VK_NULL_HANDLE;
+        }
+        if (frame->statistics_pool != VK_NULL_HANDLE) {
+            vkDestroyQueryPool(vkal_info.device, frame->statistics_pool, 0);
+            frame->statistics_pool = VK_NULL_HANDLE;
+        }
+        if (frame->occlusion_pool != VK_NULL_HANDLE) {
+            vkDestroyQueryPool(vkal_info.device, frame->occlusion_pool, 0);
+            frame->occlusion_pool = VK_NULL_HANDLE;
+        }
+    }
+    mutex_destroy(&vkal_gpu_profiler.mutex);
+}
+
+static void reset_gpu_profiler_pool(VkCommandBuffer command_buffer)
+{
+    mutex_lock(&vkal_gpu_profiler.mutex);
+    VkalGpuProfilerFrame * frame = &vkal_gpu_profiler.frames[vkal_info.frames_rendered];
+    if (frame->needs_reset) {
+        if (frame->pool != VK_NULL_HANDLE) {
+            vkCmdResetQueryPool(command_buffer, frame->pool, 0, VKAL_TIMESTAMP_QUERY_COUNT);
+        }
+        if (frame->statistics_pool != VK_NULL_HANDLE) {
+            vkCmdResetQueryPool(command_buffer, frame->statistics_pool, 0, VKAL_MAX_STATISTICS_SCOPES);
+        }
+        vkCmdResetQueryPool(command_buffer, frame->occlusion_pool, 0, VKAL_OCCLUSION_QUERY_COUNT);
+        frame->needs_reset = 0;
+    }
+    mutex_unlock(&vkal_gpu_profiler.mutex);
+}
+
+static void resolve_timestamps(VkalGpuProfilerFrame * frame, VkalGpuProfile * profile)
+{
+    // Pairs of (timestamp, availability).
+    uint64_t results[2 * VKAL_TIMESTAMP_QUERY_COUNT];
+    vkGetQueryPoolResults(vkal_info.device, frame->pool, 0, 2 * frame->scope_count,
+                          sizeof(results), results, 2 * sizeof(uint64_t),
+                          VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+
+    double ms_per_tick = (double)vkal_info.physical_device_properties.limits.timestampPeriod / 1000000.0;
+    uint64_t first = UINT64_MAX;
+    uint64_t last = 0;
+    for (uint32_t i = 0; i < frame->scope_count; ++i) {
+        profile->scopes[i] = frame->scopes[i];
+        profile->scopes[i].ms = -1.0;
+        uint64_t * begin = &results[4 * i];
+        uint64_t * end = &results[4 * i + 2];
+        if (frame->ended[i] && begin[1] && end[1]) {
+            uint64_t begin_ticks = begin[0] & vkal_info.timestamp_mask;
+            uint64_t end_ticks = end[0] & vkal_info.timestamp_mask;
+            profile->scopes[i].ms = (double)((end_ticks - begin_ticks) & vkal_info.timestamp_mask) * ms_per_tick;
+            first = VKAL_MIN(first, begin_ticks);
+            last = VKAL_MAX(last, end_ticks);
+        }
+    }
+    profile->scope_count = frame->scope_count;
+    profile->frame_ms = last > first ? (double)(last - first) * ms_per_tick : 0.0;
+}
+
+static void resolve_statistics(VkalGpuProfilerFrame * frame, VkalGpuProfile * profile)
+{
+    uint64_t statistics[VKAL_MAX_STATISTICS_SCOPES][VKAL_PIPELINE_STATISTICS_COUNT + 1] = { 0 };
+    if (frame->statistics_pool != VK_NULL_HANDLE) {
+        vkGetQueryPoolResults(vkal_info.device, frame->statistics_pool, 0, frame->statistics_count,
+                              sizeof(statistics), statistics, sizeof(statistics[0]),
+                              VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+    }
+    uint64_t samples[VKAL_MAX_STATISTICS_SCOPES][2];
+    vkGetQueryPoolResults(vkal_info.device, frame->occlusion_pool, 0, frame->statistics_count,
+                          sizeof(samples), samples, sizeof(samples[0]),
+                          VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+
+    for (uint32_t i = 0; i < frame->statistics_count; ++i) {
+        VkalPipelineStatistics * out = &profile->statistics[i];
+        memset(out, 0, sizeof(VkalPipelineStatistics));
+        memcpy(out->name, frame->statistics[i].name, VKAL_GPU_SCOPE_NAME_LENGTH);
+        int statistics_available = frame->statistics_pool == VK_NULL_HANDLE || statistics[i][VKAL_PIPELINE_STATISTICS_COUNT];
+        out->available = frame->statistics_ended[i] && statistics_available && samples[i][1];
+        if (out->available) {
+            out->input_vertices              = statistics[i][0];
+            out->input_primitives            = statistics[i][1];
+            out->vertex_shader_invocations   = statistics[i][2];
+            out->clipping_invocations        = statistics[i][3];
+            out->clipping_primitives         = statistics[i][4];
+            out->fragment_shader_invocations = statistics[i][5];
+            out->compute_shader_invocations  = statistics[i][6];
+            out->samples_passed              = samples[i][0];
+        }
+    }
+    profile->statistics_count = frame->statistics_count;
+}
+
+static void resolve_occlusion_queries(VkalGpuProfilerFrame * frame)
+{
+    uint64_t samples[VKAL_MAX_OCCLUSION_QUERIES][2];
+    vkGetQueryPoolResults(vkal_info.device, frame->occlusion_pool, VKAL_MAX_STATISTICS_SCOPES, VKAL_MAX_OCCLUSION_QUERIES,
+                          sizeof(samples), samples, sizeof(samples[0]),
+                          VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+    for (uint32_t i = 0; i < VKAL_MAX_OCCLUSION_QUERIES; ++i) {
+        vkal_gpu_profiler.occlusion_valid[i] = frame->occlusion_written[i] == 2 && samples[i][1];
+        vkal_gpu_profiler.occlusion_results[i] = samples[i][0];
+    }
+}
+
+/* Called once the frame's fence has signaled. Queries of command buffers that were never submitted
+   come back unavailable instead of stalling. */
+static void resolve_gpu_profile(uint32_t frame_index)
+{
+    mutex_lock(&vkal_gpu_profiler.mutex);
+    VkalGpuProfilerFrame * frame = &vkal_gpu_profiler.frames[frame_index];
+    if (frame->occlusion_pool == VK_NULL_HANDLE) {
+        mutex_unlock(&vkal_gpu_profiler.mutex);
+        return;
+    }
+    // A frame without scopes must not keep reporting the ones of an earlier frame.
+    if (frame->scope_count) {
+        resolve_timestamps(frame, &vkal_info.gpu_profile);
+    }
+    else {
+        vkal_info.gpu_profile.scope_count = 0;
+        vkal_info.gpu_profile.frame_ms = 0.0;
+    }
+    if (frame->statistics_count) {
+        resolve_statistics(frame, &vkal_info.gpu_profile);
+    }
+    else {
+        vkal_info.gpu_profile.statistics_count = 0;
+    }
+    resolve_occlusion_queries(frame);
+
+    if (vkal_info.host_query_reset) {
+        if (frame->pool != VK_NULL_HANDLE) {
+            vkResetQueryPool(vkal_info.device, frame->pool, 0, VKAL_TIMESTAMP_QUERY_COUNT);
+        }
+        if (frame->statistics_pool != VK_NULL_HANDLE) {
+            vkResetQueryPool(vkal_info.device, frame->statistics_pool, 0, VKAL_MAX_STATISTICS_SCOPES);
+        }
+        vkResetQueryPool(vkal_info.device, frame->occlusion_pool, 0, VKAL_OCCLUSION_QUERY_COUNT);
+    }
+    else {
+        frame->needs_reset = 1;
+    }
+    frame->scope_count = 0;
+    frame->open_count = 0;
+    frame->statistics_count = 0;
+    memset(frame->occlusion_written, 0, sizeof(frame->occlusion_written));
+    mutex_unlock(&vkal_gpu_profiler.mutex);
+}
+
+void vkal_gpu_scope_begin(VkCommandBuffer command_buffer, char const * name)
+{
+    if (!vkal_info.timestamps_supported) {
+        return;
+    }
+    mutex_lock(&vkal_gpu_profiler.mutex);
+    VkalGpuProfilerFrame * frame = &vkal_gpu_profiler.frames[vkal_info.frames_rendered];
+    // Writing to a pool that has not been reset is invalid. Drop the scope instead.
+    if (!frame->needs_reset && frame->scope_count < VKAL_MAX_GPU_SCOPES) {
+        uint32_t scope = frame->scope_count++;
+        strncpy(frame->scopes[scope].name, name, VKAL_GPU_SCOPE_NAME_LENGTH - 1);
+        frame->scopes[scope].name[VKAL_GPU_SCOPE_NAME_LENGTH - 1] = '\0';
+        frame->scopes[scope].depth = frame->open_count;
+        frame->scopes[scope].ms = -1.0;
+        frame->ended[scope] = 0;
+        frame->open[frame->open_count++] = scope;
+        vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, frame->pool, 2 * scope);
+    }
+    mutex_unlock(&vkal_gpu_profiler.mutex);
+}
+
+void vkal_gpu_scope_end(VkCommandBuffer command_buffer, char const * name)
+{
+    if (!vkal_info.timestamps_supported) {
+        return;
+    }
+    mutex_lock(&vkal_gpu_profiler.mutex);
+    VkalGpuProfilerFrame * frame = &vkal_gpu_profiler.frames[vkal_info.frames_rendered];
+    for (uint32_t i = frame->open_count; i > 0; --i) {
+        uint32_t scope = frame->open[i - 1];
+        if (strncmp(frame->scopes[scope].name, name, VKAL_GPU_SCOPE_NAME_LENGTH - 1) == 0) {
+            vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, frame->pool, 2 * scope + 1);
+            frame->ended[scope] = 1;
+            memmove(&frame->open[i - 1], &frame->open[i], (frame->open_count - i) * sizeof(uint32_t));
+            frame->open_count--;
+            break;
+        }
+    }
+    mutex_unlock(&vkal_gpu_profiler.mutex);
+}
+
+void vkal_statistics_scope_begin(VkCommandBuffer command_buffer, char const * name)
+{
+    mutex_lock(&vkal_gpu_profiler.mutex);
+    VkalGpuProfilerFrame * frame = &vkal_gpu_profiler.frames[vkal_info.frames_rendered];
+    if (!frame->needs_reset && frame->statistics_count < VKAL_MAX_STATISTICS_SCOPES) {
+        uint32_t scope = frame->statistics_count++;
+        strncpy(frame->statistics[scope].name, name, VKAL_GPU_SCOPE_NAME_LENGTH - 1);
+        frame->statistics[scope].name[VKAL_GPU_SCOPE_NAME_LENGTH - 1] = '\0';
+        frame->statistics_ended[scope] = 0;
+        if (frame->statistics_pool != VK_NULL_HANDLE) {
+            vkCmdBeginQuery(command_buffer, frame->statistics_pool, scope, 0);
+        }
+        vkCmdBeginQuery(command_buffer, frame->occlusion_pool, scope,
+                        vkal_info.occlusion_query_precise ? VK_QUERY_CONTROL_PRECISE_BIT : 0);
+    }
+    mutex_unlock(&vkal_gpu_profiler.mutex);
+}
+
+void vkal_statistics_scope_end(VkCommandBuffer command_buffer, char const * name)
+{
+    mutex_lock(&vkal_gpu_profiler.mutex);
+    VkalGpuProfilerFrame * frame = &vkal_gpu_profiler.frames[vkal_info.frames_rendered];
+    for (uint32_t i = frame->statistics_count; i > 0; --i) {
+        uint32_t scope = i - 1;
+        if (!frame->statistics_ended[scope] &&
+            strncmp(frame->statistics[scope].name, name, VKAL_GPU_SCOPE_NAME_LENGTH - 1) == 0) {
+            if (frame->statistics_pool != VK_NULL_HANDLE) {
+                vkCmdEndQuery(command_buffer, frame->statistics_pool, scope);
+            }
+            vkCmdEndQuery(command_buffer, frame->occlusion_pool, scope);
+            frame->statistics_ended[scope] = 1;
+            break;
+        }
+    }
+    mutex_unlock(&vkal_gpu_profiler.mutex);
+}
+
+void vkal_occlusion_query_begin(VkCommandBuffer command_buffer, uint32_t query_id)
+{
+    assert(query_id < VKAL_MAX_OCCLUSION_QUERIES && "occlusion query id out of range!");
+    mutex_lock(&vkal_gpu_profiler.mutex);
+    VkalGpuProfilerFrame * frame = &vkal_gpu_profiler.frames[vkal_info.frames_rendered];
+    // A query may only be begun once between resets.
+    if (!frame->needs_reset && frame->occlusion_written[query_id] == 0) {
+        frame->occlusion_written[query_id] = 1;
+        vkCmdBeginQuery(command_buffer, frame->occlusion_pool, VKAL_MAX_STATISTICS_SCOPES + query_id, 0);
+    }
+    mutex_unlock(&vkal_gpu_profiler.mutex);
+}
+
+void vkal_occlusion_query_end(VkCommandBuffer command_buffer, uint32_t query_id)
+{
+    assert(query_id < VKAL_MAX_OCCLUSION_QUERIES && "occlusion query id out of range!");
+    mutex_lock(&vkal_gpu_profiler.mutex);
+    VkalGpuProfilerFrame * frame = &vkal_gpu_profiler.frames[vkal_info.frames_rendered];
+    if (frame->occlusion_written[query_id] == 1) {
+        vkCmdEndQuery(command_buffer, frame->occlusion_pool, VKAL_MAX_STATISTICS_SCOPES + query_id);
+        frame->occlusion_written[query_id] = 2;
+    }
+    mutex_unlock(&vkal_gpu_profiler.mutex);
+}
+
+int vkal_get_occlusion_result(uint32_t query_id, uint64_t * out_samples_passed)
+{
+    assert(query_id < VKAL_MAX_OCCLUSION_QUERIES && "occlusion query id out of range!");
+    mutex_lock(&vkal_gpu_profiler.mutex);
+    int valid = vkal_gpu_profiler.occlusion_valid[query_id];
+    *out_samples_passed = valid ? vkal_gpu_profiler.occlusion_results[query_id] : 0;
+    mutex_unlock(&vkal_gpu_profiler.mutex);
+    return valid;
+}
+
+void vkal_get_gpu_profile(VkalGpuProfile * out_profile)
+{
+    *out_profile = vkal_info.gpu_profile;
+}
+
+void vkal_print_gpu_profile(void)
 {
-    VkSubmitInfo submit_info = { 0 };
-    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    VkSemaphore wait_semaphores[1];
-    wait_semaphores[0] = vkal_info.image_available_semaphores[vkal_info.frames_rendered];
-    VkPipelineStageFlags wait_stages[1];
-    wait_stages[0] = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    submit_info.waitSemaphoreCount = 1;
-    submit_info.pWaitSemaphores = wait_semaphores; // wait until image is available from swapchain ringbuffer
-    submit_info.pWaitDstStageMask = wait_stages;
-    submit_info.commandBufferCount = command_buffer_count;
-    submit_info.pCommandBuffers = command_buffers;
-    VkSemaphore signal_semaphores[1];
-    signal_semaphores[0] = vkal_info.render_finished_semaphores[vkal_info.frames_rendered];
-    submit_info.signalSemaphoreCount = 1;
-    submit_info.pSignalSemaphores = signal_semaphores;
-    VkResult result = vkQueueSubmit(vkal_info.graphics_queue, 1, &submit_info,
-				    vkal_info.in_flight_fences[vkal_info.frames_rendered]);
-    VKAL_ASSERT(result && "Failed to submit command buffer to queue!");
+    VkalGpuProfile * profile = &vkal_info.gpu_profile;
+    printf("[VKAL] GPU frame: %.3f ms\n", profile->frame_ms);
+    for (uint32_t i = 0; i < profile->scope_count; ++i) {
+        VkalGpuScope * scope = &profile->scopes[i];
+        if (scope->ms < 0.0) {
+            printf("[VKAL]   %*s%s: -\n", 2 * scope->depth, "", scope->name);
+        }
+        else {
+            printf("[VKAL]   %*s%s: %.3f ms\n", 2 * scope->depth, "", scope->name, scope->ms);
+        }
+    }
+    for (uint32_t i = 0; i < profile->statistics_count; ++i) {
+        VkalPipelineStatistics * statistics = &profile->statistics[i];
+        if (!statistics->available) {
+            printf("[VKAL]   %s: -\n", statistics->name);
+            continue;
+        }
+        printf("[VKAL]   %s: %llu vertices, %llu primitives (%llu after clipping), %llu vs, %llu fs, %llu cs invocations, %llu samples\n",
+               statistics->name,
+               (unsigned long long)statistics->input_vertices,
+               (unsigned long long)statistics->input_primitives,
+               (unsigned long long)statistics->clipping_primitives,
+               (unsigned long long)statistics->vertex_shader_invocations,
+               (unsigned long long)statistics->fragment_shader_invocations,
+               (unsigned long long)statistics->compute_shader_invocations,
+               (unsigned long long)statistics->samples_passed);
+    }
 }
 
-void vkal_present(uint32_t image_id)
+void handle_pool_init(VkalHandlePool * pool, uint32_t item_size, uint32_t capacity)
 {
-    VkPresentInfoKHR present_info = { 0 };
-    present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-    present_info.waitSemaphoreCount = 1;
-    VkSemaphore wait_semaphores[1];
-    wait_semaphores[0] = vkal_info.render_finished_semaphores[vkal_info.frames_rendered];
-    present_info.pWaitSemaphores = wait_semaphores;
-    VkSwapchainKHR swap_chains[1];
-    swap_chains[0] = vkal_info.swapchain;
-    present_info.swapchainCount = 1;
-    present_info.pSwapchains = swap_chains;
-    present_info.pImageIndices = &image_id;
-    VkResult result = vkQueuePresentKHR(vkal_info.present_queue, &present_info);
-    
-    if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || vkal_info.should_recreate_swapchain) {
-		vkal_info.should_recreate_swapchain = 0;
-		recreate_swapchain();
-		return;
+    memset(pool, 0, sizeof(VkalHandlePool));
+    pool->item_size = item_size;
+    pool->capacity = capacity;
+    pool->items = (uint8_t*)calloc(capacity, item_size);
+    pool->generations = (uint16_t*)calloc(capacity, sizeof(uint16_t));
+    pool->used = (uint8_t*)calloc(capacity, sizeof(uint8_t));
+    pool->free_slots = (uint32_t*)malloc(capacity * sizeof(uint32_t));
+    assert(pool->items && pool->generations && pool->used && pool->free_slots && "handle_pool_init: out of memory!");
+}
+
+/* O(1): reuses the most recently freed slot or takes the next fresh one, doubling the capacity if needed.
+   The item is zeroed. Pointers into the pool are invalidated by the next alloc. */
+uint32_t handle_pool_alloc(VkalHandlePool * pool, void ** out_item)
+{
+    uint32_t slot;
+    if (pool->free_count) {
+        slot = pool->free_slots[--pool->free_count];
     }
     else {
-		// TODO
+        if (pool->slot_count == pool->capacity) {
+            uint32_t old_capacity = pool->capacity;
+            pool->capacity = old_capacity ? 2 * old_capacity : 16;
+            assert(pool->capacity <= VKAL_HANDLE_INDEX_MASK && "handle_pool_alloc: too many handles!");
+            pool->items = (uint8_t*)realloc(pool->items, (size_t)pool->capacity * pool->item_size);
+            VKAL_REALLOC(pool->generations, pool->capacity);
+            VKAL_REALLOC(pool->used, pool->capacity);
+            VKAL_REALLOC(pool->free_slots, pool->capacity);
+            assert(pool->items && pool->generations && pool->used && pool->free_slots && "handle_pool_alloc: out of memory!");
+            memset(pool->generations + old_capacity, 0, (pool->capacity - old_capacity) * sizeof(uint16_t));
+            memset(pool->used + old_capacity, 0, (pool->capacity - old_capacity) * sizeof(uint8_t));
+        }
+        slot = pool->slot_count++;
+        pool->generations[slot] = 1;
     }
-    
-    vkal_info.frames_rendered = (vkal_info.frames_rendered+1) % VKAL_MAX_IMAGES_IN_FLIGHT;
+    pool->used[slot] = 1;
+    void * item = pool->items + (size_t)slot * pool->item_size;
+    memset(item, 0, pool->item_size);
+    if (out_item) {
+        *out_item = item;
+    }
+    return ((uint32_t)pool->generations[slot] << VKAL_HANDLE_INDEX_BITS) | slot;
 }
 
-void create_default_semaphores(void)
+void handle_pool_free(VkalHandlePool * pool, uint32_t handle)
 {
-    for (int i = 0; i < VKAL_MAX_IMAGES_IN_FLIGHT; ++i) {
-		VkFenceCreateInfo fenceInfo = { 0 };
-		fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-		fenceInfo.pNext = NULL;
-		fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-		VkResult result = vkCreateFence(vkal_info.device, &fenceInfo, NULL, &vkal_info.in_flight_fences[i]);
-		VKAL_ASSERT(result && "failed to create draw-fence");
+    assert(handle_pool_valid(pool, handle) && "handle_pool_free: stale or invalid handle!");
+    uint32_t slot = handle & VKAL_HANDLE_INDEX_MASK;
+    pool->used[slot] = 0;
+    // Skip generation 0 so a zeroed handle never looks valid.
+    pool->generations[slot] = (uint16_t)((pool->generations[slot] % VKAL_HANDLE_GENERATION_MASK) + 1);
+    pool->free_slots[pool->free_count++] = slot;
+}
 
-		VkSemaphoreCreateInfo sem_info = (VkSemaphoreCreateInfo){ 0 };
-		sem_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
-		vkCreateSemaphore(vkal_info.device, &sem_info, 0, &vkal_info.image_available_semaphores[i]);
-		vkCreateSemaphore(vkal_info.device, &sem_info, 0, &vkal_info.render_finished_semaphores[i]);
+int handle_pool_valid(VkalHandlePool * pool, uint32_t handle)
+{
+    uint32_t slot = handle & VKAL_HANDLE_INDEX_MASK;
+    return handle != VKAL_INVALID_HANDLE && slot < pool->slot_count && pool->used[slot] &&
+        pool->generations[slot] == (handle >> VKAL_HANDLE_INDEX_BITS);
+}
+
+/* Asserts on stale handles, so use-after-free shows up in debug builds. */
+void * handle_pool_get(VkalHandlePool * pool, uint32_t handle)
+{
+    assert(handle_pool_valid(pool, handle) && "handle_pool_get: stale or invalid handle!");
+    return pool->items + (size_t)(handle & VKAL_HANDLE_INDEX_MASK) * pool->item_size;
+}
 
+/* Handle of the live item in 'slot', VKAL_INVALID_HANDLE if the slot is free. */
+uint32_t handle_pool_handle_at(VkalHandlePool * pool, uint32_t slot)
+{
+    if (slot >= pool->slot_count || !pool->used[slot]) {
+        return VKAL_INVALID_HANDLE;
     }
-    //memset(vkal_info.image_in_flight_fences, VK_NULL_HANDLE, vkal_info.swapchain_image_count * sizeof(VkFence));
+    return ((uint32_t)pool->generations[slot] << VKAL_HANDLE_INDEX_BITS) | slot;
 }
 
-void allocate_default_device_memory_uniform(void)
+void handle_pool_destroy(VkalHandlePool * pool)
 {
-    VkMemoryRequirements buffer_memory_requirements;
-    vkGetBufferMemoryRequirements(vkal_info.device, vkal_info.default_uniform_buffer.buffer, &buffer_memory_requirements);
-    uint32_t mem_type_index = check_memory_type_index(
-		buffer_memory_requirements.memoryTypeBits, 
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
-	vkal_info.default_device_memory_uniform = allocate_memory(buffer_memory_requirements.size, mem_type_index);
-    
-    VkResult result = vkBindBufferMemory(
-		vkal_info.device, vkal_info.default_uniform_buffer.buffer,
-		vkal_info.default_device_memory_uniform, 0); // the last param is the memory offset!
-    VKAL_ASSERT(result && "failed to bind uniform buffer to device memory!");
+    VKAL_FREE(pool->items);
+    VKAL_FREE(pool->generations);
+    VKAL_FREE(pool->used);
+    VKAL_FREE(pool->free_slots);
+    memset(pool, 0, sizeof(VkalHandlePool));
 }
 
-void allocate_default_device_memory_vertex(void)
+void create_handle_pools(void)
 {
-    VkMemoryRequirements buffer_memory_requirements;
-    vkGetBufferMemoryRequirements(vkal_info.device, vkal_info.default_vertex_buffer.buffer, &buffer_memory_requirements);
-    uint32_t mem_type_index = check_memory_type_index(buffer_memory_requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-    vkal_info.default_device_memory_vertex = allocate_memory(buffer_memory_requirements.size, mem_type_index);
-    
-    VkResult result = vkBindBufferMemory(vkal_info.device, vkal_info.default_vertex_buffer.buffer, vkal_info.default_device_memory_vertex, 0);
-    VKAL_ASSERT(result && "failed to bind vertex buffer memory!");
+    handle_pool_init(&vkal_info.user_device_memory, sizeof(VkalDeviceMemoryHandle), VKAL_MAX_VKDEVICEMEMORY);
+    handle_pool_init(&vkal_info.user_images, sizeof(VkalImageHandle), VKAL_MAX_VKIMAGE);
+    handle_pool_init(&vkal_info.user_image_views, sizeof(VkalImageViewHandle), VKAL_MAX_VKIMAGEVIEW);
+    handle_pool_init(&vkal_info.user_shader_modules, sizeof(VkalShaderModuleHandle), VKAL_MAX_VKSHADERMODULE);
+    handle_pool_init(&vkal_info.user_pipeline_layouts, sizeof(VkalPipelineLayoutHandle), VKAL_MAX_VKPIPELINELAYOUT);
+    handle_pool_init(&vkal_info.user_descriptor_set_layouts, sizeof(VkalDescriptorSetLayoutHande), VKAL_MAX_VKDESCRIPTORSETLAYOUT);
+    handle_pool_init(&vkal_info.user_pipelines, sizeof(VkalPipelineHandle), VKAL_MAX_VKPIPELINE);
+    handle_pool_init(&vkal_info.user_samplers, sizeof(VkalSamplerHandle), VKAL_MAX_VKSAMPLER);
+    handle_pool_init(&vkal_info.user_framebuffers, sizeof(VkalFramebufferHandle), VKAL_MAX_VKFRAMEBUFFER);
 }
 
-void allocate_default_device_memory_index(void)
+void destroy_handle_pools(void)
 {
-    VkMemoryRequirements buffer_memory_requirements;
-    vkGetBufferMemoryRequirements(vkal_info.device, vkal_info.default_index_buffer.buffer, &buffer_memory_requirements);
-    uint32_t mem_type_index = check_memory_type_index(buffer_memory_requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-    vkal_info.default_device_memory_index = allocate_memory(buffer_memory_requirements.size, mem_type_index);
-    
-    VkResult result = vkBindBufferMemory(vkal_info.device, vkal_info.default_index_buffer.buffer, vkal_info.default_device_memory_index, 0);
-    VKAL_ASSERT(result && "failed to bind vertex buffer memory!");
+    handle_pool_destroy(&vkal_info.user_device_memory);
+    handle_pool_destroy(&vkal_info.user_images);
+    handle_pool_destroy(&vkal_info.user_image_views);
+    handle_pool_destroy(&vkal_info.user_shader_modules);
+    handle_pool_destroy(&vkal_info.user_pipeline_layouts);
+    handle_pool_destroy(&vkal_info.user_descriptor_set_layouts);
+    handle_pool_destroy(&vkal_info.user_pipelines);
+    handle_pool_destroy(&vkal_info.user_samplers);
+    handle_pool_destroy(&vkal_info.user_framebuffers);
 }
 
-void create_default_uniform_buffer(uint32_t size)
+static void free_list_insert(VkalFreeList * free_list, uint32_t index, VkalMemoryRange range)
 {
-    vkal_info.default_uniform_buffer = create_buffer(size, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
-	VKAL_DBG_BUFFER_NAME(vkal_info.device, vkal_info.default_uniform_buffer, "Default Uniform Buffer");
+    if (free_list->count == free_list->capacity) {
+        free_list->capacity = free_list->capacity ? 2 * free_list->capacity : 16;
+        VKAL_REALLOC(free_list->ranges, free_list->capacity);
+        assert(free_list->ranges && "free_list_insert: out of memory!");
+    }
+    memmove(&free_list->ranges[index + 1], &free_list->ranges[index],
+            (free_list->count - index) * sizeof(VkalMemoryRange));
+    free_list->ranges[index] = range;
+    free_list->count++;
 }
 
-uint32_t vkal_aligned_size(uint32_t size, uint32_t alignment)
+static void free_list_remove(VkalFreeList * free_list, uint32_t index)
 {
-    return (size + alignment - 1) & ~(alignment - 1);
+    memmove(&free_list->ranges[index], &free_list->ranges[index + 1],
+            (free_list->count - index - 1) * sizeof(VkalMemoryRange));
+    free_list->count--;
 }
 
-/* NOTE: It probably is not a good idea to map and unmap the buffer every frame. This function is supposed to be 
-         'safe' in that you don't have to worry about touching the memory after update. But when building for 
-         production the uniform buffer should probably stay mapped. */
-void vkal_update_uniform(UniformBuffer * uniform_buffer, void * data) // TODO: Does uniform_buffer really have to be a pointer?
+void free_list_init(VkalFreeList * free_list, VkDeviceSize size)
 {
-    uint64_t alignment = vkal_info.physical_device_properties.limits.nonCoherentAtomSize;
-    uint64_t data_in_bytes = uniform_buffer->size;
-    uint64_t aligned_size = (data_in_bytes + alignment - 1) & ~(alignment - 1);
+    free_list->ranges = NULL;
+    free_list->count = 0;
+    free_list->capacity = 0;
+    VkalMemoryRange whole = { 0, size };
+    free_list_insert(free_list, 0, whole);
+}
 
-    void * mapped_uniform_memory = 0;
-    VkResult result = vkMapMemory(
-		vkal_info.device, 
-		vkal_info.default_device_memory_uniform, 
-		uniform_buffer->offset, aligned_size, 
-		0, 
-		&mapped_uniform_memory);
-    VKAL_ASSERT(result && "failed to map device memory");
+/* Best fit: Takes the smallest free range that can hold 'size' bytes at the requested alignment.
+   Padding in front of the aligned offset stays in the free list. Returns 0 if nothing fits. */
+int free_list_alloc(VkalFreeList * free_list, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize * out_offset)
+{
+    if (alignment == 0) alignment = 1;
+    uint32_t best = UINT32_MAX;
+    VkDeviceSize best_size = 0;
+    for (uint32_t i = 0; i < free_list->count; ++i) {
+        VkalMemoryRange range = free_list->ranges[i];
+        VkDeviceSize aligned_offset = ((range.offset + alignment - 1) / alignment) * alignment;
+        if (aligned_offset + size > range.offset + range.size) {
+            continue;
+        }
+        if (best == UINT32_MAX || range.size < best_size) {
+            best = i;
+            best_size = range.size;
+        }
+    }
+    if (best == UINT32_MAX) {
+        return 0;
+    }
 
-    uint64_t offset = uniform_buffer->offset;
-    uint64_t offset_alignment = (offset + alignment - 1) & ~(alignment - 1);
+    VkalMemoryRange range = free_list->ranges[best];
+    VkDeviceSize aligned_offset = ((range.offset + alignment - 1) / alignment) * alignment;
+    VkDeviceSize head = aligned_offset - range.offset;
+    VkDeviceSize tail = (range.offset + range.size) - (aligned_offset + size);
+    if (head && tail) {
+        free_list->ranges[best].size = head;
+        VkalMemoryRange tail_range = { aligned_offset + size, tail };
+        free_list_insert(free_list, best + 1, tail_range);
+    }
+    else if (head) {
+        free_list->ranges[best].size = head;
+    }
+    else if (tail) {
+        free_list->ranges[best].offset = aligned_offset + size;
+        free_list->ranges[best].size = tail;
+    }
+    else {
+        free_list_remove(free_list, best);
+    }
+    *out_offset = aligned_offset;
+    return 1;
+}
 
-    memcpy(mapped_uniform_memory, data, uniform_buffer->size);
-    VkMappedMemoryRange flush_range;
-    flush_range.sType  = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
-    flush_range.pNext  = 0;
-    flush_range.memory = vkal_info.default_device_memory_uniform;
-    flush_range.offset = offset_alignment;
-    flush_range.size   = VK_WHOLE_SIZE;
-    
-    result = vkFlushMappedMemoryRanges(vkal_info.device, 1, &flush_range);
-    VKAL_ASSERT(result && "failed to flush mapped memory range(s)!");
-    result = vkInvalidateMappedMemoryRanges(vkal_info.device, 1, &flush_range);
-    VKAL_ASSERT(result && "failed to invalidate mapped memory range(s)!");
-    vkUnmapMemory(vkal_info.device, vkal_info.default_device_memory_uniform); // invalidated _all_ previously acquired pointers via vkMapMemory
+void free_list_free(VkalFreeList * free_list, VkDeviceSize offset, VkDeviceSize size)
+{
+    uint32_t index = 0;
+    while (index < free_list->count && free_list->ranges[index].offset < offset) {
+        index++;
+    }
+    int merge_prev = (index > 0) &&
+        (free_list->ranges[index - 1].offset + free_list->ranges[index - 1].size == offset);
+    int merge_next = (index < free_list->count) &&
+        (offset + size == free_list->ranges[index].offset);
+
+    if (merge_prev && merge_next) {
+        free_list->ranges[index - 1].size += size + free_list->ranges[index].size;
+        free_list_remove(free_list, index);
+    }
+    else if (merge_prev) {
+        free_list->ranges[index - 1].size += size;
+    }
+    else if (merge_next) {
+        free_list->ranges[index].offset = offset;
+        free_list->ranges[index].size += size;
+    }
+    else {
+        VkalMemoryRange range = { offset, size };
+        free_list_insert(free_list, index, range);
+    }
 }
 
-void create_device_memory(VkDeviceSize size, uint32_t mem_type_bits, uint32_t * out_memory_id)
+void free_list_destroy(VkalFreeList * free_list)
+{
+    VKAL_FREE(free_list->ranges);
+    free_list->ranges = NULL;
+    free_list->count = 0;
+    free_list->capacity = 0;
+}
+
+static uint32_t create_memory_block(VkDeviceSize size, uint32_t mem_type_index, uint32_t linear, uint32_t dedicated)
 {
     uint32_t free_index;
-    for (free_index = 0; free_index < VKAL_MAX_VKDEVICEMEMORY; ++free_index) {
-		if (vkal_info.user_device_memory[free_index].used) {
-			continue;
-		}
-		break;
+    for (free_index = 0; free_index < VKAL_MAX_MEMORY_BLOCKS; ++free_index) {
+        if (vkal_info.memory_blocks[free_index].used) {
+            continue;
+        }
+        break;
+    }
+    assert(free_index < VKAL_MAX_MEMORY_BLOCKS && "create_memory_block: out of memory blocks!");
+
+    VkalMemoryBlock * block = &vkal_info.memory_blocks[free_index];
+    memset(block, 0, sizeof(VkalMemoryBlock));
+    block->device_memory = allocate_memory(size, mem_type_index, VKAL_MEMORY_CATEGORY_OTHER);
+    vkal_info.memory_allocations[vkal_info.memory_allocation_count - 1].block = 1; // Just recorded by allocate_memory.
+    block->size = size;
+    block->mem_type_index = mem_type_index;
+    block->linear = linear;
+    block->dedicated = dedicated;
+    block->used = 1;
+    free_list_init(&block->free_list, size);
+    return free_index;
+}
+
+static void destroy_memory_block(uint32_t id)
+{
+    VkalMemoryBlock * block = &vkal_info.memory_blocks[id];
+    if (block->used) {
+        free_memory(block->device_memory);
+        free_list_destroy(&block->free_list);
+        block->used = 0;
+    }
+}
+
+static uint32_t register_device_memory(uint32_t block_id, VkDeviceSize offset, VkDeviceSize size, VkalMemoryCategory category)
+{
+    VkalMemoryBlock * block = &vkal_info.memory_blocks[block_id];
+    block->used_size += size;
+    block->allocation_count++;
+
+    VkalDeviceMemoryHandle * handle;
+    uint32_t memory_id = handle_pool_alloc(&vkal_info.user_device_memory, (void**)&handle);
+    handle->device_memory = block->device_memory;
+    handle->offset = offset;
+    handle->size = size;
+    handle->block = block_id;
+    handle->category = category;
+    return memory_id;
+}
+
+/* Allocates 'requirements.size' bytes out of a block of the given memory type. Requests larger than
+   half a block get a dedicated VkDeviceMemory. Set 'linear' for buffers, 0 for optimal tiled images.
+   'category' is what vkal_get_memory_stats counts the range under. */
+void sub_allocate_memory(VkMemoryRequirements requirements, uint32_t mem_type_index, uint32_t linear, VkalMemoryCategory category, uint32_t * out_memory_id)
+{
+    VkDeviceSize offset = 0;
+    uint32_t block_id = VKAL_MAX_MEMORY_BLOCKS;
+    if (requirements.size > VKAL_MEMORY_BLOCK_SIZE / 2) {
+        block_id = create_memory_block(requirements.size, mem_type_index, linear, 1);
+        free_list_alloc(&vkal_info.memory_blocks[block_id].free_list, requirements.size, requirements.alignment, &offset);
+    }
+    else {
+        for (uint32_t i = 0; i < VKAL_MAX_MEMORY_BLOCKS; ++i) {
+            VkalMemoryBlock * block = &vkal_info.memory_blocks[i];
+            if (!block->used || block->dedicated ||
+                block->mem_type_index != mem_type_index || block->linear != linear) {
+                continue;
+            }
+            if (free_list_alloc(&block->free_list, requirements.size, requirements.alignment, &offset)) {
+                block_id = i;
+                break;
+            }
+        }
+        if (block_id == VKAL_MAX_MEMORY_BLOCKS) {
+            block_id = create_memory_block(VKAL_MEMORY_BLOCK_SIZE, mem_type_index, linear, 0);
+            int ok = free_list_alloc(&vkal_info.memory_blocks[block_id].free_list, requirements.size, requirements.alignment, &offset);
+            assert(ok && "sub_allocate_memory: allocation does not fit into a fresh block!");
+            (void)ok;
+        }
     }
-    vkal_info.user_device_memory[free_index].device_memory = allocate_memory(size, mem_type_bits);
-    vkal_info.user_device_memory[free_index].used = 1;
-    *out_memory_id = free_index;
+    *out_memory_id = register_device_memory(block_id, offset, requirements.size, category);
+}
+
+/* Gets its own VkDeviceMemory starting at offset 0, as before the sub-allocator existed. */
+void create_device_memory(VkDeviceSize size, uint32_t mem_type_bits, uint32_t * out_memory_id)
+{
+    uint32_t block_id = create_memory_block(size, mem_type_bits, 0, 1);
+    VkDeviceSize offset = 0;
+    free_list_alloc(&vkal_info.memory_blocks[block_id].free_list, size, 1, &offset);
+    *out_memory_id = register_device_memory(block_id, offset, size, VKAL_MEMORY_CATEGORY_TEXTURE);
+}
+
+/* Allocates memory for an image created with create_image and binds it. */
+void vkal_allocate_image_memory(uint32_t image_id, VkMemoryPropertyFlags memory_property_flags, uint32_t * out_memory_id)
+{
+    VkMemoryRequirements image_memory_requirements = { 0 };
+    vkGetImageMemoryRequirements(vkal_info.device, get_image(image_id), &image_memory_requirements);
+    uint32_t mem_type_index = check_memory_type_index(image_memory_requirements.memoryTypeBits, memory_property_flags);
+    sub_allocate_memory(image_memory_requirements, mem_type_index, 0, VKAL_MEMORY_CATEGORY_TEXTURE, out_memory_id);
+    VkResult result = vkBindImageMemory(vkal_info.device, get_image(image_id),
+                                        get_device_memory(*out_memory_id), get_device_memory_offset(*out_memory_id));
+    VKAL_ASSERT(result && "failed to bind image memory!");
 }
 
 VkDeviceMemory get_device_memory(uint32_t id)
 {
-    assert(id < VKAL_MAX_VKDEVICEMEMORY);
-    assert(vkal_info.user_device_memory[id].used);
-    return vkal_info.user_device_memory[id].device_memory;
+    return ((VkalDeviceMemoryHandle*)handle_pool_get(&vkal_info.user_device_memory, id))->device_memory;
 }
 
+VkDeviceSize get_device_memory_offset(uint32_t id)
+{
+    return ((VkalDeviceMemoryHandle*)handle_pool_get(&vkal_info.user_device_memory, id))->offset;
+}
+
+/* Gives the range back to its block. Dedicated blocks are freed right away, shared blocks stay
+   around (even when empty) until vkal_cleanup so they can be reused. */
 uint32_t vkal_destroy_device_memory(uint32_t id)
 {
     uint32_t is_destroyed = 0;
-    if (vkal_info.user_device_memory[id].used) {
-	    vkFreeMemory(vkal_info.device, get_device_memory(id), 0);
-	    vkal_info.user_device_memory[id].used = 0;
+    if (handle_pool_valid(&vkal_info.user_device_memory, id)) {
+	    VkalDeviceMemoryHandle * handle = (VkalDeviceMemoryHandle*)handle_pool_get(&vkal_info.user_device_memory, id);
+	    VkalMemoryBlock * block = &vkal_info.memory_blocks[handle->block];
+	    free_list_free(&block->free_list, handle->offset, handle->size);
+	    block->used_size -= handle->size;
+	    block->allocation_count--;
+	    if (block->dedicated && block->allocation_count == 0) {
+	        destroy_memory_block(handle->block);
+	    }
+	    handle_pool_free(&vkal_info.user_device_memory, id);
 	    is_destroyed = 1;
     }
     return is_destroyed;
 }
 
-VkDeviceMemory allocate_memory(VkDeviceSize size, uint32_t mem_type_bits)
+void destroy_memory_blocks(void)
+{
+    for (uint32_t i = 0; i < VKAL_MAX_MEMORY_BLOCKS; ++i) {
+        destroy_memory_block(i);
+    }
+}
+
+void vkal_get_allocator_stats(VkalAllocatorStats * out_stats)
+{
+    memset(out_stats, 0, sizeof(VkalAllocatorStats));
+    VkDeviceSize free_bytes = 0;
+    VkDeviceSize largest_free_bytes = 0; // sum of the largest free range of each block
+    for (uint32_t i = 0; i < VKAL_MAX_MEMORY_BLOCKS; ++i) {
+        VkalMemoryBlock * block = &vkal_info.memory_blocks[i];
+        if (!block->used) {
+            continue;
+        }
+        out_stats->block_count++;
+        if (block->dedicated) {
+            out_stats->dedicated_block_count++;
+        }
+        out_stats->allocation_count += block->allocation_count;
+        out_stats->block_bytes += block->size;
+        out_stats->used_bytes += block->used_size;
+        out_stats->free_range_count += block->free_list.count;
+        VkDeviceSize block_largest = 0;
+        for (uint32_t r = 0; r < block->free_list.count; ++r) {
+            VkDeviceSize range_size = block->free_list.ranges[r].size;
+            free_bytes += range_size;
+            block_largest = VKAL_MAX(block_largest, range_size);
+        }
+        largest_free_bytes += block_largest;
+        out_stats->largest_free_range = VKAL_MAX(out_stats->largest_free_range, block_largest);
+    }
+    out_stats->fragmentation = free_bytes ? 1.0f - (float)largest_free_bytes / (float)free_bytes : 0.0f;
+}
+
+VkDeviceMemory allocate_memory(VkDeviceSize size, uint32_t mem_type_bits, VkalMemoryCategory category)
 {
-    VkDeviceMemory memory;
     VkMemoryAllocateInfo memory_info_image = { 0 };
     memory_info_image.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
     memory_info_image.allocationSize = size;
     memory_info_image.memoryTypeIndex = mem_type_bits;
-    VkResult result = vkAllocateMemory(vkal_info.device, &memory_info_image, 0, &memory);
-    VKAL_ASSERT(result && "failed to allocate memory!");
-    return memory;
+    return allocate_tracked_memory(&memory_info_image, category);
+}
+
+void vkal_get_memory_stats(VkalMemoryStats * out_stats)
+{
+    memset(out_stats, 0, sizeof(VkalMemoryStats));
+    VkPhysicalDeviceMemoryProperties const * properties = &vkal_info.memory_properties;
+    VkDeviceSize budget[VK_MAX_MEMORY_HEAPS];
+    VkDeviceSize usage[VK_MAX_MEMORY_HEAPS];
+    query_memory_budget(budget, usage);
+
+    out_stats->heap_count = properties->memoryHeapCount;
+    out_stats->budget_available = vkal_info.memory_budget_enabled;
+    for (uint32_t i = 0; i < properties->memoryHeapCount; ++i) {
+        out_stats->heaps[i].size = properties->memoryHeaps[i].size;
+        out_stats->heaps[i].flags = properties->memoryHeaps[i].flags;
+        out_stats->heaps[i].budget = budget[i];
+        out_stats->heaps[i].usage = usage[i];
+        out_stats->over_budget |= usage[i] > budget[i];
+    }
+    for (uint32_t i = 0; i < vkal_info.memory_allocation_count; ++i) {
+        VkalMemoryAllocation * allocation = &vkal_info.memory_allocations[i];
+        out_stats->heaps[allocation->heap].allocated_bytes += allocation->size;
+        out_stats->heaps[allocation->heap].allocation_count++;
+        if (!allocation->block) {
+            out_stats->category_bytes[allocation->category] += allocation->size;
+            out_stats->category_allocation_count[allocation->category]++;
+        }
+    }
+    // Blocks count for their heap as a whole, but by category only with what is actually allocated in them.
+    for (uint32_t i = 0; i < vkal_info.user_device_memory.slot_count; ++i) {
+        uint32_t id = handle_pool_handle_at(&vkal_info.user_device_memory, i);
+        if (id == VKAL_INVALID_HANDLE) continue;
+        VkalDeviceMemoryHandle * handle = (VkalDeviceMemoryHandle*)handle_pool_get(&vkal_info.user_device_memory, id);
+        out_stats->category_bytes[handle->category] += handle->size;
+        out_stats->category_allocation_count[handle->category]++;
+    }
+}
+
+static char const * memory_category_name(VkalMemoryCategory category)
+{
+    static char const * names[VKAL_MEMORY_CATEGORY_COUNT] = {
+        "other", "texture", "vertex", "uniform", "staging", "acceleration_structure"
+    };
+    return names[category];
+}
+
+/* snprintf that keeps appending to 'buffer' and counts what did not fit. */
+static void json_append(char * buffer, uint32_t buffer_size, uint32_t * length, char const * format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    uint32_t offset = *length < buffer_size ? *length : buffer_size;
+    int written = vsnprintf(buffer ? buffer + offset : NULL, buffer_size - offset, format, args);
+    va_end(args);
+    if (written > 0) {
+        *length += (uint32_t)written;
+    }
+}
+
+uint32_t vkal_memory_stats_to_json(char * buffer, uint32_t buffer_size)
+{
+    VkalMemoryStats stats;
+    vkal_get_memory_stats(&stats);
+
+    uint32_t length = 0;
+    json_append(buffer, buffer_size, &length, "{\"budget_available\":%s,\"over_budget\":%s,\"heaps\":[",
+                stats.budget_available ? "true" : "false", stats.over_budget ? "true" : "false");
+    for (uint32_t i = 0; i < stats.heap_count; ++i) {
+        VkalMemoryHeapStats * heap = &stats.heaps[i];
+        json_append(buffer, buffer_size, &length,
+                    "%s{\"index\":%u,\"device_local\":%s,\"size\":%llu,\"budget\":%llu,\"usage\":%llu,\"allocated\":%llu,\"allocations\":%u}",
+                    i ? "," : "", i, (heap->flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) ? "true" : "false",
+                    (unsigned long long)heap->size, (unsigned long long)heap->budget, (unsigned long long)heap->usage,
+                    (unsigned long long)heap->allocated_bytes, heap->allocation_count);
+    }
+    json_append(buffer, buffer_size, &length, "],\"categories\":{");
+    for (uint32_t i = 0; i < VKAL_MEMORY_CATEGORY_COUNT; ++i) {
+        json_append(buffer, buffer_size, &length, "%s\"%s\":{\"bytes\":%llu,\"allocations\":%u}",
+                    i ? "," : "", memory_category_name((VkalMemoryCategory)i),
+                    (unsigned long long)stats.category_bytes[i], stats.category_allocation_count[i]);
+    }
+    json_append(buffer, buffer_size, &length, "}}");
+    return length;
 }
 
 VkalBuffer create_buffer(uint32_t size, VkBufferUsageFlags usage)
@@ -3114,17 +6768,27 @@ VkalBuffer create_buffer(uint32_t size, VkBufferUsageFlags usage)
     VkBufferCreateInfo buffer_info = { 0 };
     buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
     buffer_info.size = size;
-    QueueFamilyIndicies indicies = find_queue_families(vkal_info.physical_device, vkal_info.surface);
+    QueueFamilyIndicies indicies = vkal_info.queue_families;
     buffer_info.pQueueFamilyIndices = &indicies.graphics_family;
     buffer_info.queueFamilyIndexCount = 1;
     buffer_info.usage = usage;
     buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    // Storage buffers are written by async compute and read by graphics. Sharing them between both
+    // families saves us from ownership transfers every frame. Uploads may write them on the transfer
+    // queue, so that family has to be in the set as well.
+    uint32_t concurrent_families[3] = { indicies.graphics_family, indicies.compute_family, indicies.transfer_family };
+    if (vkal_info.dedicated_compute && (usage & VK_BUFFER_USAGE_STORAGE_BUFFER_BIT)) {
+        buffer_info.sharingMode = VK_SHARING_MODE_CONCURRENT;
+        buffer_info.queueFamilyIndexCount = vkal_info.dedicated_transfer ? 3 : 2;
+        buffer_info.pQueueFamilyIndices = concurrent_families;
+    }
     VkResult result = vkCreateBuffer(vkal_info.device, &buffer_info, 0, &vk_buffer);
     VKAL_ASSERT(result && "Failed to create buffer.");
     
     VkalBuffer buffer = { 0 };
     buffer.size = size;
     buffer.usage = usage;
+    buffer.concurrent = buffer_info.sharingMode == VK_SHARING_MODE_CONCURRENT;
     buffer.buffer = vk_buffer;
     return buffer;
 }
@@ -3178,6 +6842,7 @@ void vkal_update_descriptor_set_uniform(
 		descriptor_type, buffer_infos);
 
     vkUpdateDescriptorSets(vkal_info.device, 1, &write_set_uniform, 0, VK_NULL_HANDLE);
+    vkal_info.frame_stats.descriptor_updates++;
 }
 
 void vkal_update_descriptor_set_bufferarray(VkDescriptorSet descriptor_set, VkDescriptorType descriptor_type, 
@@ -3194,6 +6859,7 @@ void vkal_update_descriptor_set_bufferarray(VkDescriptorSet descriptor_set, VkDe
 	descriptor_type, buffer_infos);
 
     vkUpdateDescriptorSets(vkal_info.device, 1, &write_set_uniform, 0, 0);
+    vkal_info.frame_stats.descriptor_updates++;
 }
 
 UniformBuffer vkal_create_uniform_buffer(uint32_t size, uint32_t elements, uint32_t binding)
@@ -3208,40 +6874,45 @@ UniformBuffer vkal_create_uniform_buffer(uint32_t size, uint32_t elements, uint3
     uniform_buffer.size = elements * uniform_buffer.alignment;
     uint64_t next_offset = uniform_buffer.size;
     vkal_info.default_uniform_buffer_offset += next_offset;
+    assert(vkal_info.default_uniform_buffer_offset <= vkal_info.uniform_ring_base && "vkal_create_uniform_buffer: out of uniform memory!");
     return uniform_buffer;
 }
 
+/* Copies 'size' bytes into 'dst_buffer' at 'dst_offset' through the staging ring. Does not block.
+   Set 'overwrite' if the range may still be read by frames in flight. */
+static uint64_t upload_to_buffer(VkalBuffer const * dst_buffer, VkDeviceSize dst_offset, void * data, VkDeviceSize size, uint32_t overwrite)
+{
+    VkDeviceSize staging_offset = 0;
+    void * staging_memory = staging_alloc(size, &staging_offset);
+    memcpy(staging_memory, data, size);
+    staging_flush(staging_offset, size);
+
+    VkCommandBuffer cmd_buffer = upload_command_buffer();
+    VkBufferCopy buffer_copy = { 0 };
+    buffer_copy.dstOffset = dst_offset;
+    buffer_copy.srcOffset = staging_offset;
+    buffer_copy.size = size;
+    vkCmdCopyBuffer(cmd_buffer, vkal_info.staging_buffer.buffer, dst_buffer->buffer, 1, &buffer_copy);
+    if (vkal_info.dedicated_transfer) {
+        VkalUploadBatch * batch = &vkal_info.upload_batches[vkal_info.upload_batch_recording];
+        batch->wait_graphics |= overwrite || vkal_info.upload_sync_graphics;
+        // Concurrent buffers have no owner to transfer.
+        if (!dst_buffer->concurrent) {
+            upload_add_buffer_ownership(dst_buffer->buffer, dst_offset, size);
+        }
+    }
+    return vkal_upload_ticket();
+}
+
 uint64_t vkal_vertex_buffer_add(void * vertices, uint32_t vertex_size, uint32_t vertex_count)
 {
     uint64_t alignment = vkal_info.physical_device_properties.limits.nonCoherentAtomSize;
     uint32_t vertices_in_bytes = vertex_count * vertex_size;
     uint64_t size = (vertices_in_bytes + alignment - 1) & ~(alignment - 1);
     
-    // map staging memory and upload vertex data
-    void * staging_memory;
-    VkResult result = vkMapMemory(vkal_info.device, vkal_info.device_memory_staging, 0, size, 0, &staging_memory);
-    VKAL_ASSERT(result && "failed to map device staging memory!");
-    flush_to_memory(vkal_info.device_memory_staging, staging_memory, vertices, vertices_in_bytes, 0);
-    vkUnmapMemory(vkal_info.device, vkal_info.device_memory_staging);
-    
-    // copy vertex buffer data from staging memory (host visible) to device local memory for every command buffer
+    // copy vertex buffer data from staging memory (host visible) to device local memory
     uint64_t offset = vkal_info.default_vertex_buffer_offset;
-
-	VkCommandBuffer cmd_buffer = vkal_create_command_buffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1);
-	VkBufferCopy buffer_copy = { 0 };
-	buffer_copy.dstOffset = offset;
-	buffer_copy.srcOffset = 0;
-	buffer_copy.size = vertices_in_bytes;
-	vkCmdCopyBuffer(cmd_buffer,
-			vkal_info.staging_buffer.buffer, vkal_info.default_vertex_buffer.buffer, 1, &buffer_copy);
-	vkEndCommandBuffer(cmd_buffer);
-    
-    VkSubmitInfo submit_info = { 0 };
-    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submit_info.commandBufferCount = 1;// vkal_info.command_buffer_count;
-	submit_info.pCommandBuffers = &cmd_buffer;
-    vkQueueSubmit(vkal_info.graphics_queue, 1, &submit_info, VK_NULL_HANDLE);
-    vkDeviceWaitIdle(vkal_info.device);
+    upload_to_buffer(&vkal_info.default_vertex_buffer, offset, vertices, vertices_in_bytes, 0);
     
     // When mapping memory later again to copy into it (see:fluch_to_memory) we must respect
     // the devices alignment.
@@ -3254,38 +6925,17 @@ uint64_t vkal_vertex_buffer_add(void * vertices, uint32_t vertex_size, uint32_t
 void vkal_vertex_buffer_reset(void)
 {
     vkal_info.default_vertex_buffer_offset = 0;
+    vkal_info.upload_sync_graphics = 1;
 }
 
 // NOTE: If vertex_count is higher than the current buffer, vertex data after offset+vertex_count (in bytes) will be overwritten!!!
-void vkal_vertex_buffer_update(void* vertices, uint32_t vertex_count, uint32_t vertex_size, VkDeviceSize offset)
+// Returns the upload ticket, see vkal_wait_upload.
+uint64_t vkal_vertex_buffer_update(void* vertices, uint32_t vertex_count, uint32_t vertex_size, VkDeviceSize offset)
 {
-    uint64_t alignment = vkal_info.physical_device_properties.limits.nonCoherentAtomSize;
     uint32_t vertices_in_bytes = vertex_count * vertex_size;
-    uint64_t size = (vertices_in_bytes + alignment - 1) & ~(alignment - 1);
-
-    // map staging memory and upload vertex data
-    void* staging_memory;
-    VkResult result = vkMapMemory(vkal_info.device, vkal_info.device_memory_staging, 0, size, 0, &staging_memory);
-    VKAL_ASSERT(result && "failed to map device staging memory!");
-    flush_to_memory(vkal_info.device_memory_staging, staging_memory, vertices, vertices_in_bytes, 0);
-    vkUnmapMemory(vkal_info.device, vkal_info.device_memory_staging);
 
     // copy vertex buffer data from staging memory (host visible) to device local memory at offset position
-    VkCommandBuffer cmd_buffer = vkal_create_command_buffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1);
-    VkBufferCopy buffer_copy = { 0 };
-    buffer_copy.dstOffset = offset;
-    buffer_copy.srcOffset = 0;
-    buffer_copy.size = vertices_in_bytes;
-    vkCmdCopyBuffer(cmd_buffer,
-        vkal_info.staging_buffer.buffer, vkal_info.default_vertex_buffer.buffer, 1, &buffer_copy);
-    vkEndCommandBuffer(cmd_buffer);
-
-    VkSubmitInfo submit_info = { 0 };
-    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submit_info.commandBufferCount = 1;// vkal_info.command_buffer_count;
-    submit_info.pCommandBuffers = &cmd_buffer;
-    vkQueueSubmit(vkal_info.graphics_queue, 1, &submit_info, VK_NULL_HANDLE);
-    vkDeviceWaitIdle(vkal_info.device);
+    return upload_to_buffer(&vkal_info.default_vertex_buffer, offset, vertices, vertices_in_bytes, 1);
 }
 
 uint64_t vkal_index_buffer_add(void * indices, uint32_t index_count)
@@ -3294,29 +6944,9 @@ uint64_t vkal_index_buffer_add(void * indices, uint32_t index_count)
     uint32_t indices_in_bytes = index_count * vkal_index_size;
     uint64_t size = (indices_in_bytes + alignment - 1) & ~(alignment - 1);
     
-    // map staging memory and upload index data
-    void * staging_memory;
-    VkResult result = vkMapMemory(vkal_info.device, vkal_info.device_memory_staging, 0, size, 0, &staging_memory);
-    VKAL_ASSERT(result && "failed to map device staging memory!");
-    flush_to_memory(vkal_info.device_memory_staging, staging_memory, indices, indices_in_bytes, 0);
-    vkUnmapMemory(vkal_info.device, vkal_info.device_memory_staging);
-    
     // copy vertex index data from staging memory (host visible) to device local memory through a command buffer
     uint64_t offset = vkal_info.default_index_buffer_offset;
-	VkCommandBuffer cmd_buffer = vkal_create_command_buffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1);
-	VkBufferCopy buffer_copy = { 0 };
-	buffer_copy.dstOffset = offset;
-	buffer_copy.srcOffset = 0;
-	buffer_copy.size = indices_in_bytes;
-	vkCmdCopyBuffer(cmd_buffer, vkal_info.staging_buffer.buffer, vkal_info.default_index_buffer.buffer, 1, &buffer_copy);
-	vkEndCommandBuffer(cmd_buffer);
-    
-    VkSubmitInfo submit_info = { 0 };
-    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	submit_info.commandBufferCount = 1; // vkal_info.default_command_buffer_count;
-	submit_info.pCommandBuffers = &cmd_buffer;  //vkal_info.default_command_buffers;
-    vkQueueSubmit(vkal_info.graphics_queue, 1, &submit_info, VK_NULL_HANDLE);
-    vkDeviceWaitIdle(vkal_info.device);
+    upload_to_buffer(&vkal_info.default_index_buffer, offset, indices, indices_in_bytes, 0);
     
     // When mapping memory later again to copy into it (see:fluch_to_memory) we must respect
     // the devices alignment.
@@ -3331,29 +6961,8 @@ uint64_t vkal_index_buffer_update(void *indices, uint32_t index_count, uint32_t
     uint32_t indices_in_bytes = index_count * vkal_index_size;
     uint64_t size = (indices_in_bytes + alignment - 1) & ~(alignment - 1);
 
-    // map staging memory and upload index data
-    void *staging_memory;
-    VkResult result = vkMapMemory(vkal_info.device, vkal_info.device_memory_staging, 0, size, 0, &staging_memory);
-    VKAL_ASSERT(result && "failed to map device staging memory!");
-    flush_to_memory(vkal_info.device_memory_staging, staging_memory, indices, indices_in_bytes, 0);
-    vkUnmapMemory(vkal_info.device, vkal_info.device_memory_staging);
-
     // copy vertex index data from staging memory (host visible) to device local memory through a command buffer
-    VkCommandBuffer cmd_buffer = vkal_create_command_buffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1);
-    VkBufferCopy buffer_copy = {0};
-    buffer_copy.dstOffset = offset;
-    buffer_copy.srcOffset = 0;
-    buffer_copy.size = indices_in_bytes;
-    vkCmdCopyBuffer(cmd_buffer, vkal_info.staging_buffer.buffer, vkal_info.default_index_buffer.buffer, 1,
-                    &buffer_copy);
-    vkEndCommandBuffer(cmd_buffer);
-
-    VkSubmitInfo submit_info = {0};
-    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submit_info.commandBufferCount = 1; // vkal_info.default_command_buffer_count;
-    submit_info.pCommandBuffers = &cmd_buffer;  //vkal_info.default_command_buffers;
-    vkQueueSubmit(vkal_info.graphics_queue, 1, &submit_info, VK_NULL_HANDLE);
-    vkDeviceWaitIdle(vkal_info.device);
+    upload_to_buffer(&vkal_info.default_index_buffer, offset, indices, indices_in_bytes, 1);
 
     // When mapping memory later again to copy into it (see:fluch_to_memory) we must respect
     // the devices alignment.
@@ -3366,6 +6975,115 @@ uint64_t vkal_index_buffer_update(void *indices, uint32_t index_count, uint32_t
 void vkal_index_buffer_reset(void)
 {
     vkal_info.default_index_buffer_offset = 0;
+    vkal_info.upload_sync_graphics = 1;
+}
+
+VkalDrawList vkal_create_draw_list(uint32_t max_draw_count, uint32_t indexed)
+{
+    VkalDrawList draw_list = { 0 };
+    draw_list.indexed = indexed;
+    draw_list.max_draw_count = max_draw_count;
+    draw_list.stride = indexed ? sizeof(VkDrawIndexedIndirectCommand) : sizeof(VkDrawIndirectCommand);
+    VkDeviceSize alignment = VKAL_MAX(vkal_info.physical_device_properties.limits.minStorageBufferOffsetAlignment, 4);
+    VkDeviceSize size = VKAL_DRAW_LIST_HEADER_SIZE + (VkDeviceSize)max_draw_count * draw_list.stride;
+    draw_list.region_size = ((size + alignment - 1) / alignment) * alignment;
+
+    VkBufferUsageFlags usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    VkDeviceSize buffer_size = vkal_info.frames_in_flight * draw_list.region_size;
+    draw_list.memory = vkal_allocate_devicememory((uint32_t)buffer_size, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0);
+    draw_list.buffer = vkal_create_buffer(buffer_size, &draw_list.memory, usage);
+    return draw_list;
+}
+
+void vkal_destroy_draw_list(VkalDrawList * draw_list)
+{
+    vkal_destroy_buffer(&draw_list->buffer);
+    vkal_free_devicememory(&draw_list->memory);
+    memset(draw_list, 0, sizeof(VkalDrawList));
+}
+
+VkDeviceSize vkal_draw_list_offset(VkalDrawList const * draw_list)
+{
+    return vkal_info.frames_rendered * draw_list->region_size;
+}
+
+uint64_t vkal_draw_list_upload(VkalDrawList * draw_list, void const * commands, uint32_t count)
+{
+    assert(count <= draw_list->max_draw_count && "vkal_draw_list_upload: too many draws!");
+    draw_list->draw_counts[vkal_info.frames_rendered] = count;
+    VkDeviceSize offset = vkal_draw_list_offset(draw_list);
+    uint32_t header[VKAL_DRAW_LIST_HEADER_SIZE / sizeof(uint32_t)] = { count };
+    upload_to_buffer(&draw_list->buffer, offset, header, sizeof(header), 0);
+    if (!count) {
+        return vkal_upload_ticket();
+    }
+    return upload_to_buffer(&draw_list->buffer, offset + VKAL_DRAW_LIST_HEADER_SIZE, (void*)commands, (VkDeviceSize)count * draw_list->stride, 0);
+}
+
+void vkal_draw_list_begin(VkCommandBuffer command_buffer, VkalDrawList * draw_list)
+{
+    draw_list->draw_counts[vkal_info.frames_rendered] = VKAL_DRAW_LIST_GPU_COUNT;
+    // Without drawIndirectCount all max_draw_count commands are drawn, so the unused ones must be zero (no instances).
+    VkDeviceSize offset = vkal_draw_list_offset(draw_list);
+    VkDeviceSize size = vkal_info.draw_indirect_count ? sizeof(uint32_t) : draw_list->region_size;
+    vkCmdFillBuffer(command_buffer, draw_list->buffer.buffer, offset, size, 0);
+
+    VkBufferMemoryBarrier barrier = { 0 };
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = draw_list->buffer.buffer;
+    barrier.offset = offset;
+    barrier.size = draw_list->region_size;
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         0, 0, NULL, 1, &barrier, 0, NULL);
+}
+
+void vkal_draw_list_end(VkCommandBuffer command_buffer, VkalDrawList * draw_list)
+{
+    VkBufferMemoryBarrier barrier = { 0 };
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = draw_list->buffer.buffer;
+    barrier.offset = vkal_draw_list_offset(draw_list);
+    barrier.size = draw_list->region_size;
+    // On the async compute queue the semaphore of vkal_compute_submit does the rest.
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+                         0, 0, NULL, 1, &barrier, 0, NULL);
+}
+
+void vkal_draw_list_draw(VkCommandBuffer command_buffer, VkPipeline pipeline, VkalDrawList * draw_list)
+{
+    VkDeviceSize offset = vkal_draw_list_offset(draw_list);
+    uint32_t draw_count = draw_list->draw_counts[vkal_info.frames_rendered];
+    if (draw_count == VKAL_DRAW_LIST_GPU_COUNT) {
+        if (vkal_info.draw_indirect_count) {
+            if (draw_list->indexed) {
+                vkal_draw_indexed_indirect_count(command_buffer, pipeline, draw_list->buffer.buffer, offset + VKAL_DRAW_LIST_HEADER_SIZE,
+                                                 draw_list->buffer.buffer, offset, draw_list->max_draw_count, draw_list->stride);
+            }
+            else {
+                vkal_draw_indirect_count(command_buffer, pipeline, draw_list->buffer.buffer, offset + VKAL_DRAW_LIST_HEADER_SIZE,
+                                         draw_list->buffer.buffer, offset, draw_list->max_draw_count, draw_list->stride);
+            }
+            return;
+        }
+        draw_count = draw_list->max_draw_count; // Zeroed by vkal_draw_list_begin.
+    }
+    if (!draw_count) {
+        return;
+    }
+    if (draw_list->indexed) {
+        vkal_draw_indexed_indirect(command_buffer, pipeline, draw_list->buffer.buffer, offset + VKAL_DRAW_LIST_HEADER_SIZE, draw_count, draw_list->stride);
+    }
+    else {
+        vkal_draw_indirect(command_buffer, pipeline, draw_list->buffer.buffer, offset + VKAL_DRAW_LIST_HEADER_SIZE, draw_count, draw_list->stride);
+    }
 }
 
 VkDeviceAddress vkal_get_buffer_device_address(VkBuffer buffer)
@@ -3384,6 +7102,8 @@ void vkal_cleanup(void) {
 
 
     vkQueueWaitIdle(vkal_info.graphics_queue);
+    destroy_job_pool();
+    retire_swapchains(1);
     
     VKAL_FREE(vkal_info.available_instance_extensions);
     VKAL_FREE(vkal_info.available_instance_layers);
@@ -3402,69 +7122,97 @@ void vkal_cleanup(void) {
 		vkDestroyCommandPool(vkal_info.device, vkal_info.default_command_pools[i], 0);
     }
 	
-    for (uint32_t i = 0; i < VKAL_MAX_VKDEVICEMEMORY; ++i) {
-        vkal_destroy_device_memory(i);
+    for (uint32_t i = 0; i < vkal_info.user_device_memory.slot_count; ++i) {
+        vkal_destroy_device_memory(handle_pool_handle_at(&vkal_info.user_device_memory, i));
+    }
+    destroy_memory_blocks();
+    destroy_upload_batches();
+    destroy_compute_resources();
+    destroy_frame_command_pools();
+    free_memory(vkal_info.device_memory_staging);
+    vkUnmapMemory(vkal_info.device, vkal_info.device_memory_transient);
+    free_memory(vkal_info.device_memory_transient);
+    free_memory(vkal_info.default_device_memory_index);
+    vkUnmapMemory(vkal_info.device, vkal_info.default_device_memory_uniform);
+    free_memory(vkal_info.default_device_memory_uniform);
+    free_memory(vkal_info.default_device_memory_vertex);
+    if (vkal_info.headless_readback_buffer.buffer != VK_NULL_HANDLE) {
+        vkDestroyBuffer(vkal_info.device, vkal_info.headless_readback_buffer.buffer, 0);
+        free_memory(vkal_info.device_memory_headless_readback);
     }
-    vkFreeMemory(vkal_info.device, vkal_info.device_memory_staging, 0); 
-    vkFreeMemory(vkal_info.device, vkal_info.default_device_memory_index, 0);
-    vkFreeMemory(vkal_info.device, vkal_info.default_device_memory_uniform, 0);
-    vkFreeMemory(vkal_info.device, vkal_info.default_device_memory_vertex, 0);
     
     for (uint32_t i = 0; i < VKAL_MAX_IMAGES_IN_FLIGHT; ++i) {
 		vkDestroyFence(vkal_info.device, vkal_info.in_flight_fences[i], NULL);
 		vkDestroySemaphore(vkal_info.device, vkal_info.render_finished_semaphores[i], NULL);
 		vkDestroySemaphore(vkal_info.device, vkal_info.image_available_semaphores[i], NULL);
     }
+    if (vkal_info.timeline_semaphore != VK_NULL_HANDLE) {
+        vkDestroySemaphore(vkal_info.device, vkal_info.timeline_semaphore, NULL);
+        vkal_info.timeline_semaphore = VK_NULL_HANDLE;
+    }
+    destroy_gpu_profiler();
     
     vkDestroyBuffer(vkal_info.device, vkal_info.default_uniform_buffer.buffer, 0);
     vkDestroyBuffer(vkal_info.device, vkal_info.default_vertex_buffer.buffer, 0);
     vkDestroyBuffer(vkal_info.device, vkal_info.default_index_buffer.buffer, 0);
     vkDestroyBuffer(vkal_info.device, vkal_info.staging_buffer.buffer, 0);
+    vkDestroyBuffer(vkal_info.device, vkal_info.transient_buffer.buffer, 0);
     
-    for (uint32_t i = 0; i < VKAL_MAX_VKIMAGEVIEW; ++i) {
-        vkal_destroy_image_view(i);
+    for (uint32_t i = 0; i < vkal_info.user_image_views.slot_count; ++i) {
+        vkal_destroy_image_view(handle_pool_handle_at(&vkal_info.user_image_views, i));
     }
-    for (uint32_t i = 0; i < VKAL_MAX_VKIMAGE; ++i) {
-        vkal_destroy_image(i);
+    for (uint32_t i = 0; i < vkal_info.user_images.slot_count; ++i) {
+        vkal_destroy_image(handle_pool_handle_at(&vkal_info.user_images, i));
     }
 
-    for (uint32_t i = 0; i < VKAL_MAX_VKSHADERMODULE; ++i) {
-		destroy_shader_module(i);
+    for (uint32_t i = 0; i < vkal_info.user_shader_modules.slot_count; ++i) {
+		destroy_shader_module(handle_pool_handle_at(&vkal_info.user_shader_modules, i));
     }
 
-    for (uint32_t i = 0; i < VKAL_MAX_VKPIPELINELAYOUT; ++i) {
-		destroy_pipeline_layout(i);
+    for (uint32_t i = 0; i < vkal_info.user_pipeline_layouts.slot_count; ++i) {
+		destroy_pipeline_layout(handle_pool_handle_at(&vkal_info.user_pipeline_layouts, i));
     }
 
-    for (uint32_t i = 0; i < VKAL_MAX_VKDESCRIPTORSETLAYOUT; ++i) {
-		destroy_descriptor_set_layout(i);
+    for (uint32_t i = 0; i < vkal_info.user_descriptor_set_layouts.slot_count; ++i) {
+		destroy_descriptor_set_layout(handle_pool_handle_at(&vkal_info.user_descriptor_set_layouts, i));
     }
 
-    for (uint32_t i = 0; i < VKAL_MAX_VKPIPELINE; ++i) {
-		destroy_graphics_pipeline(i);
+    for (uint32_t i = 0; i < vkal_info.user_pipelines.slot_count; ++i) {
+		destroy_graphics_pipeline(handle_pool_handle_at(&vkal_info.user_pipelines, i));
     }
+    destroy_pipeline_registry();
+    vkal_save_pipeline_cache();
+    vkDestroyPipelineCache(vkal_info.device, vkal_info.pipeline_cache, 0);
+    vkal_info.pipeline_cache = VK_NULL_HANDLE;
 
-    for (uint32_t i = 0; i < VKAL_MAX_VKSAMPLER; ++i) {
-		destroy_sampler(i);
+    for (uint32_t i = 0; i < vkal_info.user_samplers.slot_count; ++i) {
+		destroy_sampler(handle_pool_handle_at(&vkal_info.user_samplers, i));
     }
 
-    for (uint32_t i = 0; i < VKAL_MAX_VKFRAMEBUFFER; ++i) {
-		destroy_framebuffer(i);
+    for (uint32_t i = 0; i < vkal_info.user_framebuffers.slot_count; ++i) {
+		destroy_framebuffer(handle_pool_handle_at(&vkal_info.user_framebuffers, i));
     }
+    destroy_handle_pools();
 
     vkDestroyDescriptorPool(vkal_info.device, vkal_info.default_descriptor_pool, 0);
     
-    vkDestroySurfaceKHR(vkal_info.instance, vkal_info.surface, 0);
+    if (!vkal_info.headless) {
+        vkDestroySurfaceKHR(vkal_info.instance, vkal_info.surface, 0);
 
 #if defined (VKAL_GLFW)
-    glfwDestroyWindow(vkal_info.window);
+        glfwDestroyWindow(vkal_info.window);
 #elif defined (VKAL_WIN32)
-    DestroyWindow(vkal_info.window);
+        DestroyWindow(vkal_info.window);
 #elif defined (VKAL_SDL)
 
 #endif
+    }
     vkDestroyDevice(vkal_info.device, 0);
     vkDestroyInstance(vkal_info.instance, 0);
+    VKAL_FREE(vkal_info.memory_allocations);
+    vkal_info.memory_allocations = NULL;
+    vkal_info.memory_allocation_count = 0;
+    vkal_info.memory_allocation_capacity = 0;
 
 #ifdef VKAL_GLFW
     glfwTerminate();
@@ -36,22 +36,51 @@
 #define UNIFORM_BUFFER_SIZE				(64 * VKAL_MB)
 #define VERTEX_BUFFER_SIZE				(64 * VKAL_MB)
 #define INDEX_BUFFER_SIZE				(64 * VKAL_MB)
+#define VKAL_TRANSIENT_BUFFER_SIZE		(32 * VKAL_MB) /* Scratch memory handed out by vkal_transient_alloc. */
+#define VKAL_UNIFORM_RING_SIZE			(16 * VKAL_MB) /* Tail of the default uniform buffer, split between frames in flight. */
 
 #define VKAL_MAX_SWAPCHAIN_IMAGES		4
+#define VKAL_MAX_PRESENT_MODES			9
 #define VKAL_MAX_IMAGES_IN_FLIGHT		4
+#define VKAL_MAX_RETIRED_SWAPCHAINS		4 /* Replaced swapchains waiting for their last frames to finish. */
+#define VKAL_FRAMES_IN_FLIGHT			2 /* Default, see vkal_set_frames_in_flight. */
+#define VKAL_MAX_GPU_SCOPES				64 /* Timestamp scopes per frame, see vkal_gpu_scope_begin. */
+#define VKAL_GPU_SCOPE_NAME_LENGTH		32
+#define VKAL_MAX_STATISTICS_SCOPES		16 /* Pipeline statistics scopes per frame, see vkal_statistics_scope_begin. */
+#define VKAL_MAX_OCCLUSION_QUERIES		256 /* Ids available to vkal_occlusion_query_begin. */
+#define VKAL_FRAME_STATS_HISTORY		128 /* Frames kept by vkal_get_frame_stats_history. */
 #define VKAL_MAX_DESCRIPTOR_SETS		10
 #define VKAL_MAX_COMMAND_POOLS			2
-#define VKAL_MAX_VKDEVICEMEMORY			128
+#define VKAL_MAX_MEMORY_BLOCKS			64
+#define VKAL_MEMORY_BLOCK_SIZE			(256 * VKAL_MB)
+#define VKAL_MAX_TEXTURES				10
+/* Initial capacities of the handle pools. They grow on demand. */
+#define VKAL_MAX_VKDEVICEMEMORY			1024 /* Sub-allocations, not VkDeviceMemory objects. */
 #define VKAL_MAX_VKIMAGE				128
 #define VKAL_MAX_VKIMAGEVIEW			128
 #define VKAL_MAX_VKSHADERMODULE			64
 #define VKAL_MAX_VKPIPELINELAYOUT		64
 #define VKAL_MAX_VKDESCRIPTORSETLAYOUT	128
 #define VKAL_MAX_VKPIPELINE				64
+#define VKAL_PIPELINE_REGISTRY_SIZE		128 /* Initial slot count of the pipeline registry, power of two. */
 #define VKAL_MAX_VKSAMPLER				128
-#define VKAL_MAX_TEXTURES				10
 #define VKAL_MAX_VKFRAMEBUFFER			64
-#define VKAL_VSYNC_ON					1
+#define VKAL_MAX_UPLOAD_BATCHES			8
+#define VKAL_MAX_UPLOAD_BARRIERS		64
+#define VKAL_MAX_UNIFORM_DIRTY_RANGES	64
+#define VKAL_VSYNC_ON					1 /* Default present mode preference, see vkal_set_present_modes. */
+#define VKAL_FRAME_LIMITER_SPIN_NS		2000000 /* The frame limiter busy-waits for the last part of the frame instead of sleeping. */
+#define VKAL_USE_TRANSFER_QUEUE			1 /* Route uploads through a transfer-only queue family if the device has one. */
+#define VKAL_USE_COMPUTE_QUEUE			1 /* Use a compute family without graphics for vkal_compute_submit if available. */
+#define VKAL_USE_TIMELINE_SEMAPHORE		1 /* Track graphics queue submissions on a timeline semaphore if the device supports it (Vulkan 1.2). */
+#define VKAL_PIPELINE_CACHE_FILE		"vkal_pipeline_cache.bin" /* Default, see vkal_set_pipeline_cache_path. */
+#define VKAL_MAX_PATH					256
+#define VKAL_MAX_COLOR_ATTACHMENTS		8
+#define VKAL_MAX_DYNAMIC_STATES			16
+#define VKAL_WORKER_THREADS				0  /* 0: one per core, minus the main thread. */
+#define VKAL_MAX_WORKER_THREADS			16
+#define VKAL_BIND_STATE_CACHE_SIZE		8  /* Command buffers per thread whose bound state is remembered. */
+#define VKAL_HEADLESS_FORMAT			VK_FORMAT_R8G8B8A8_UNORM
 #define VKAL_SHADOW_MAP_DIMENSION		2048
 
 // TODO: Error code to string
@@ -73,6 +102,8 @@
 
 #define VKAL_MALLOC(pointer, count) pointer = malloc(count * sizeof(*pointer))
 
+#define VKAL_REALLOC(pointer, count) pointer = realloc(pointer, count * sizeof(*pointer))
+
 #define VKAL_FREE(pointer) free(pointer)					
 
 #define VKAL_ARRAY_LENGTH(arr)		\
@@ -108,13 +139,34 @@ typedef struct VkalTexture
     char      texture_file[64];
 } VkalTexture;
 
+typedef struct VkalMemoryRange
+{
+    VkDeviceSize offset;
+    VkDeviceSize size;
+} VkalMemoryRange;
+
+/* Free ranges of a block, sorted by offset. Adjacent ranges are merged on free. */
+typedef struct VkalFreeList
+{
+    VkalMemoryRange * ranges;
+    uint32_t          count;
+    uint32_t          capacity;
+} VkalFreeList;
+
+/* Memory for user buffers created with vkal_create_buffer. The free list lives on the heap so
+   copies of a DeviceMemory all see the same state. Release it with vkal_free_devicememory.
+   Device local memory is a linear range inside one of the allocator's blocks, 'offset' is where it starts
+   and the free list hands out offsets into the block's VkDeviceMemory. */
 typedef struct DeviceMemory
 {
     VkDeviceMemory vk_device_memory;
+    VkDeviceSize   offset;
+    uint32_t       memory_id;    /* Sub-allocation, VKAL_INVALID_HANDLE if vk_device_memory is its own. */
     VkDeviceSize   size;
     VkDeviceSize   alignment;
-    VkDeviceSize   free;
+    VkDeviceSize   free;         /* High-water mark: end of the highest range handed out so far. */
     uint32_t       mem_type_index;
+    VkalFreeList   * free_list;
 } DeviceMemory;
 
 typedef struct VkalBuffer
@@ -125,10 +177,38 @@ typedef struct VkalBuffer
     /* TODO: Remove device_memory as vkal_device_memory has handle to the VkDeviceMemory */
     VkDeviceMemory		device_memory;
     DeviceMemory        * vkal_device_memory;
+    VkalFreeList        * free_list; /* Where vkal_destroy_buffer returns the range to. */
+    VkDeviceSize        allocated_size;
     VkBufferUsageFlags	usage;
+    uint32_t			concurrent; /* VK_SHARING_MODE_CONCURRENT: queues use it without ownership transfers. */
     void				* mapped;
 } VkalBuffer;
 
+/* Scratch memory from vkal_transient_alloc. Valid until the frame it was allocated in has finished. */
+typedef struct VkalTransientAllocation
+{
+    VkalBuffer          buffer; /* The shared transient buffer. */
+    VkDeviceSize        offset; /* Offset into 'buffer' to pass to binds/draws. */
+    void                * data; /* Host pointer to write the data to. */
+} VkalTransientAllocation;
+
+/* Indirect draw commands filled either from the CPU or by a compute pass, one region per frame in flight.
+   A region starts with a uint32_t draw count, padded to VKAL_DRAW_LIST_HEADER_SIZE bytes, followed by
+   max_draw_count VkDrawIndirectCommand or VkDrawIndexedIndirectCommand. */
+#define VKAL_DRAW_LIST_HEADER_SIZE		16
+#define VKAL_DRAW_LIST_GPU_COUNT		0xFFFFFFFF /* The draw count is written by the GPU. */
+
+typedef struct VkalDrawList
+{
+    VkalBuffer      buffer;         /* STORAGE | INDIRECT | TRANSFER_DST, device local. */
+    DeviceMemory    memory;
+    uint32_t        indexed;
+    uint32_t        max_draw_count;
+    uint32_t        stride;
+    VkDeviceSize    region_size;    /* Multiple of minStorageBufferOffsetAlignment. */
+    uint32_t        draw_counts[VKAL_MAX_IMAGES_IN_FLIGHT];
+} VkalDrawList;
+
 typedef struct VkalImage
 {
     uint32_t      image;
@@ -160,50 +240,302 @@ typedef struct DescriptorSetLayout
     VkDescriptorSetLayout	layout;
 } DescriptorSetLayout;
 
+/* Handles are 32 bit: the low VKAL_HANDLE_INDEX_BITS are the slot, the rest is the generation
+   of the slot. The generation changes whenever a slot is freed, so stale handles are caught. */
+#define VKAL_INVALID_HANDLE				0xFFFFFFFF
+#define VKAL_INVALID_IMAGE				0xFFFFFFFF /* vkal_get_image: no image this frame, skip it. */
+#define VKAL_HANDLE_INDEX_BITS			20
+#define VKAL_HANDLE_INDEX_MASK			((1u << VKAL_HANDLE_INDEX_BITS) - 1)
+#define VKAL_HANDLE_GENERATION_MASK		((1u << (32 - VKAL_HANDLE_INDEX_BITS)) - 1)
+
+typedef struct VkalHandlePool
+{
+    uint8_t     * items;
+    uint32_t    item_size;
+    uint16_t    * generations; /* Current generation of each slot. Never 0. */
+    uint8_t     * used;
+    uint32_t    * free_slots;  /* Stack of released slots. */
+    uint32_t    free_count;
+    uint32_t    slot_count;    /* Slots handed out so far. Iterate [0, slot_count) with handle_pool_handle_at. */
+    uint32_t    capacity;
+} VkalHandlePool;
+
+/* What memory is used for. Buffers are classified by their usage flags, images are textures. The sub-allocator's
+   blocks are not categorized themselves, each sub-allocation inside them is. */
+typedef enum VkalMemoryCategory
+{
+    VKAL_MEMORY_CATEGORY_OTHER = 0,
+    VKAL_MEMORY_CATEGORY_TEXTURE,
+    VKAL_MEMORY_CATEGORY_VERTEX, /* Vertex, index and indirect buffers. */
+    VKAL_MEMORY_CATEGORY_UNIFORM,
+    VKAL_MEMORY_CATEGORY_STAGING, /* Host visible memory for uploads, readback and per-frame data. */
+    VKAL_MEMORY_CATEGORY_ACCELERATION_STRUCTURE,
+    VKAL_MEMORY_CATEGORY_COUNT
+} VkalMemoryCategory;
+
+/* A sub-allocation inside one of the memory blocks. Resources must be bound at 'offset'. */
 typedef struct VkalDeviceMemoryHandle {
     VkDeviceMemory device_memory;
-    uint8_t        used;
+    VkDeviceSize   offset;
+    VkDeviceSize   size;
+    uint32_t       block;
+    VkalMemoryCategory category;
 } VkalDeviceMemoryHandle;
 
+/* A single VkDeviceMemory that is shared by many resources. Linear resources (buffers) and optimal
+   tiled images never share a block, so bufferImageGranularity cannot be violated. */
+typedef struct VkalMemoryBlock
+{
+    VkDeviceMemory device_memory;
+    VkDeviceSize   size;
+    VkDeviceSize   used_size;
+    uint32_t       mem_type_index;
+    uint32_t       linear;
+    uint32_t       dedicated;
+    uint32_t       allocation_count;
+    VkalFreeList   free_list;
+    uint8_t        used;
+} VkalMemoryBlock;
+
+/* Ring of bytes inside a buffer. Space is handed out at 'head' and given back in the same
+   order at 'tail'. An allocation never wraps around the end, the remainder is skipped instead. */
+typedef struct VkalRing
+{
+    VkDeviceSize size;
+    VkDeviceSize head;
+    VkDeviceSize tail;
+    VkDeviceSize used;
+} VkalRing;
+
+#define VKAL_UPLOAD_BATCH_FREE          0
+#define VKAL_UPLOAD_BATCH_RECORDING     1
+#define VKAL_UPLOAD_BATCH_SUBMITTED     2
+
+/* Transfers out of the staging ring that get submitted together. Every batch has a ticket that
+   increases monotonically, so waiting for a ticket also waits for all earlier uploads. */
+typedef struct VkalUploadBatch
+{
+    VkCommandBuffer command_buffer;
+    VkFence         fence;
+    uint64_t        ticket;
+    VkDeviceSize    ring_end;
+    uint32_t        state;
+    uint64_t        timeline_value; /* Replaces 'fence' if the timeline is enabled. */
+
+    /* Only used with a dedicated transfer queue: The copies run on the transfer queue, then the
+       graphics queue acquires ownership of everything that was written. */
+    VkCommandBuffer       acquire_command_buffer;
+    VkSemaphore           transfer_done;
+    VkSemaphore           graphics_done;
+    uint32_t              wait_graphics; /* Set if the batch overwrites memory the GPU might still read. */
+    VkBufferMemoryBarrier buffer_barriers[VKAL_MAX_UPLOAD_BARRIERS];
+    uint32_t              buffer_barrier_count;
+    VkImageMemoryBarrier  image_barriers[VKAL_MAX_UPLOAD_BARRIERS];
+    uint32_t              image_barrier_count;
+} VkalUploadBatch;
+
+typedef struct VkalAllocatorStats
+{
+    uint32_t     block_count;           /* VkDeviceMemory objects owned by the allocator */
+    uint32_t     dedicated_block_count;
+    uint32_t     allocation_count;      /* live sub-allocations */
+    VkDeviceSize block_bytes;
+    VkDeviceSize used_bytes;
+    uint32_t     free_range_count;
+    VkDeviceSize largest_free_range;
+    float        fragmentation;         /* 0: free memory is contiguous in every block. Approaches 1 the more it is scattered. */
+} VkalAllocatorStats;
+
+typedef struct VkalMemoryAllocation
+{
+    VkDeviceMemory      memory;
+    VkDeviceSize        size;
+    uint32_t            heap;
+    VkalMemoryCategory  category;
+    uint32_t            block; /* Sub-allocator block: Counts for its heap, the categories come from the sub-allocations. */
+} VkalMemoryAllocation;
+
+typedef struct VkalMemoryHeapStats
+{
+    VkDeviceSize      size;
+    VkMemoryHeapFlags flags;
+    VkDeviceSize      allocated_bytes;  /* By VKAL. */
+    uint32_t          allocation_count;
+    VkDeviceSize      budget;           /* From VK_EXT_memory_budget, otherwise the heap size. */
+    VkDeviceSize      usage;            /* Of the whole process with VK_EXT_memory_budget, otherwise allocated_bytes. */
+} VkalMemoryHeapStats;
+
+typedef struct VkalMemoryStats
+{
+    VkalMemoryHeapStats heaps[VK_MAX_MEMORY_HEAPS];
+    uint32_t            heap_count;
+    VkDeviceSize        category_bytes[VKAL_MEMORY_CATEGORY_COUNT];
+    uint32_t            category_allocation_count[VKAL_MEMORY_CATEGORY_COUNT];
+    uint32_t            budget_available;
+    uint32_t            over_budget; /* Some heap's usage exceeds its budget. */
+} VkalMemoryStats;
+
+typedef struct VkalPipelineCacheStats
+{
+    uint32_t     pipelines_created;
+    uint32_t     feedback_available; /* Hits/misses are only known if the device reports creation feedback (Vulkan 1.3). */
+    uint32_t     cache_hits;
+    uint32_t     cache_misses;
+    uint64_t     creation_time_ns;   /* Sum of the reported creation times. */
+    size_t       loaded_size;        /* Bytes of cache data loaded at init. 0 if there was no file or it was rejected. */
+    uint32_t     file_rejected;      /* The file was written by another device or driver. */
+    uint32_t     registry_hits;      /* vkal_create_pipeline calls that returned an existing pipeline. */
+} VkalPipelineCacheStats;
+
+/* Binds issued by the vkal_draw* wrappers, vkal_viewport and vkal_scissor, and how many of them
+   were dropped because the command buffer already had that state bound. */
+typedef struct VkalBindStats
+{
+    uint64_t     pipelines;
+    uint64_t     pipelines_skipped;
+    uint64_t     vertex_buffers;
+    uint64_t     vertex_buffers_skipped;
+    uint64_t     index_buffers;
+    uint64_t     index_buffers_skipped;
+    uint64_t     viewports;
+    uint64_t     viewports_skipped;
+    uint64_t     scissors;
+    uint64_t     scissors_skipped;
+} VkalBindStats;
+
+/* GPU time of one vkal_gpu_scope_begin/end pair. */
+typedef struct VkalGpuScope
+{
+    char         name[VKAL_GPU_SCOPE_NAME_LENGTH];
+    uint32_t     depth; /* Number of scopes that were open at its begin. */
+    double       ms;    /* Negative if the scope was never ended or never executed. */
+} VkalGpuScope;
+
+/* Counters of one vkal_statistics_scope_begin/end pair. The pipeline statistics are 0 if the device
+   lacks pipelineStatisticsQuery. */
+typedef struct VkalPipelineStatistics
+{
+    char         name[VKAL_GPU_SCOPE_NAME_LENGTH];
+    uint32_t     available; /* 0 if the scope was never ended or never executed. */
+    uint64_t     input_vertices;
+    uint64_t     input_primitives;
+    uint64_t     vertex_shader_invocations;
+    uint64_t     clipping_invocations;
+    uint64_t     clipping_primitives; /* Primitives that survived clipping. */
+    uint64_t     fragment_shader_invocations;
+    uint64_t     compute_shader_invocations;
+    uint64_t     samples_passed; /* Exact if the device supports occlusionQueryPrecise, otherwise only 0 / non-0. */
+} VkalPipelineStatistics;
+
+/* CPU side cost of one frame, from the end of one vkal_present to the end of the next. */
+typedef struct VkalFrameStats
+{
+    uint64_t     frame; /* Number of frames presented before this one. */
+    double       frame_ms;
+    double       fence_wait_ms;  /* vkal_get_image waiting for the frame in flight and its swapchain image. Excludes the frame limiter. */
+    double       acquire_ms;     /* vkAcquireNextImageKHR. */
+    double       submit_ms;      /* vkal_queue_submit, including the flushes it does. */
+    double       present_ms;     /* vkQueuePresentKHR and swapchain recreation. */
+    uint64_t     upload_bytes;
+    uint32_t     upload_count;
+    uint32_t     pipeline_creations;
+    uint32_t     descriptor_updates;
+} VkalFrameStats;
+
+typedef struct VkalGpuProfile
+{
+    VkalGpuScope scopes[VKAL_MAX_GPU_SCOPES]; /* In the order they were begun. */
+    uint32_t     scope_count;
+    double       frame_ms; /* From the earliest begin to the latest end. */
+    VkalPipelineStatistics statistics[VKAL_MAX_STATISTICS_SCOPES];
+    uint32_t     statistics_count;
+} VkalGpuProfile;
+
+/* What recreate_swapchain replaced. Destroyed once all work submitted before the recreation has finished. */
+typedef struct VkalRetiredSwapchain
+{
+    VkSwapchainKHR  swapchain;
+    VkImageView     image_views[VKAL_MAX_SWAPCHAIN_IMAGES];
+    uint32_t        image_view_count;
+    VkFramebuffer   * framebuffers;
+    uint32_t        framebuffer_count;
+    uint32_t        depth_image;
+    uint32_t        depth_image_view;
+    uint32_t        depth_memory;   /* VKAL_INVALID_HANDLE if the new depth buffer reuses it. */
+    VkFence         fence;
+    uint64_t        timeline_value; /* Replaces 'fence' if the timeline is enabled. */
+} VkalRetiredSwapchain;
+
+typedef enum VkalLatencyMode
+{
+    VKAL_LATENCY_MODE_THROUGHPUT = 0, /* The CPU may record up to frames_in_flight frames ahead of the GPU. */
+    VKAL_LATENCY_MODE_LOW        = 1  /* vkal_get_image waits until the GPU has finished the previous frame. */
+} VkalLatencyMode;
+
 typedef struct VkalImageHandle {
     VkImage image;
-    uint8_t used;
 } VkalImageHandle;
 
 typedef struct VkalImageViewHandle {
     VkImageView image_view;
-    uint8_t     used;
     uint32_t    offset;
 } VkalImageViewHandle;
 
 typedef struct VkalShaderModuleHandle {
     VkShaderModule shader_module;
-    uint8_t        used;
 } VkalShaderModuleHandle;
 
 typedef struct VkalPipelineLayoutHandle {
     VkPipelineLayout pipeline_layout;
-    uint8_t          used;
 } VkalPipelineLayoutHandle;
 
 typedef struct VkalDescriptorSetLayoutHande {
     VkDescriptorSetLayout descriptor_set_layout;
-    uint8_t               used;
 } VkalDescriptorSetLayoutHande;
 
 typedef struct VkalPipelineHandle {
     VkPipeline pipeline;
-    uint8_t    used;
+    uint64_t   hash;      /* Hash of 'key'. */
+    uint8_t  * key;       /* Serialized VkalPipelineDesc. NULL if the pipeline is not in the registry. */
+    uint32_t   key_size;
+    uint32_t   ref_count; /* Number of vkal_create_pipeline calls not yet matched by vkal_destroy_graphics_pipeline. */
 } VkalPipelineHandle;
 
+/* Open addressing table of pipeline handles, keyed by VkalPipelineHandle.hash. */
+#define VKAL_PIPELINE_REGISTRY_TOMBSTONE 0 /* Never a valid handle, see handle_pool_free. */
+
+typedef struct VkalPipelineRegistry
+{
+    uint32_t * slots;    /* VKAL_INVALID_HANDLE: empty. */
+    uint32_t   capacity; /* Power of two. */
+    uint32_t   count;    /* Live entries. */
+    uint32_t   used;     /* Live entries plus tombstones. */
+} VkalPipelineRegistry;
+
+typedef struct VkalPipelineKey
+{
+    uint8_t  * data;
+    uint32_t   size;
+    uint32_t   capacity;
+} VkalPipelineKey;
+
+/* Transient command pool of one frame in flight. Instead of resetting or freeing single buffers, the pool
+   is reset as a whole once the frame's fence has signaled and its buffers are handed out again. */
+typedef struct VkalFrameCommandPool
+{
+    VkCommandPool         pool;
+    VkCommandBufferLevel  level;
+    VkCommandBuffer       * buffers;
+    uint32_t              buffer_count;
+    uint32_t              used;
+} VkalFrameCommandPool;
+
 typedef struct VkalSamplerHandle {
     VkSampler sampler;
-    uint8_t   used;
 } VkalSamplerHandle;
 
 typedef struct VkalFramebufferHandle {
     VkFramebuffer framebuffer;
-    uint8_t       used;
 } VkalFramebufferHandle;
 
 typedef struct OffscreenPass {
@@ -241,6 +573,17 @@ typedef struct VkalWantedFeatures {
     VkPhysicalDeviceFeatures2                           features2;
 } VkalWantedFeatures;
 
+typedef struct QueueFamilyIndicies {
+    int has_graphics_family;
+    uint32_t graphics_family;
+    int has_present_family;
+    uint32_t present_family;
+    int has_transfer_family; /* A family that supports transfer but neither graphics nor compute. */
+    uint32_t transfer_family;
+    int has_compute_family;  /* A family that supports compute but not graphics (async compute). */
+    uint32_t compute_family;
+} QueueFamilyIndicies;
+
 typedef struct VkalInfo
 {
     
@@ -267,28 +610,64 @@ typedef struct VkalInfo
     VkalPhysicalDevice				* suitable_devices;
     uint32_t						suitable_device_count;
     
+    uint32_t                        instance_api_version;
+
     /* Active Physical Device */
     VkPhysicalDevice				physical_device;
     VkPhysicalDeviceProperties		physical_device_properties;
+    /* Resolved once in create_logical_device, resource creation reads these. */
+    QueueFamilyIndicies				queue_families;
+    VkPhysicalDeviceMemoryProperties	memory_properties;
     
-    VkalDeviceMemoryHandle			user_device_memory[VKAL_MAX_VKDEVICEMEMORY];
-
-    VkalImageHandle					user_images[VKAL_MAX_VKIMAGE];
-    uint32_t						user_image_count;
-
-    VkalImageViewHandle				user_image_views[VKAL_MAX_VKIMAGEVIEW];
-    VkalShaderModuleHandle			user_shader_modules[VKAL_MAX_VKSHADERMODULE];
-    VkalPipelineLayoutHandle		user_pipeline_layouts[VKAL_MAX_VKPIPELINELAYOUT];
-    VkalDescriptorSetLayoutHande	user_descriptor_set_layouts[VKAL_MAX_VKDESCRIPTORSETLAYOUT];
-    VkalPipelineHandle				user_pipelines[VKAL_MAX_VKPIPELINE];
-    VkalSamplerHandle				user_samplers[VKAL_MAX_VKSAMPLER];
-    VkalFramebufferHandle			user_framebuffers[VKAL_MAX_VKFRAMEBUFFER];
+    VkalHandlePool					user_device_memory; /* VkalDeviceMemoryHandle */
+    VkalMemoryBlock					memory_blocks[VKAL_MAX_MEMORY_BLOCKS];
+    /* Every live VkDeviceMemory, see vkal_get_memory_stats. */
+    VkalMemoryAllocation			* memory_allocations;
+    uint32_t						memory_allocation_count;
+    uint32_t						memory_allocation_capacity;
+    uint32_t						memory_budget_enabled; /* VK_EXT_memory_budget */
+
+    VkalHandlePool					user_images;                 /* VkalImageHandle */
+    VkalHandlePool					user_image_views;            /* VkalImageViewHandle */
+    VkalHandlePool					user_shader_modules;         /* VkalShaderModuleHandle */
+    VkalHandlePool					user_pipeline_layouts;       /* VkalPipelineLayoutHandle */
+    VkalHandlePool					user_descriptor_set_layouts; /* VkalDescriptorSetLayoutHande */
+    VkalHandlePool					user_pipelines;              /* VkalPipelineHandle */
+    VkalHandlePool					user_samplers;               /* VkalSamplerHandle */
+    VkalHandlePool					user_framebuffers;           /* VkalFramebufferHandle */
 
     VkDevice	 device; 
     VkQueue		 graphics_queue;
     VkQueue      present_queue;
+    VkQueue      transfer_queue;   /* Same as graphics_queue if there is no dedicated transfer family. */
+    uint32_t     graphics_family;
+    uint32_t     transfer_family;
+    uint32_t     dedicated_transfer;
+    VkCommandPool transfer_command_pool;
+
+    /* Async compute. Same as the graphics queue if there is no dedicated compute family. */
+    VkQueue         compute_queue;
+    uint32_t        compute_family;
+    uint32_t        dedicated_compute;
+    VkCommandPool   compute_command_pool;
+    VkCommandBuffer compute_command_buffers[VKAL_MAX_IMAGES_IN_FLIGHT];
+    VkSemaphore     compute_finished_semaphores[VKAL_MAX_IMAGES_IN_FLIGHT];
+    VkSemaphore     compute_graphics_semaphores[VKAL_MAX_IMAGES_IN_FLIGHT]; /* Graphics queue -> compute: earlier frames and uploads are done. */
+    VkPipelineStageFlags compute_wait_stages[VKAL_MAX_IMAGES_IN_FLIGHT];
+    uint32_t        compute_pending[VKAL_MAX_IMAGES_IN_FLIGHT];
+
+    VkalFrameCommandPool  thread_command_pools[VKAL_MAX_IMAGES_IN_FLIGHT][VKAL_MAX_WORKER_THREADS]; /* Secondaries. */
+    VkalFrameCommandPool  oneshot_command_pools[VKAL_MAX_IMAGES_IN_FLIGHT][2]; /* vkal_create_command_buffer, by VkCommandBufferLevel. */
     VkSurfaceKHR surface;
 
+    /* Headless: No window, no surface and no swapchain. Frames are rendered into
+       offscreen images that take the place of the swapchain images. */
+    uint32_t        headless;
+    uint32_t        headless_images[VKAL_MAX_SWAPCHAIN_IMAGES];
+    uint32_t        headless_image_memory[VKAL_MAX_SWAPCHAIN_IMAGES];
+    VkalBuffer      headless_readback_buffer;
+    VkDeviceMemory  device_memory_headless_readback;
+
     VkSwapchainKHR	swapchain;
     uint32_t		should_recreate_swapchain; // = 0;
     VkImage			swapchain_images[VKAL_MAX_SWAPCHAIN_IMAGES];
@@ -296,12 +675,22 @@ typedef struct VkalInfo
     VkFormat		swapchain_image_format;
     VkExtent2D		swapchain_extent;
     VkImageView		swapchain_image_views[VKAL_MAX_SWAPCHAIN_IMAGES];
+    VkalRetiredSwapchain retired_swapchains[VKAL_MAX_RETIRED_SWAPCHAINS];
+    uint32_t		retired_swapchain_count; /* Oldest first. */
     uint32_t		depth_stencil_image;
     uint32_t		depth_stencil_image_view;
     uint32_t		device_memory_depth_stencil;
 
     VkDeviceMemory	    device_memory_staging;
     VkalBuffer			staging_buffer;
+    void                * staging_mapped;
+    uint32_t            staging_coherent;
+    VkalRing            staging_ring;
+    VkalUploadBatch     upload_batches[VKAL_MAX_UPLOAD_BATCHES];
+    uint32_t            upload_batch_recording; /* VKAL_MAX_UPLOAD_BATCHES if no batch is open */
+    uint64_t            upload_ticket_next;
+    uint64_t            upload_ticket_completed;
+    uint32_t            upload_sync_graphics; /* Set by the reset functions: next adds may overwrite data in use. */
 
     VkRenderPass		render_pass;
     VkRenderPass		render_to_image_render_pass;
@@ -319,7 +708,40 @@ typedef struct VkalInfo
     VkSemaphore			image_available_semaphores[VKAL_MAX_IMAGES_IN_FLIGHT];
     VkSemaphore			render_finished_semaphores[VKAL_MAX_IMAGES_IN_FLIGHT];
     VkFence				in_flight_fences[VKAL_MAX_IMAGES_IN_FLIGHT];
-    uint32_t			frames_rendered;
+    VkFence				images_in_flight[VKAL_MAX_SWAPCHAIN_IMAGES]; /* Fence of the frame that last rendered to a swapchain image. */
+    uint32_t			frames_in_flight;
+    VkalLatencyMode		latency_mode;
+    uint32_t			frames_rendered; /* Index of the current frame in flight, not a frame counter. */
+
+    VkPresentModeKHR	present_mode_preferences[VKAL_MAX_PRESENT_MODES];
+    uint32_t			present_mode_preference_count;
+    uint32_t			present_modes_set;
+    VkPresentModeKHR	present_mode; /* Mode of the current swapchain. */
+    uint64_t			frame_limit_period_ns; /* 0: no limit. */
+    uint64_t			frame_limit_next_ns;
+
+    /* Timeline backend: every submission to the graphics queue signals the next value of one timeline
+       semaphore. Frames, upload batches and one-shot command buffers then wait on values instead of fences. */
+    uint32_t			timeline_enabled;
+    VkSemaphore			timeline_semaphore;
+    uint64_t			timeline_value; /* Signaled by the latest submission. */
+    uint64_t			frame_values[VKAL_MAX_IMAGES_IN_FLIGHT];
+    uint64_t			image_values[VKAL_MAX_SWAPCHAIN_IMAGES];
+    uint32_t			acquired_image;
+
+    uint32_t			timestamps_supported; /* The graphics queue can write timestamps. */
+    uint64_t			timestamp_mask; /* timestampValidBits of the graphics queue. */
+    uint32_t			host_query_reset;
+    uint32_t			pipeline_statistics_supported;
+    uint32_t			occlusion_query_precise;
+    uint32_t			inherited_queries; /* Secondaries may run inside the primary's statistics scopes and occlusion queries. */
+    VkalGpuProfile		gpu_profile; /* Latest resolved frame, see vkal_get_gpu_profile. */
+
+    VkalFrameStats		frame_stats; /* Frame being recorded. */
+    VkalFrameStats		frame_stats_history[VKAL_FRAME_STATS_HISTORY]; /* Ring of finished frames. */
+    uint32_t			frame_stats_head;
+    uint32_t			frame_stats_count;
+    uint64_t			frame_stats_end_ns; /* When the previous frame ended. */
     //uint32_t current_frame;
     
 	VkalBuffer			default_uniform_buffer;
@@ -332,18 +754,40 @@ typedef struct VkalInfo
     uint64_t		default_vertex_buffer_offset;
     uint64_t		default_index_buffer_offset;
 
+    /* The default uniform memory stays mapped. Writes are flushed once per submit. */
+    void            * uniform_mapped;
+    uint32_t        uniform_coherent;
+    VkDeviceSize    uniform_memory_size;
+    VkalMemoryRange uniform_dirty[VKAL_MAX_UNIFORM_DIRTY_RANGES];
+    uint32_t        uniform_dirty_count;
+    VkDeviceSize    uniform_ring_base;  /* Start of the per-frame uniform ring within the uniform buffer. */
+    VkDeviceSize    uniform_ring_slice; /* Bytes per frame in flight. */
+    VkDeviceSize    uniform_ring_head;  /* Next free byte in the current frame's slice. */
+    VkDeviceSize    uniform_ring_range; /* Largest descriptor range bound with dynamic offsets. */
+
+    /* Per-frame linear allocator, one region per frame in flight. */
+    VkalBuffer      transient_buffer;
+    VkDeviceMemory  device_memory_transient;
+    uint32_t        transient_coherent;
+    VkDeviceSize    transient_region_size;
+    VkDeviceSize    transient_head;    /* Next free byte in the current frame's region. */
+    VkDeviceSize    transient_flushed; /* Everything below this in the current region has been flushed. */
+
     VkDescriptorPool default_descriptor_pool;
 
+    VkPipelineCache         pipeline_cache;
+    char                    pipeline_cache_path[VKAL_MAX_PATH]; /* Empty: no persistence. */
+    uint32_t                pipeline_cache_path_set;
+    VkalPipelineCacheStats  pipeline_cache_stats;
+    VkalPipelineRegistry    pipeline_registry;
+
+    VkalBindStats   bind_stats; /* Totals of finished worker jobs. Use vkal_get_bind_stats. */
+
     uint32_t        raytracing_enabled;
+    uint32_t        multi_draw_indirect;  /* More than one draw per indirect call. Falls back to a loop if not enabled. */
+    uint32_t        draw_indirect_count;  /* The *_indirect_count draws, features12.drawIndirectCount. */
 } VkalInfo;
 
-typedef struct QueueFamilyIndicies {
-    int has_graphics_family;
-    uint32_t graphics_family;
-    int has_present_family;
-    uint32_t present_family;
-} QueueFamilyIndicies;
-
 typedef struct ShaderStageSetup
 {
     VkPipelineShaderStageCreateInfo vertex_shader_create_info;
@@ -365,8 +809,88 @@ typedef struct SingleShaderStageSetup
     uint32_t module;
 } SingleShaderStageSetup;
 
+/* Complete state of a graphics pipeline. Start from vkal_pipeline_desc_default and change what you need.
+   The arrays pointed to only have to live until vkal_create_pipeline returns. */
+typedef struct VkalPipelineDesc
+{
+    VkVertexInputBindingDescription     * vertex_input_bindings;
+    uint32_t                            vertex_input_binding_count;
+    VkVertexInputAttributeDescription   * vertex_attributes;
+    uint32_t                            vertex_attribute_count;
+
+    ShaderStageSetup                    shader_setup;
+    uint32_t                            patch_control_points; /* Only used if tessellation shaders are part of the pipeline. */
+
+    VkPrimitiveTopology                 primitive_topology;
+    VkBool32                            primitive_restart_enable;
+
+    VkPolygonMode                       polygon_mode;
+    VkCullModeFlags                     cull_mode;
+    VkFrontFace                         front_face;
+    VkBool32                            depth_clamp_enable;
+    VkBool32                            depth_bias_enable;
+    float                               depth_bias_constant_factor;
+    float                               depth_bias_slope_factor;
+    float                               line_width;
+
+    VkBool32                            depth_test_enable;
+    VkBool32                            depth_write_enable;
+    VkCompareOp                         depth_compare_op;
+    VkBool32                            stencil_test_enable;
+    VkStencilOpState                    stencil_front;
+    VkStencilOpState                    stencil_back;
+
+    VkSampleCountFlagBits               samples; /* Must match the attachments of the render pass. */
+    VkBool32                            sample_shading_enable;
+    float                               min_sample_shading;
+    VkBool32                            alpha_to_coverage_enable;
+
+    uint32_t                            color_attachment_count; /* Must match the color attachments of the subpass. */
+    VkPipelineColorBlendAttachmentState blend_attachments[VKAL_MAX_COLOR_ATTACHMENTS];
+    float                               blend_constants[4];
+
+    uint32_t                            dynamic_state_count;
+    VkDynamicState                      dynamic_states[VKAL_MAX_DYNAMIC_STATES];
+
+    VkRenderPass                        render_pass;
+    uint32_t                            subpass;
+    VkPipelineLayout                    pipeline_layout;
+} VkalPipelineDesc;
+
+/* Jobs run on the worker threads started by vkal_init. worker_index is in [0, vkal_get_worker_count()). */
+typedef void (*VkalJobFunction)(void * data, uint32_t worker_index);
+
+/* Zero-initialize before the first vkal_submit_job. */
+typedef struct VkalJobGroup
+{
+    uint32_t pending;
+} VkalJobGroup;
+
+typedef struct VkalPipelineBatch VkalPipelineBatch;
+
+typedef struct VkalPipelineBatchJob
+{
+    VkalPipelineBatch           * batch;
+    uint32_t                    index;
+    VkResult                    result;
+    VkPipelineCreationFeedback  feedback;
+} VkalPipelineBatchJob;
+
+/* Pipelines being compiled by vkal_create_pipelines_begin. Must stay at the same address until
+   vkal_create_pipelines_end. */
+struct VkalPipelineBatch
+{
+    VkalJobGroup                group;
+    VkalPipelineDesc const      * descs;
+    uint32_t                    count;
+    VkPipeline                  * out_pipelines;
+    VkalPipelineKey             * keys;
+    uint64_t                    * hashes;
+    uint32_t                    * sources; /* i: compiled. j < i: duplicate of desc j. VKAL_INVALID_HANDLE: already registered. */
+    VkalPipelineBatchJob        * jobs;
+};
+
 #define VKAL_MAX_SURFACE_FORMATS	176
-#define VKAL_MAX_PRESENT_MODES		9
 
 typedef struct SwapChainSupportDetails {
     VkSurfaceCapabilitiesKHR capabilities;
@@ -401,6 +925,14 @@ void vkal_create_instance_sdl(
     char** instance_layers, uint32_t instance_layer_count);
 #endif
 
+/* Creates an instance without a window and a surface. vkal_init will then render into offscreen
+   images of the given size instead of a swapchain. vkal_present does not present anything in this
+   mode, use vkal_read_image to get the pixels of a rendered image back to the host. */
+void vkal_create_instance_headless(
+    uint32_t width, uint32_t height,
+    char** instance_extensions, uint32_t instance_extension_count,
+    char** instance_layers, uint32_t instance_layer_count);
+
 void vkal_find_suitable_devices(
 	char ** extensions, uint32_t extension_count,
 	VkalPhysicalDevice ** out_devices, uint32_t * out_device_count);
@@ -414,8 +946,10 @@ int check_instance_extension_support(
 void create_logical_device(char** extensions, uint32_t extension_count, VkalWantedFeatures vulkan_features);
 QueueFamilyIndicies find_queue_families(VkPhysicalDevice device, VkSurfaceKHR surface);
 void create_swapchain(void);
+void create_headless_images(void);
 void create_image_views(void);
 void recreate_swapchain(void);
+void retire_swapchains(int wait);
 void create_default_framebuffers(void);
 void internal_create_framebuffer(VkFramebufferCreateInfo create_info, uint32_t * out_framebuffer);
 VkFramebuffer get_framebuffer(uint32_t id);
@@ -428,6 +962,8 @@ VkalImage create_vkal_image(
     VkImageUsageFlags usage_flags, VkImageAspectFlags aspect_bits,
 	VkImageLayout layout);
 void create_default_command_buffers(void);
+/* One-shot command buffer from the current frame's transient pool. It is recycled automatically once the
+   frame comes around again, so submit it to the graphics queue within this frame and do not free it. */
 VkCommandBuffer vkal_create_command_buffer(VkCommandBufferLevel cmd_buffer_level, uint32_t begin);
 void create_default_render_pass(void);
 void create_render_to_image_render_pass(void);
@@ -448,6 +984,97 @@ VkPipeline vkal_create_graphics_pipeline(
 void create_graphics_pipeline(VkGraphicsPipelineCreateInfo create_info, uint32_t * out_graphics_pipeline);
 VkPipeline get_graphics_pipeline(uint32_t id);
 void destroy_graphics_pipeline(uint32_t id);
+
+/* Pipelines made from a VkalPipelineDesc are registered under a hash of the description. Creating
+   a pipeline from an identical description returns the existing one and bumps its reference count,
+   vkal_destroy_graphics_pipeline destroys it once every reference is released.
+   vkal_create_graphics_pipeline goes through the registry as well. */
+VkalPipelineDesc vkal_pipeline_desc_default(void);
+VkPipeline vkal_create_pipeline(VkalPipelineDesc const * desc);
+void create_pipeline_registry(void);
+void destroy_pipeline_registry(void);
+
+/* Compiles the descriptions concurrently on the worker threads, through the shared pipeline cache.
+   vkal_create_pipelines_begin returns right away; 'descs' has to stay alive and 'out_pipelines' is only
+   filled once vkal_create_pipelines_end returns. Identical descriptions are compiled once. Begin and end
+   must be called from the thread that owns VKAL, the workers never touch the registry. */
+void vkal_create_pipelines_begin(VkalPipelineBatch * batch, VkalPipelineDesc const * descs, uint32_t count, VkPipeline * out_pipelines);
+int  vkal_pipeline_batch_done(VkalPipelineBatch * batch);
+void vkal_create_pipelines_end(VkalPipelineBatch * batch);
+void vkal_create_pipelines(VkalPipelineDesc const * descs, uint32_t count, VkPipeline * out_pipelines);
+
+void create_job_pool(uint32_t thread_count);
+void destroy_job_pool(void);
+uint32_t vkal_get_worker_count(void);
+void vkal_submit_job(VkalJobGroup * group, VkalJobFunction function, void * data);
+int  vkal_job_group_done(VkalJobGroup * group);
+void vkal_wait_job_group(VkalJobGroup * group);
+
+/* All pipelines are created through vkal_info.pipeline_cache. It is loaded from disk in vkal_init and
+   written back in vkal_cleanup. Call vkal_set_pipeline_cache_path before vkal_init to change the file,
+   NULL keeps the cache in memory only. */
+void vkal_set_pipeline_cache_path(char const * path);
+
+/* Number of frames the CPU may record while the GPU is still busy, 1 to VKAL_MAX_IMAGES_IN_FLIGHT.
+   Call before vkal_init. The latency mode can be changed at any time. */
+void vkal_set_frames_in_flight(uint32_t count);
+void vkal_set_latency_mode(VkalLatencyMode mode);
+
+/* Present modes in order of preference. FIFO is used if none of them is supported. Can be called before
+   vkal_init or at any time later, the swapchain is then recreated at the next vkal_present. */
+void vkal_set_present_modes(VkPresentModeKHR const * present_modes, uint32_t count);
+VkPresentModeKHR vkal_get_present_mode(void);
+/* vkal_get_image holds each frame back until 1/frames_per_second has passed since the previous one started.
+   It sleeps and spins for the last VKAL_FRAME_LIMITER_SPIN_NS. 0 turns the limiter off. */
+void vkal_set_frame_limit(double frames_per_second);
+
+/* Timeline values, see VKAL_USE_TIMELINE_SEMAPHORE. Without the timeline all values are 0 and
+   vkal_wait_value returns right away. */
+uint64_t vkal_submitted_value(void);  /* Value the latest graphics queue submission signals. */
+uint64_t vkal_gpu_progress(void);     /* Highest value the GPU has reached. */
+void     vkal_wait_value(uint64_t value);
+void create_pipeline_cache(void);
+void vkal_save_pipeline_cache(void);
+void vkal_get_pipeline_cache_stats(VkalPipelineCacheStats * out_stats);
+
+/* Compute pipelines live in the same table as graphics pipelines. */
+VkPipeline vkal_create_compute_pipeline(SingleShaderStageSetup shader_setup, VkPipelineLayout pipeline_layout);
+void create_compute_pipeline(VkComputePipelineCreateInfo create_info, uint32_t * out_compute_pipeline);
+void vkal_bind_descriptor_sets_compute(
+	VkCommandBuffer command_buffer,
+	uint32_t first_set, VkDescriptorSet * descriptor_sets, uint32_t descriptor_set_count,
+	VkPipelineLayout pipeline_layout);
+void vkal_dispatch(VkCommandBuffer command_buffer, VkPipeline pipeline, uint32_t group_count_x, uint32_t group_count_y, uint32_t group_count_z);
+void vkal_dispatch_indirect(VkCommandBuffer command_buffer, VkPipeline pipeline, VkBuffer buffer, VkDeviceSize offset);
+
+/* Async compute for the current frame: call vkal_begin_compute after vkal_get_image, record dispatches,
+   then vkal_compute_submit. The next vkal_queue_submit waits for the compute work at 'graphics_wait_stage'.
+   The compute work itself waits for everything submitted to the graphics queue before it, so it can overwrite
+   resources the previous frames read. */
+void create_compute_resources(void);
+void destroy_compute_resources(void);
+VkCommandBuffer vkal_begin_compute(void);
+void vkal_compute_submit(VkCommandBuffer command_buffer, VkPipelineStageFlags graphics_wait_stage);
+
+/* Records items [first, first + count) into a secondary command buffer. Runs on a worker thread, so it
+   must only record commands: use the VkCommandBuffer flavours (vkal_bind_descriptor_set2, vkal_viewport, ...). */
+typedef void (*VkalRecordFunction)(VkCommandBuffer command_buffer, uint32_t first, uint32_t count, void * user_data);
+
+void create_frame_command_pools(void);
+void destroy_frame_command_pools(void);
+/* A secondary command buffer from the current frame's pool of 'worker_index', begun to continue 'subpass'
+   of 'render_pass'. Only valid for this frame and only usable on that worker. */
+VkCommandBuffer vkal_begin_secondary(uint32_t worker_index, VkRenderPass render_pass, uint32_t subpass, VkFramebuffer framebuffer);
+/* Render pass on the default command buffer whose contents come from vkal_record_parallel or vkCmdExecuteCommands. */
+void vkal_begin_render_pass_secondary(uint32_t image_id, VkRenderPass render_pass);
+/* Splits 'item_count' into one chunk per worker, records the chunks concurrently and executes them in order
+   on the default command buffer of 'image_id'. Only for the default render pass and framebuffers (or a pass
+   compatible with them): Call between vkal_begin_render_pass_secondary and vkal_end_renderpass. */
+void vkal_record_parallel(uint32_t image_id, uint32_t item_count, VkalRecordFunction record, void * user_data);
+/* Same for any render pass: 'command_buffer' must be inside 'subpass' of 'render_pass' on 'framebuffer', begun with
+   VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS. Viewport and scissor of the secondaries cover 'extent'. */
+void vkal_record_parallel2(VkCommandBuffer command_buffer, VkRenderPass render_pass, uint32_t subpass, VkFramebuffer framebuffer,
+                           VkExtent2D extent, uint32_t item_count, VkalRecordFunction record, void * user_data);
     
 void create_default_depth_buffer(void);
 void create_default_descriptor_pool(void);
@@ -456,15 +1083,19 @@ void allocate_default_device_memory_uniform(void);
 void allocate_default_device_memory_vertex(void);
 void allocate_default_device_memory_index(void);
 DeviceMemory vkal_allocate_devicememory(uint32_t size, VkBufferUsageFlags buffer_usage_flags, VkMemoryPropertyFlags memory_property_flags, VkFlags mem_alloc_flags);
+void vkal_free_devicememory(DeviceMemory * device_memory);
 void create_default_uniform_buffer(uint32_t size);
 void create_default_vertex_buffer(uint32_t size);
 void create_default_index_buffer(uint32_t size);
 void create_default_semaphores(void);
+void create_timeline_semaphore(void);
+void create_gpu_profiler(void);
+void destroy_gpu_profiler(void);
 void vkal_cleanup(void);
 void flush_to_memory(VkDeviceMemory device_memory, void * dst_memory, void * src_memory, uint32_t size, uint32_t offset);
 uint64_t vkal_vertex_buffer_add(void * vertices, uint32_t vertex_size, uint32_t vertex_count);
 void vkal_vertex_buffer_reset(void);
-void vkal_vertex_buffer_update(void* vertices, uint32_t vertex_count, uint32_t vertex_size, VkDeviceSize offset);
+uint64_t vkal_vertex_buffer_update(void* vertices, uint32_t vertex_count, uint32_t vertex_size, VkDeviceSize offset);
 
 // Define VKAL_INDEX_TYPE_UINT32 to use uint32_t as index-type instead of uint16_t (default).
 uint64_t vkal_index_buffer_add(void * indices, uint32_t index_count);
@@ -491,11 +1122,38 @@ void vkal_update_descriptor_set_texturearray(
 	VkDescriptorType descriptor_type,
 	uint32_t array_element, VkalTexture texture);
 void vkal_update_uniform(UniformBuffer * uniform_buffer, void * data);
+void vkal_flush_uniforms(void);
+
+/* Per-frame uniform ring. Bind the buffer returned by vkal_create_dynamic_uniform_buffer as
+   VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC and pass the offsets returned by vkal_uniform_push
+   to vkal_bind_descriptor_set_dynamic. Pushed data is valid for the current frame only. */
+UniformBuffer vkal_create_dynamic_uniform_buffer(uint32_t size, uint32_t binding);
+uint32_t vkal_uniform_push(void * data, uint32_t size);
+
+/* Bump allocates from the current frame's region of the transient buffer. No driver calls.
+   Must be called after vkal_get_image. The buffer can be used as vertex, index, uniform,
+   storage or indirect buffer. */
+void create_transient_buffer(uint32_t size);
+VkalTransientAllocation vkal_transient_alloc(VkDeviceSize size, VkDeviceSize alignment);
+void vkal_flush_transient(void);
 uint32_t check_memory_type_index(uint32_t const memory_requirement_bits, VkMemoryPropertyFlags const wanted_property);
-void upload_texture(VkImage const image, uint32_t w, uint32_t h, uint32_t n, uint32_t array_layer_count, unsigned char * texture_data);
+uint64_t upload_texture(VkImage const image, uint32_t w, uint32_t h, uint32_t n, uint32_t array_layer_count, unsigned char * texture_data);
 void create_staging_buffer(uint32_t size);
+void create_upload_batches(void);
+void destroy_upload_batches(void);
+void ring_init(VkalRing * ring, VkDeviceSize size);
+int ring_alloc(VkalRing * ring, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize * out_offset);
+void ring_release(VkalRing * ring, VkDeviceSize end);
+
+/* Uploads through the staging ring do not block. They are recorded into a batch that is submitted
+   by vkal_flush_uploads, which vkal_queue_submit and vkal_flush_command_buffer call for you. */
+uint64_t vkal_upload_ticket(void);
+uint64_t vkal_flush_uploads(void);
+void vkal_wait_upload(uint64_t ticket);
+int vkal_upload_finished(uint64_t ticket);
 VkalBuffer create_buffer(uint32_t size, VkBufferUsageFlags usage);
 VkalBuffer vkal_create_buffer(VkDeviceSize size, DeviceMemory * device_memory, VkBufferUsageFlags buffer_usage_flags);
+void vkal_destroy_buffer(VkalBuffer * buffer);
 void vkal_map_buffer(VkalBuffer* buffer);
 void vkal_unmap_buffer(VkalBuffer * buffer);
 void vkal_update_buffer_offset(VkalBuffer * buffer, uint8_t* data, uint32_t byte_count, uint32_t offset);
@@ -528,10 +1186,36 @@ void create_pipeline_layout(
     uint32_t * out_pipeline_layout);
 void destroy_pipeline_layout(uint32_t id);
 VkPipelineLayout get_pipeline_layout(uint32_t id);
-VkDeviceMemory allocate_memory(VkDeviceSize size, uint32_t mem_type_bits);
+VkDeviceMemory allocate_memory(VkDeviceSize size, uint32_t mem_type_bits, VkalMemoryCategory category);
+void free_memory(VkDeviceMemory memory);
 void create_device_memory(VkDeviceSize size, uint32_t mem_type_bits, uint32_t * out_memory_id);
 uint32_t vkal_destroy_device_memory(uint32_t id);
 VkDeviceMemory get_device_memory(uint32_t id);
+VkDeviceSize get_device_memory_offset(uint32_t id);
+void sub_allocate_memory(VkMemoryRequirements requirements, uint32_t mem_type_index, uint32_t linear, VkalMemoryCategory category, uint32_t * out_memory_id);
+void vkal_allocate_image_memory(uint32_t image_id, VkMemoryPropertyFlags memory_property_flags, uint32_t * out_memory_id);
+void destroy_memory_blocks(void);
+void vkal_get_allocator_stats(VkalAllocatorStats * out_stats);
+/* Device memory per heap and category. Heap budget and usage come from VK_EXT_memory_budget if the device
+   supports it. VKAL enables the extension itself. */
+void vkal_get_memory_stats(VkalMemoryStats * out_stats);
+/* Writes vkal_get_memory_stats as JSON into 'buffer', truncated to 'buffer_size' and null terminated.
+   Returns the length of the full string like snprintf, so a return >= buffer_size means it did not fit. */
+uint32_t vkal_memory_stats_to_json(char * buffer, uint32_t buffer_size);
+void free_list_init(VkalFreeList * free_list, VkDeviceSize size);
+int free_list_alloc(VkalFreeList * free_list, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize * out_offset);
+void free_list_free(VkalFreeList * free_list, VkDeviceSize offset, VkDeviceSize size);
+void free_list_destroy(VkalFreeList * free_list);
+
+void handle_pool_init(VkalHandlePool * pool, uint32_t item_size, uint32_t capacity);
+uint32_t handle_pool_alloc(VkalHandlePool * pool, void ** out_item);
+void handle_pool_free(VkalHandlePool * pool, uint32_t handle);
+int handle_pool_valid(VkalHandlePool * pool, uint32_t handle);
+void * handle_pool_get(VkalHandlePool * pool, uint32_t handle);
+uint32_t handle_pool_handle_at(VkalHandlePool * pool, uint32_t slot);
+void handle_pool_destroy(VkalHandlePool * pool);
+void create_handle_pools(void);
+void destroy_handle_pools(void);
 VkWriteDescriptorSet create_write_descriptor_set_image(
 	VkDescriptorSet dst_descriptor_set, uint32_t dst_binding,
 	uint32_t count, VkDescriptorType type,
@@ -574,6 +1258,40 @@ void create_shader_module(uint8_t const * shader_byte_code, int size, uint32_t *
 VkShaderModule get_shader_module(uint32_t id);
 void destroy_shader_module(uint32_t id);
 uint32_t vkal_get_image(void);
+/* The draw wrappers, vkal_viewport and vkal_scissor remember what they bound per command buffer and
+   skip binds that would not change anything. The state is forgotten whenever VKAL begins a command buffer
+   or render pass. Call this after binding or setting state on 'command_buffer' yourself (vkCmd*, ImGui, ...)
+   or after beginning it without VKAL. State is tracked per thread: invalidate on the recording thread. */
+void vkal_invalidate_bind_state(VkCommandBuffer command_buffer);
+/* Includes the binds of the calling thread and of all finished worker jobs. */
+void vkal_get_bind_stats(VkalBindStats * out_stats);
+void vkal_reset_bind_stats(void);
+/* Timestamps around the commands recorded between begin and end. Scopes nest and are matched by name. They
+   belong to the current frame and are resolved once its fence has signaled, in the vkal_get_image of the
+   same frame in flight, so the profile lags behind by vkal_info.frames_in_flight frames. Only use them on
+   command buffers submitted to the graphics queue. Without hostQueryReset (Vulkan 1.2) the query pool is
+   reset by vkal_begin or vkal_begin_command_buffer, so one of them must start the frame. */
+void vkal_gpu_scope_begin(VkCommandBuffer command_buffer, char const * name);
+void vkal_gpu_scope_end(VkCommandBuffer command_buffer, char const * name);
+/* Pipeline statistics and samples passed of the draws and dispatches between begin and end, resolved like the
+   GPU scopes. Statistics scopes cannot nest, nor contain an occlusion query, and must begin and end in the
+   same subpass or both outside of a render pass. vkal_record_parallel and other secondaries from
+   vkal_begin_secondary may only execute inside a scope or occlusion query if vkal_info.inherited_queries is set. */
+void vkal_statistics_scope_begin(VkCommandBuffer command_buffer, char const * name);
+void vkal_statistics_scope_end(VkCommandBuffer command_buffer, char const * name);
+/* Counts the samples that pass the depth and stencil tests between begin and end, e.g. for a bounding box
+   drawn with color and depth writes off. 'query_id' < VKAL_MAX_OCCLUSION_QUERIES is chosen by the caller
+   and may be used once per frame. */
+void vkal_occlusion_query_begin(VkCommandBuffer command_buffer, uint32_t query_id);
+void vkal_occlusion_query_end(VkCommandBuffer command_buffer, uint32_t query_id);
+/* Result of 'query_id' from the latest resolved frame. Returns 0 if that frame did not run the query. */
+int vkal_get_occlusion_result(uint32_t query_id, uint64_t * out_samples_passed);
+void vkal_get_gpu_profile(VkalGpuProfile * out_profile);
+/* Stats of the latest presented frame. Returns 0 if no frame has been presented yet. */
+int vkal_get_frame_stats(VkalFrameStats * out_stats);
+/* Copies up to 'max_count' of the most recent frames, oldest first. Returns how many were copied. */
+uint32_t vkal_get_frame_stats_history(VkalFrameStats * out_stats, uint32_t max_count);
+void vkal_print_gpu_profile(void);
 void vkal_viewport(VkCommandBuffer command_buffer, float x, float y, float width, float height);
 void vkal_scissor(VkCommandBuffer command_buffer, float offset_x, float offset_y, float extent_x, float extent_y);
 void vkal_draw_indexed(
@@ -590,6 +1308,32 @@ void vkal_draw_from_buffers(
     VkalBuffer vertex_buffer,
     uint32_t image_id, VkPipeline pipeline,
     VkDeviceSize vertex_buffer_offset, uint32_t vertex_count);
+/* Indirect draws from the default vertex (and index) buffer, which are bound at offset 0: address your meshes
+   through firstVertex/vertexOffset and firstIndex. 'stride' is the distance between two commands, 0 for tightly
+   packed ones. The count variants take the draw count from 'count_buffer' and need features12.drawIndirectCount. */
+void vkal_draw_indirect(VkCommandBuffer command_buffer, VkPipeline pipeline,
+    VkBuffer buffer, VkDeviceSize offset, uint32_t draw_count, uint32_t stride);
+void vkal_draw_indexed_indirect(VkCommandBuffer command_buffer, VkPipeline pipeline,
+    VkBuffer buffer, VkDeviceSize offset, uint32_t draw_count, uint32_t stride);
+void vkal_draw_indirect_count(VkCommandBuffer command_buffer, VkPipeline pipeline,
+    VkBuffer buffer, VkDeviceSize offset, VkBuffer count_buffer, VkDeviceSize count_offset,
+    uint32_t max_draw_count, uint32_t stride);
+void vkal_draw_indexed_indirect_count(VkCommandBuffer command_buffer, VkPipeline pipeline,
+    VkBuffer buffer, VkDeviceSize offset, VkBuffer count_buffer, VkDeviceSize count_offset,
+    uint32_t max_draw_count, uint32_t stride);
+
+VkalDrawList vkal_create_draw_list(uint32_t max_draw_count, uint32_t indexed);
+void vkal_destroy_draw_list(VkalDrawList * draw_list);
+/* Offset of the current frame's region. Bind [offset, offset + region_size) as storage buffer for a culling shader. */
+VkDeviceSize vkal_draw_list_offset(VkalDrawList const * draw_list);
+/* CPU path: uploads 'count' commands into the current frame's region. */
+uint64_t vkal_draw_list_upload(VkalDrawList * draw_list, void const * commands, uint32_t count);
+/* GPU path: vkal_draw_list_begin clears the region and vkal_draw_list_end makes the compute writes visible to
+   the indirect draws. Record both around your culling dispatch, e.g. on the command buffer of vkal_begin_compute. */
+void vkal_draw_list_begin(VkCommandBuffer command_buffer, VkalDrawList * draw_list);
+void vkal_draw_list_end(VkCommandBuffer command_buffer, VkalDrawList * draw_list);
+/* Draws the current frame's region with a single indirect (count) call. */
+void vkal_draw_list_draw(VkCommandBuffer command_buffer, VkPipeline pipeline, VkalDrawList * draw_list);
 void vkal_draw_indexed2(
     VkCommandBuffer command_buffer, VkPipeline pipeline,
     VkDeviceSize index_buffer_offset, uint32_t index_count,
@@ -627,6 +1371,7 @@ void vkal_end_command_buffer(uint32_t image_id);
 void vkal_end_renderpass(uint32_t image_id);
 void vkal_queue_submit(VkCommandBuffer * command_buffers, uint32_t command_buffer_count);
 void vkal_present(uint32_t image_id);
+void vkal_read_image(uint32_t image_id, void * out_pixels);
 VkDescriptorSetLayout vkal_create_descriptor_set_layout(VkDescriptorSetLayoutBinding * layout, uint32_t binding_count);
 void create_descriptor_set_layout(VkDescriptorSetLayoutBinding * layout, uint32_t binding_count, uint32_t * out_descriptor_set_layout);
 VkDescriptorSetLayout get_descriptor_set_layout(uint32_t id);